@@ -0,0 +1,89 @@
+// bench/json_bench.cpp - core/json.hpp against the implementation it replaced
+//
+// Build with -DBUILD_BENCHMARKS=ON on the host and run ./json_bench. The document mirrors
+// overlay_history.json with 200 entries, the largest file hymod parses on a normal boot.
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include "core/json.hpp"
+#include "json_baseline.hpp"
+
+using namespace hymo;
+using Clock = std::chrono::steady_clock;
+
+// Average microseconds per call of f over n calls
+template <typename F>
+static double bench(int n, F f) {
+    auto start = Clock::now();
+    for (int i = 0; i < n; ++i) {
+        f();
+    }
+    return std::chrono::duration<double, std::micro>(Clock::now() - start).count() / n;
+}
+
+static std::string history_document(int entries) {
+    std::string doc = "[";
+    for (int i = 0; i < entries; ++i) {
+        if (i) {
+            doc += ",";
+        }
+        doc += "{\"target\":\"/system/app/App" + std::to_string(i) +
+               "\",\"layer_hash\":\"a1b2c3d4e5f6\",\"kernel_release\":\"5.15.94-android14\","
+               "\"errno\":0,\"error\":\"\",\"failed\":false,\"timestamp\":1760000000}";
+    }
+    return doc + "]";
+}
+
+int main() {
+    const int runs = 2000;
+    const std::string doc = history_document(200);
+    const std::string path = "/data/adb/modules/some_module/system/bin/tool";
+
+    json::Value current = json::parse(doc);
+    json_baseline::Value baseline = json_baseline::parse(doc);
+    if (json::dump(json::parse(json::dump(current))) != json::dump(current)) {
+        fprintf(stderr, "round trip mismatch\n");
+        return 1;
+    }
+
+    volatile size_t sink = 0;
+    printf("sizeof(Value)   baseline %zu B, current %zu B\n", sizeof(json_baseline::Value),
+           sizeof(json::Value));
+    printf("parse           baseline %8.1f us, current %8.1f us\n",
+           bench(runs, [&] { sink += json_baseline::parse(doc).a.size(); }),
+           bench(runs, [&] { sink += json::parse(doc).as_array().size(); }));
+    printf("dump            baseline %8.1f us, current %8.1f us\n",
+           bench(runs, [&] { sink += json_baseline::dump(baseline, 2).size(); }),
+           bench(runs, [&] { sink += json::dump(current, 2).size(); }));
+    printf("escape          baseline %8.2f us, current %8.2f us\n",
+           bench(runs * 100, [&] { sink += json_baseline::escape_string(path).size(); }),
+           bench(runs * 100, [&] { sink += json::escape_string(path).size(); }));
+
+    printf("pull scan       current  %8.1f us\n", bench(runs, [&] {
+               json::Reader reader(doc);
+               for (json::Token t = reader.next(); t != json::Token::End && t != json::Token::Error;
+                    t = reader.next()) {
+                   sink += 1;
+               }
+           }));
+    std::string out;
+    printf("streaming write current  %8.1f us\n", bench(runs, [&] {
+               out.clear();
+               json::Writer w(out, 2);
+               w.begin_array();
+               for (int i = 0; i < 200; ++i) {
+                   w.begin_object()
+                       .field("target", "/system/app/App")
+                       .field("layer_hash", "a1b2c3d4e5f6")
+                       .field("kernel_release", "5.15.94-android14")
+                       .field("errno", 0)
+                       .field("error", "")
+                       .field("failed", false)
+                       .field("timestamp", 1760000000LL)
+                       .end_object();
+               }
+               w.end_array();
+               sink += out.size();
+           }));
+    return 0;
+}
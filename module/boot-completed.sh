@@ -2,6 +2,7 @@
 # Hymo boot-completed.sh
 # Clean up boot flags for next boot
 
+MODDIR="${0%/*}"
 BASE_DIR="/data/adb/hymo"
 LOG_FILE="$BASE_DIR/daemon.log"
 
@@ -21,3 +22,15 @@ if [ -f "$BASE_DIR/boot_count" ]; then
     echo "0" > "$BASE_DIR/boot_count"
     log "Boot completed, reset boot count"
 fi
+
+# Optional resident query daemon for faster WebUI/CLI queries
+if [ -f "$BASE_DIR/enable_daemon" ]; then
+    "$MODDIR/hymod" daemon >/dev/null 2>&1 &
+    log "Started hymod daemon"
+fi
+
+# Optional watcher that hot-applies module installs, updates and removals
+if [ -f "$BASE_DIR/enable_watch" ]; then
+    "$MODDIR/hymod" watch >/dev/null 2>&1 &
+    log "Started hymod module watcher"
+fi
@@ -56,7 +56,6 @@ fi
 
 # Handle Image Creation (Borrowed from meta-overlayfs)
 IMG_FILE="$BASE_DIR/modules.img"
-IMG_SIZE_MB=2048
 
 # Check if force_ext4 is enabled in config 
 if [ -f "$BASE_DIR/config.json" ]; then
@@ -72,13 +71,13 @@ if [ ! -f "$IMG_FILE" ]; then
         ui_print "- Kernel supports tmpfs. Skipping ext4 image creation."
     else
         if [ "$FORCE_EXT4" = true ]; then
-             ui_print "- Creating 2GB ext4 image (Forced Mode)..."
+             ui_print "- Creating ext4 image (Forced Mode)..."
         else
-             ui_print "- Creating 2GB ext4 image for module storage..."
+             ui_print "- Creating ext4 image for module storage..."
         fi
         
-        # Use hymod to create image
-        $MODPATH/hymod config create-image "$BASE_DIR"
+        # Use hymod to create image, sized to the installed modules; it grows on demand
+        $MODPATH/hymod config create-image "$BASE_DIR" --size auto
         
         if [ $? -ne 0 ]; then
             ui_print "! Failed to format ext4 image"
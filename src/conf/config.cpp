@@ -4,21 +4,120 @@
 #include <iostream>
 #include <sstream>
 #include "../core/json.hpp"
+#include "../core/snapshot.hpp"
 #include "../defs.hpp"
 #include "../utils.hpp"
 
 namespace hymo {
 
+// Everything load_default() reads; the snapshot is only reused while all three are unchanged
+static std::string config_sources_signature() {
+    fs::path base(BASE_DIR);
+    return file_signature(base / CONFIG_FILENAME) + file_signature(base / "module_mode.json") +
+           file_signature(base / "module_rules.json");
+}
+
+static Config config_from_snapshot(const SnapshotView& snap) {
+    Config config;
+    config.moduledir = std::string(snap.get("moduledir"));
+    config.tempdir = std::string(snap.get("tempdir"));
+    config.mountsource = std::string(snap.get("mountsource"));
+    config.debug = snap.get_bool("debug", config.debug);
+    config.verbose = snap.get_bool("verbose", config.verbose);
+    config.fs_type = filesystem_type_from_string(std::string(snap.get("fs_type")));
+    config.disable_umount = snap.get_bool("disable_umount", config.disable_umount);
+    config.enable_nuke = snap.get_bool("enable_nuke", config.enable_nuke);
+    config.ignore_protocol_mismatch =
+        snap.get_bool("ignore_protocol_mismatch", config.ignore_protocol_mismatch);
+    config.enable_kernel_debug = snap.get_bool("enable_kernel_debug", config.enable_kernel_debug);
+    config.enable_stealth = snap.get_bool("enable_stealth", config.enable_stealth);
+    config.hymofs_enabled = snap.get_bool("hymofs_enabled", config.hymofs_enabled);
+    config.mirror_path = std::string(snap.get("mirror_path"));
+    config.uname_release = std::string(snap.get("uname_release"));
+    config.uname_version = std::string(snap.get("uname_version"));
+    config.mount_stage = std::string(snap.get("mount_stage"));
+    config.sync_jobs = static_cast<int>(snap.get_int("sync_jobs", config.sync_jobs));
+    config.dedup = snap.get_bool("dedup", config.dedup);
+    config.erofs_recompress = snap.get_bool("erofs_recompress", config.erofs_recompress);
+    config.tmpfs_max_ram_percent =
+        static_cast<int>(snap.get_int("tmpfs_max_ram_percent", config.tmpfs_max_ram_percent));
+    config.max_mounts = static_cast<int>(snap.get_int("max_mounts", config.max_mounts));
+    config.partitions = snap.get_list("partitions");
+
+    for (std::string_view id : snap.keys_with_prefix("mode/")) {
+        config.module_modes[std::string(id)] = std::string(snap.get("mode/" + std::string(id)));
+    }
+    // Rules are stored as one flat list of path, mode pairs per module
+    for (std::string_view id : snap.keys_with_prefix("rules/")) {
+        std::vector<std::string> flat = snap.get_list("rules/" + std::string(id));
+        auto& rules = config.module_rules[std::string(id)];
+        for (size_t i = 0; i + 1 < flat.size(); i += 2) {
+            rules.push_back({flat[i], flat[i + 1]});
+        }
+    }
+    return config;
+}
+
+static void write_config_snapshot(const Config& config, const std::string& source) {
+    SnapshotBuilder snap;
+    snap.set("moduledir", config.moduledir.string());
+    snap.set("tempdir", config.tempdir.string());
+    snap.set("mountsource", config.mountsource);
+    snap.set_bool("debug", config.debug);
+    snap.set_bool("verbose", config.verbose);
+    snap.set("fs_type", filesystem_type_to_string(config.fs_type));
+    snap.set_bool("disable_umount", config.disable_umount);
+    snap.set_bool("enable_nuke", config.enable_nuke);
+    snap.set_bool("ignore_protocol_mismatch", config.ignore_protocol_mismatch);
+    snap.set_bool("enable_kernel_debug", config.enable_kernel_debug);
+    snap.set_bool("enable_stealth", config.enable_stealth);
+    snap.set_bool("hymofs_enabled", config.hymofs_enabled);
+    snap.set("mirror_path", config.mirror_path);
+    snap.set("uname_release", config.uname_release);
+    snap.set("uname_version", config.uname_version);
+    snap.set("mount_stage", config.mount_stage);
+    snap.set_int("sync_jobs", config.sync_jobs);
+    snap.set_bool("dedup", config.dedup);
+    snap.set_bool("erofs_recompress", config.erofs_recompress);
+    snap.set_int("tmpfs_max_ram_percent", config.tmpfs_max_ram_percent);
+    snap.set_int("max_mounts", config.max_mounts);
+    snap.set_list("partitions", config.partitions);
+    for (const auto& [id, mode] : config.module_modes) {
+        snap.set("mode/" + id, mode);
+    }
+    for (const auto& [id, rules] : config.module_rules) {
+        std::vector<std::string> flat;
+        for (const auto& rule : rules) {
+            flat.push_back(rule.path);
+            flat.push_back(rule.mode);
+        }
+        snap.set_list("rules/" + id, flat);
+    }
+
+    if (!ensure_dir_exists(RUN_DIR) ||
+        !snap.write(CONFIG_SNAPSHOT_FILE, SnapshotKind::Config, source)) {
+        LOG_DEBUG("Could not write config snapshot");
+    }
+}
+
 Config Config::load_default() {
+    // Taken before reading: if a file changes mid-read the snapshot is simply rebuilt next time
+    std::string source = config_sources_signature();
+    SnapshotView snap;
+    if (snap.open_fresh(CONFIG_SNAPSHOT_FILE, SnapshotKind::Config, source)) {
+        return config_from_snapshot(snap);
+    }
+
     Config config;
-    fs::path default_path = fs::path(BASE_DIR) / "config.json";
+    fs::path default_path = fs::path(BASE_DIR) / CONFIG_FILENAME;
     if (fs::exists(default_path)) {
         try {
-            return from_file(default_path);
+            config = from_file(default_path);
         } catch (...) {
             LOG_WARN("Failed to load default config, using defaults");
         }
     }
+    write_config_snapshot(config, source);
     return config;
 }
 
@@ -36,7 +135,7 @@ Config Config::from_file(const fs::path& path) {
 
     try {
         json::Value root = json::parse(json_str);
-        if (root.type == json::Type::Object) {
+        if (root.type() == json::Type::Object) {
             const auto& o = root.as_object();
 
             if (o.count("moduledir"))
@@ -71,10 +170,21 @@ Config Config::from_file(const fs::path& path) {
                 config.uname_version = o.at("uname_version").as_string();
             if (o.count("mount_stage"))
                 config.mount_stage = o.at("mount_stage").as_string();
-
-            if (o.count("partitions") && o.at("partitions").type == json::Type::Array) {
+            if (o.count("sync_jobs"))
+                config.sync_jobs = static_cast<int>(o.at("sync_jobs").as_number());
+            if (o.count("dedup"))
+                config.dedup = o.at("dedup").as_bool();
+            if (o.count("erofs_recompress"))
+                config.erofs_recompress = o.at("erofs_recompress").as_bool();
+            if (o.count("tmpfs_max_ram_percent"))
+                config.tmpfs_max_ram_percent =
+                    static_cast<int>(o.at("tmpfs_max_ram_percent").as_number());
+            if (o.count("max_mounts"))
+                config.max_mounts = static_cast<int>(o.at("max_mounts").as_number());
+
+            if (o.count("partitions") && o.at("partitions").type() == json::Type::Array) {
                 for (const auto& p : o.at("partitions").as_array()) {
-                    if (p.type == json::Type::String) {
+                    if (p.type() == json::Type::String) {
                         config.partitions.push_back(p.as_string());
                     }
                 }
@@ -120,6 +230,13 @@ bool Config::save_to_file(const fs::path& path) const {
         root["uname_version"] = json::Value(uname_version);
     if (!mount_stage.empty())
         root["mount_stage"] = json::Value(mount_stage);
+    if (sync_jobs > 0)
+        root["sync_jobs"] = json::Value(sync_jobs);
+    root["dedup"] = json::Value(dedup);
+    root["erofs_recompress"] = json::Value(erofs_recompress);
+    root["tmpfs_max_ram_percent"] = json::Value(tmpfs_max_ram_percent);
+    if (max_mounts > 0)
+        root["max_mounts"] = json::Value(max_mounts);
 
     if (!partitions.empty()) {
         json::Value parts = json::Value::array();
@@ -169,9 +286,9 @@ std::map<std::string, std::string> load_module_modes() {
 
     try {
         auto root = json::parse(buffer.str());
-        if (root.type == json::Type::Object) {
+        if (root.type() == json::Type::Object) {
             for (const auto& [key, val] : root.as_object()) {
-                if (val.type == json::Type::String) {
+                if (val.type() == json::Type::String) {
                     modes[key] = val.as_string();
                 }
             }
@@ -195,11 +312,11 @@ std::map<std::string, std::vector<ModuleRuleConfig>> load_module_rules() {
 
     try {
         auto root = json::parse(buffer.str());
-        if (root.type == json::Type::Object) {
+        if (root.type() == json::Type::Object) {
             for (const auto& [mod_id, list] : root.as_object()) {
-                if (list.type == json::Type::Array) {
+                if (list.type() == json::Type::Array) {
                     for (const auto& rule : list.as_array()) {
-                        if (rule.type == json::Type::Object) {
+                        if (rule.type() == json::Type::Object) {
                             const auto& ro = rule.as_object();
                             if (ro.count("path") && ro.count("mode")) {
                                 rules[mod_id].push_back(
@@ -15,7 +15,7 @@ struct ModuleRuleConfig {
     std::string mode;
 };
 
-enum class FilesystemType { AUTO, EXT4, EROFS_FS, TMPFS };
+enum class FilesystemType { AUTO, EXT4, EROFS_FS, TMPFS, DIRECT, ZRAM };
 
 // Convert string to FilesystemType
 inline FilesystemType filesystem_type_from_string(const std::string& str) {
@@ -25,6 +25,10 @@ inline FilesystemType filesystem_type_from_string(const std::string& str) {
         return FilesystemType::EROFS_FS;
     if (str == "tmpfs")
         return FilesystemType::TMPFS;
+    if (str == "direct")
+        return FilesystemType::DIRECT;
+    if (str == "zram")
+        return FilesystemType::ZRAM;
     return FilesystemType::AUTO;
 }
 
@@ -37,6 +41,10 @@ inline std::string filesystem_type_to_string(FilesystemType type) {
         return "erofs";
     case FilesystemType::TMPFS:
         return "tmpfs";
+    case FilesystemType::DIRECT:
+        return "direct";
+    case FilesystemType::ZRAM:
+        return "zram";
     default:
         return "auto";
     }
@@ -59,6 +67,11 @@ struct Config {
     std::string uname_release;
     std::string uname_version;
     std::string mount_stage = "metamount";  // "post-fs-data", "metamount", "services"
+    int sync_jobs = 0;                      // Parallel copy streams for module sync, 0 = auto
+    bool dedup = false;                     // Hardlink identical files across modules in storage
+    bool erofs_recompress = false;          // Repack EROFS images with lz4hc after boot
+    int tmpfs_max_ram_percent = 25;         // Largest share of RAM tmpfs storage may claim
+    int max_mounts = 0;                     // Mounts a run may add, 0 = unlimited
     std::vector<std::string> partitions;
     std::map<std::string, std::string> module_modes;
     std::map<std::string, std::vector<ModuleRuleConfig>> module_rules;
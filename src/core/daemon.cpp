@@ -0,0 +1,315 @@
+// core/daemon.cpp - Resident query server implementation
+#include "daemon.hpp"
+#include <dirent.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstddef>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <utility>
+#include "../utils.hpp"
+
+namespace hymo {
+
+// Abstract socket: no filesystem entry to clean up, gone once the daemon exits
+static constexpr char SOCKET_NAME[] = "hymo_daemon";
+static constexpr size_t MAX_REQUEST_BYTES = 4096;
+static constexpr int CLIENT_TIMEOUT_MS = 2000;
+// Uncached replies such as storage usage may walk the module tree
+static constexpr int REPLY_TIMEOUT_MS = 30000;
+
+static volatile sig_atomic_t g_stop = 0;
+
+static void request_stop(int) {
+    g_stop = 1;
+}
+
+static socklen_t socket_address(struct sockaddr_un& addr) {
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    // sun_path[0] stays NUL, which selects the abstract namespace
+    memcpy(addr.sun_path + 1, SOCKET_NAME, sizeof(SOCKET_NAME) - 1);
+    return static_cast<socklen_t>(offsetof(struct sockaddr_un, sun_path) + sizeof(SOCKET_NAME));
+}
+
+static void set_timeouts(int fd, int ms) {
+    struct timeval tv;
+    tv.tv_sec = ms / 1000;
+    tv.tv_usec = (ms % 1000) * 1000;
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+}
+
+static bool send_all(int fd, const std::string& data) {
+    size_t sent = 0;
+    while (sent < data.size()) {
+        ssize_t n = send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        sent += static_cast<size_t>(n);
+    }
+    return true;
+}
+
+static bool recv_all(int fd, std::string& out, size_t limit) {
+    char buf[4096];
+    for (;;) {
+        ssize_t n = recv(fd, buf, sizeof(buf), 0);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            return false;
+        }
+        if (n == 0) {
+            return true;
+        }
+        out.append(buf, static_cast<size_t>(n));
+        if (out.size() > limit) {
+            return false;
+        }
+    }
+}
+
+// Reply layout: "<exit code> <stdout length>\n" followed by stdout, then stderr
+static std::string run_request(const DaemonHandler& handler,
+                               const std::vector<std::string>& request) {
+    std::ostringstream out, err;
+    std::streambuf* old_out = std::cout.rdbuf(out.rdbuf());
+    std::streambuf* old_err = std::cerr.rdbuf(err.rdbuf());
+    int code = 1;
+    try {
+        code = handler(request);
+    } catch (const std::exception& e) {
+        err << "Error: " << e.what() << "\n";
+    }
+    std::cout.rdbuf(old_out);
+    std::cerr.rdbuf(old_err);
+
+    std::string stdout_data = out.str();
+    return std::to_string(code) + " " + std::to_string(stdout_data.size()) + "\n" + stdout_data +
+           err.str();
+}
+
+struct CachedReply {
+    std::string key;
+    std::string reply;
+};
+
+static void serve_client(int listen_fd, const DaemonHandler& handler,
+                         const DaemonCacheKey& cache_key, uint64_t mount_generation,
+                         std::map<std::string, CachedReply>& cache) {
+    int client = accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+    if (client < 0) {
+        return;
+    }
+
+    // Anything in the network namespace can reach an abstract socket; only root may ask
+    struct ucred cred = {};
+    socklen_t cred_len = sizeof(cred);
+    if (getsockopt(client, SOL_SOCKET, SO_PEERCRED, &cred, &cred_len) != 0) {
+        LOG_WARN("Rejected daemon client: " + std::string(strerror(errno)));
+        close(client);
+        return;
+    }
+    if (cred.uid != 0) {
+        LOG_WARN("Rejected daemon client (uid " + std::to_string(cred.uid) + ")");
+        close(client);
+        return;
+    }
+
+    set_timeouts(client, CLIENT_TIMEOUT_MS);
+    std::string payload;
+    if (!recv_all(client, payload, MAX_REQUEST_BYTES)) {
+        close(client);
+        return;
+    }
+
+    std::vector<std::string> request;
+    std::istringstream lines(payload);
+    std::string line;
+    while (std::getline(lines, line)) {
+        request.push_back(line);
+    }
+    if (request.empty()) {
+        close(client);
+        return;
+    }
+
+    std::string id;
+    for (const auto& part : request) {
+        id += part + '\n';
+    }
+    std::string key = cache_key(request, mount_generation);
+    auto it = cache.find(id);
+    std::string reply;
+    if (!key.empty() && it != cache.end() && it->second.key == key) {
+        LOG_DEBUG("Daemon cache hit: " + request[0]);
+        reply = it->second.reply;
+    } else {
+        reply = run_request(handler, request);
+        if (!key.empty()) {
+            cache[id] = CachedReply{key, reply};
+        } else if (it != cache.end()) {
+            cache.erase(it);
+        }
+    }
+
+    send_all(client, reply);
+    close(client);
+}
+
+int run_daemon(const DaemonHandler& handler, const DaemonCacheKey& cache_key) {
+    int listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listen_fd < 0) {
+        LOG_ERROR("Daemon socket failed: " + std::string(strerror(errno)));
+        return 1;
+    }
+    struct sockaddr_un addr;
+    socklen_t addr_len = socket_address(addr);
+    if (bind(listen_fd, reinterpret_cast<struct sockaddr*>(&addr), addr_len) != 0) {
+        if (errno == EADDRINUSE) {
+            LOG_ERROR("hymod daemon is already running");
+        } else {
+            LOG_ERROR("Daemon bind failed: " + std::string(strerror(errno)));
+        }
+        close(listen_fd);
+        return 1;
+    }
+    if (listen(listen_fd, 16) != 0) {
+        LOG_ERROR("Daemon listen failed: " + std::string(strerror(errno)));
+        close(listen_fd);
+        return 1;
+    }
+
+    // The kernel flags mountinfo with POLLPRI whenever the mount table changes
+    int mounts_fd = open("/proc/self/mountinfo", O_RDONLY | O_CLOEXEC);
+    uint64_t mount_generation = 0;
+
+    struct sigaction sa = {};
+    sa.sa_handler = request_stop;
+    sigaction(SIGTERM, &sa, nullptr);
+    sigaction(SIGINT, &sa, nullptr);
+    signal(SIGPIPE, SIG_IGN);
+
+    std::map<std::string, CachedReply> cache;
+    LOG_INFO("Daemon listening on @" + std::string(SOCKET_NAME));
+
+    while (!g_stop) {
+        struct pollfd fds[2] = {{listen_fd, POLLIN, 0}, {mounts_fd, POLLPRI, 0}};
+        int ready = poll(fds, mounts_fd >= 0 ? 2 : 1, -1);
+        if (ready < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            LOG_ERROR("Daemon poll failed: " + std::string(strerror(errno)));
+            break;
+        }
+        if (mounts_fd >= 0 && (fds[1].revents & (POLLPRI | POLLERR))) {
+            ++mount_generation;
+        }
+        if (fds[0].revents & POLLIN) {
+            serve_client(listen_fd, handler, cache_key, mount_generation, cache);
+        }
+    }
+
+    LOG_INFO("Daemon stopping");
+    if (mounts_fd >= 0) {
+        close(mounts_fd);
+    }
+    close(listen_fd);
+    return 0;
+}
+
+bool forward_to_daemon(const std::vector<std::string>& request, int& exit_code) {
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return false;
+    }
+    struct sockaddr_un addr;
+    socklen_t addr_len = socket_address(addr);
+    if (connect(fd, reinterpret_cast<struct sockaddr*>(&addr), addr_len) != 0) {
+        close(fd);
+        return false;
+    }
+    set_timeouts(fd, REPLY_TIMEOUT_MS);
+
+    std::string payload;
+    for (const auto& part : request) {
+        payload += part + '\n';
+    }
+    std::string reply;
+    bool ok = send_all(fd, payload) && shutdown(fd, SHUT_WR) == 0 &&
+              recv_all(fd, reply, SIZE_MAX);
+    close(fd);
+
+    size_t header_end = reply.find('\n');
+    if (!ok || header_end == std::string::npos) {
+        return false;
+    }
+    int code = 0;
+    unsigned long long stdout_len = 0;
+    if (sscanf(reply.c_str(), "%d %llu", &code, &stdout_len) != 2 ||
+        stdout_len > reply.size() - header_end - 1) {
+        return false;
+    }
+
+    std::cout << reply.substr(header_end + 1, stdout_len) << std::flush;
+    std::cerr << reply.substr(header_end + 1 + stdout_len) << std::flush;
+    exit_code = code;
+    return true;
+}
+
+std::string module_tree_signature(const fs::path& module_dir,
+                                  const std::vector<std::string>& partitions) {
+    std::string signature = file_signature(module_dir);
+    DIR* dir = opendir(module_dir.c_str());
+    if (!dir) {
+        return signature;
+    }
+    std::vector<std::string> entries;
+    while (struct dirent* entry = readdir(dir)) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+            continue;
+        }
+        fs::path module_path = module_dir / entry->d_name;
+        std::string module_sig = std::string(entry->d_name) + "=" +
+                                 file_signature(module_path) +
+                                 file_signature(module_path / "module.prop") +
+                                 file_signature(module_path / "hymo_rules.conf");
+        // Directory mtimes move whenever an entry below them is added or removed, which is
+        // all the module list derives from partition contents
+        for (const auto& partition : partitions) {
+            fs::path part_path = module_path / partition;
+            module_sig += partition + ":" + file_signature(part_path);
+            walk_tree(part_path, [&](const WalkEntry& e) {
+                if (e.type == DT_DIR) {
+                    module_sig += file_signature(part_path / e.rel);
+                }
+                return true;
+            });
+        }
+        entries.push_back(std::move(module_sig));
+    }
+    closedir(dir);
+
+    std::sort(entries.begin(), entries.end());
+    for (const auto& entry : entries) {
+        signature += entry;
+    }
+    return signature;
+}
+
+}  // namespace hymo
@@ -0,0 +1,38 @@
+// core/daemon.hpp - Resident query server on an abstract Unix socket
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+namespace hymo {
+
+// Runs one request (command followed by its arguments) and returns the exit code to hand
+// back to the client. Whatever it prints to std::cout and std::cerr becomes the reply.
+using DaemonHandler = std::function<int(const std::vector<std::string>& request)>;
+
+// Validity key for the reply to `request`. Replies are reused while the key is unchanged;
+// an empty key means the request is never cached. `mount_generation` increases whenever
+// the mount table changes.
+using DaemonCacheKey =
+    std::function<std::string(const std::vector<std::string>& request, uint64_t mount_generation)>;
+
+// Serve requests until SIGTERM/SIGINT. Only root peers are answered. Returns an exit code;
+// fails if another daemon already owns the socket.
+int run_daemon(const DaemonHandler& handler, const DaemonCacheKey& cache_key);
+
+// Hand `request` to a running daemon and copy its reply to stdout. Returns false, having
+// written nothing, when no daemon answers; the caller then runs the command itself.
+bool forward_to_daemon(const std::vector<std::string>& request, int& exit_code);
+
+// Cheap change detector for cache keys covering module directories, their module.prop and
+// hymo_rules.conf files and the directories under each partition; adding, removing,
+// disabling or updating a module changes it
+std::string module_tree_signature(const fs::path& module_dir,
+                                  const std::vector<std::string>& partitions);
+
+}  // namespace hymo
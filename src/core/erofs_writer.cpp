@@ -0,0 +1,709 @@
+// core/erofs_writer.cpp - In-process EROFS image writer implementation
+#include "erofs_writer.hpp"
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/sysmacros.h>
+#include <sys/xattr.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <ctime>
+#include <map>
+#include <system_error>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include "../defs.hpp"
+#include "../utils.hpp"
+
+namespace hymo {
+
+// On-disk format, see fs/erofs/erofs_fs.h in the kernel tree
+static constexpr uint32_t EROFS_SUPER_MAGIC_V1 = 0xE0F5E1E2;
+static constexpr uint64_t EROFS_SUPER_OFFSET = 1024;
+static constexpr size_t EROFS_SUPER_SIZE = 128;
+static constexpr size_t EROFS_INODE_COMPACT_SIZE = 32;
+static constexpr size_t EROFS_INODE_EXTENDED_SIZE = 64;
+static constexpr size_t EROFS_ISLOT_SIZE = 32;  // nid granularity
+static constexpr size_t EROFS_DIRENT_SIZE = 12;
+static constexpr size_t EROFS_XATTR_IBODY_HEADER_SIZE = 12;
+static constexpr size_t EROFS_XATTR_ENTRY_SIZE = 4;
+static constexpr uint16_t EROFS_INODE_FLAT_PLAIN = 0;
+static constexpr uint16_t EROFS_INODE_FLAT_INLINE = 2;
+
+enum : uint8_t {
+    EROFS_FT_UNKNOWN = 0,
+    EROFS_FT_REG_FILE,
+    EROFS_FT_DIR,
+    EROFS_FT_CHRDEV,
+    EROFS_FT_BLKDEV,
+    EROFS_FT_FIFO,
+    EROFS_FT_SOCK,
+    EROFS_FT_SYMLINK,
+};
+
+struct XattrPrefix {
+    uint8_t index;
+    const char* prefix;
+};
+
+// Whole-name ACL entries first so they are not taken for a "system." prefix
+static const XattrPrefix XATTR_PREFIXES[] = {
+    {2, "system.posix_acl_access"},
+    {3, "system.posix_acl_default"},
+    {1, "user."},
+    {4, "trusted."},
+    {6, "security."},
+};
+
+using DirEntries = std::vector<std::pair<std::string, size_t>>;
+
+struct ErofsNode {
+    fs::path source;  // Empty for the synthesized image root
+    struct stat st {};
+    std::string link_target;
+    std::vector<uint8_t> xattrs;  // Encoded inline xattr body, empty if none
+    DirEntries children;  // Name and node index
+    size_t parent = 0;
+    uint32_t nlink = 1;
+    uint64_t size = 0;
+    bool extended = false;
+    uint16_t layout = EROFS_INODE_FLAT_PLAIN;
+    uint64_t meta_offset = 0;  // Inode position relative to the metadata area
+    uint32_t blkaddr = 0;
+    uint32_t nblocks = 0;
+    std::vector<uint8_t> dir_data;
+};
+
+static void put16(uint8_t* p, uint16_t v) {
+    p[0] = v & 0xff;
+    p[1] = v >> 8;
+}
+
+static void put32(uint8_t* p, uint32_t v) {
+    for (int i = 0; i < 4; ++i) {
+        p[i] = (v >> (8 * i)) & 0xff;
+    }
+}
+
+static void put64(uint8_t* p, uint64_t v) {
+    for (int i = 0; i < 8; ++i) {
+        p[i] = (v >> (8 * i)) & 0xff;
+    }
+}
+
+static uint64_t align_up(uint64_t v, uint64_t a) {
+    return (v + a - 1) / a * a;
+}
+
+static uint8_t file_type_of(mode_t mode) {
+    switch (mode & S_IFMT) {
+    case S_IFREG:
+        return EROFS_FT_REG_FILE;
+    case S_IFDIR:
+        return EROFS_FT_DIR;
+    case S_IFCHR:
+        return EROFS_FT_CHRDEV;
+    case S_IFBLK:
+        return EROFS_FT_BLKDEV;
+    case S_IFIFO:
+        return EROFS_FT_FIFO;
+    case S_IFSOCK:
+        return EROFS_FT_SOCK;
+    case S_IFLNK:
+        return EROFS_FT_SYMLINK;
+    }
+    return EROFS_FT_UNKNOWN;
+}
+
+static void append_xattr(std::vector<uint8_t>& body, uint8_t index, const std::string& suffix,
+                         const std::string& value) {
+    if (body.empty()) {
+        body.assign(EROFS_XATTR_IBODY_HEADER_SIZE, 0);
+    }
+    size_t at = body.size();
+    body.resize(at + EROFS_XATTR_ENTRY_SIZE);
+    body[at] = static_cast<uint8_t>(suffix.size());
+    body[at + 1] = index;
+    put16(&body[at + 2], static_cast<uint16_t>(value.size()));
+    body.insert(body.end(), suffix.begin(), suffix.end());
+    body.insert(body.end(), value.begin(), value.end());
+    body.resize(align_up(body.size(), EROFS_XATTR_ENTRY_SIZE), 0);
+}
+
+// `selinux`, when not empty, replaces the source's security.selinux
+static std::vector<uint8_t> encode_xattrs(const fs::path& path, const std::string& selinux = {}) {
+    std::vector<uint8_t> body;
+    if (!selinux.empty()) {
+        append_xattr(body, 6, "selinux", std::string(selinux.c_str(), selinux.size() + 1));
+    }
+    ssize_t len = llistxattr(path.c_str(), nullptr, 0);
+    if (len <= 0) {
+        return body;
+    }
+    std::string names(static_cast<size_t>(len), '\0');
+    len = llistxattr(path.c_str(), &names[0], names.size());
+    if (len <= 0) {
+        return body;
+    }
+    names.resize(static_cast<size_t>(len));
+
+    for (size_t pos = 0; pos < names.size();) {
+        std::string name(names.c_str() + pos);
+        pos += name.size() + 1;
+        if (!selinux.empty() && name == "security.selinux") {
+            continue;
+        }
+
+        const XattrPrefix* prefix = nullptr;
+        for (const auto& candidate : XATTR_PREFIXES) {
+            if (name.compare(0, strlen(candidate.prefix), candidate.prefix) == 0) {
+                prefix = &candidate;
+                break;
+            }
+        }
+        if (!prefix) {
+            LOG_VERBOSE("erofs: dropping unsupported xattr " + name + " on " + path.string());
+            continue;
+        }
+
+        ssize_t vlen = lgetxattr(path.c_str(), name.c_str(), nullptr, 0);
+        if (vlen < 0) {
+            continue;
+        }
+        std::string value(static_cast<size_t>(vlen), '\0');
+        vlen = lgetxattr(path.c_str(), name.c_str(), &value[0], value.size());
+        if (vlen < 0) {
+            continue;
+        }
+        value.resize(static_cast<size_t>(vlen));
+
+        std::string suffix = name.substr(strlen(prefix->prefix));
+        if (suffix.size() > 0xff || value.size() > 0xffff) {
+            continue;
+        }
+        append_xattr(body, prefix->index, suffix, value);
+    }
+    return body;
+}
+
+// Directory entries in on-disk order, "." and ".." sorted in with the rest
+static DirEntries dir_entries(const std::vector<ErofsNode>& nodes, size_t index) {
+    DirEntries entries = nodes[index].children;
+    entries.emplace_back(".", index);
+    entries.emplace_back("..", nodes[index].parent);
+    std::sort(entries.begin(), entries.end());
+    return entries;
+}
+
+// Index of the first entry of each directory block
+static std::vector<size_t> pack_dir_blocks(const DirEntries& e, size_t blksz, size_t* last_used) {
+    std::vector<size_t> starts;
+    size_t used = blksz;
+    for (size_t i = 0; i < e.size(); ++i) {
+        size_t need = EROFS_DIRENT_SIZE + e[i].first.size();
+        if (used + need > blksz) {
+            starts.push_back(i);
+            used = 0;
+        }
+        used += need;
+    }
+    *last_used = used;
+    return starts;
+}
+
+static uint64_t dir_size(const std::vector<ErofsNode>& nodes, size_t index, size_t blksz) {
+    size_t last_used = 0;
+    auto starts = pack_dir_blocks(dir_entries(nodes, index), blksz, &last_used);
+    return (starts.size() - 1) * static_cast<uint64_t>(blksz) + last_used;
+}
+
+static void build_dir_data(std::vector<ErofsNode>& nodes, size_t index, size_t blksz) {
+    auto entries = dir_entries(nodes, index);
+    size_t last_used = 0;
+    auto starts = pack_dir_blocks(entries, blksz, &last_used);
+    starts.push_back(entries.size());
+
+    ErofsNode& dir = nodes[index];
+    dir.dir_data.assign(dir.size, 0);
+    for (size_t b = 0; b + 1 < starts.size(); ++b) {
+        uint8_t* block = dir.dir_data.data() + b * blksz;
+        size_t count = starts[b + 1] - starts[b];
+        size_t nameoff = count * EROFS_DIRENT_SIZE;
+        for (size_t i = 0; i < count; ++i) {
+            const auto& entry = entries[starts[b] + i];
+            const ErofsNode& child = nodes[entry.second];
+            uint8_t* d = block + i * EROFS_DIRENT_SIZE;
+            put64(d, child.meta_offset / EROFS_ISLOT_SIZE);
+            put16(d + 8, static_cast<uint16_t>(nameoff));
+            d[10] = file_type_of(child.st.st_mode);
+            memcpy(block + nameoff, entry.first.data(), entry.first.size());
+            nameoff += entry.first.size();
+        }
+    }
+}
+
+// Collect the tree below `source` as children of `parent`
+static bool scan_tree(std::vector<ErofsNode>& nodes, size_t parent, const fs::path& source,
+                      const ErofsLabeler& label,
+                      std::map<std::pair<dev_t, ino_t>, size_t>& hardlinks) {
+    std::unordered_map<std::string, size_t> dirs{{"", parent}};
+    bool ok = true;
+
+    bool walked = walk_tree(source, [&](const WalkEntry& e) {
+        ErofsNode node;
+        if (fstatat(e.parent_fd, e.name, &node.st, AT_SYMLINK_NOFOLLOW) != 0) {
+            LOG_ERROR("erofs: cannot stat " + (source / e.rel).string());
+            ok = false;
+            return false;
+        }
+        size_t rel_slash = e.rel.rfind('/');
+        size_t dir_index = dirs[rel_slash == std::string::npos ? "" : e.rel.substr(0, rel_slash)];
+
+        if (S_ISREG(node.st.st_mode) && node.st.st_nlink > 1) {
+            auto it = hardlinks.find({node.st.st_dev, node.st.st_ino});
+            if (it != hardlinks.end()) {
+                nodes[it->second].nlink++;
+                nodes[dir_index].children.emplace_back(e.name, it->second);
+                return false;
+            }
+        }
+
+        node.source = source / e.rel;
+        node.parent = dir_index;
+        if (S_ISLNK(node.st.st_mode)) {
+            char target[PATH_MAX];
+            ssize_t len = readlinkat(e.parent_fd, e.name, target, sizeof(target));
+            if (len < 0) {
+                LOG_ERROR("erofs: cannot read link " + node.source.string());
+                ok = false;
+                return false;
+            }
+            node.link_target.assign(target, static_cast<size_t>(len));
+        }
+        node.xattrs = encode_xattrs(
+            node.source, label ? label(e.rel, S_ISDIR(node.st.st_mode)) : std::string());
+
+        size_t index = nodes.size();
+        nodes.push_back(std::move(node));
+        nodes[dir_index].children.emplace_back(e.name, index);
+        if (S_ISREG(nodes[index].st.st_mode) && nodes[index].st.st_nlink > 1) {
+            hardlinks[{nodes[index].st.st_dev, nodes[index].st.st_ino}] = index;
+        }
+        if (S_ISDIR(nodes[index].st.st_mode)) {
+            nodes[index].nlink = 2;
+            nodes[dir_index].nlink++;
+            dirs[e.rel] = index;
+            return true;
+        }
+        return false;
+    });
+
+    return walked && ok;
+}
+
+static bool copy_range(int in_fd, uint64_t in_off, int out_fd, uint64_t out_off, uint64_t len) {
+    bool use_copy_file_range = true;
+    std::vector<char> buf;
+    while (len > 0) {
+#ifdef __NR_copy_file_range
+        if (use_copy_file_range) {
+            loff_t in_pos = static_cast<loff_t>(in_off);
+            loff_t out_pos = static_cast<loff_t>(out_off);
+            ssize_t n = syscall(__NR_copy_file_range, in_fd, &in_pos, out_fd, &out_pos,
+                                static_cast<size_t>(len), 0);
+            if (n > 0) {
+                in_off += n;
+                out_off += n;
+                len -= n;
+                continue;
+            }
+            if (n == 0) {
+                errno = EIO;  // Source shrank underneath us
+                return false;
+            }
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno != EXDEV && errno != EINVAL && errno != ENOSYS && errno != EOPNOTSUPP &&
+                errno != EBADF) {
+                return false;
+            }
+            use_copy_file_range = false;
+        }
+#endif // #ifdef __NR_copy_file_range
+        if (buf.empty()) {
+            buf.resize(1024 * 1024);
+        }
+        ssize_t n = pread(in_fd, buf.data(), std::min<uint64_t>(len, buf.size()), in_off);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            if (n == 0) {
+                errno = EIO;
+            }
+            return false;
+        }
+        for (ssize_t done = 0; done < n;) {
+            ssize_t w = pwrite(out_fd, buf.data() + done, n - done, out_off + done);
+            if (w < 0 && errno == EINTR) {
+                continue;
+            }
+            if (w <= 0) {
+                return false;
+            }
+            done += w;
+        }
+        in_off += n;
+        out_off += n;
+        len -= n;
+    }
+    return true;
+}
+
+static bool pread_full(int fd, uint8_t* out, size_t len, uint64_t offset) {
+    while (len > 0) {
+        ssize_t n = pread(fd, out, len, offset);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            if (n == 0) {
+                errno = EIO;
+            }
+            return false;
+        }
+        out += n;
+        len -= n;
+        offset += n;
+    }
+    return true;
+}
+
+// Copy the block part of a regular file into the image and its tail into `meta`
+static bool write_file_data(const ErofsNode& node, int image_fd, size_t blksz, uint8_t* tail_dst) {
+    int fd = open(node.source.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        LOG_ERROR("erofs: cannot open " + node.source.string() + ": " + strerror(errno));
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || static_cast<uint64_t>(st.st_size) != node.size) {
+        LOG_ERROR("erofs: " + node.source.string() + " changed while building the image");
+        close(fd);
+        return false;
+    }
+
+    uint64_t block_bytes = node.layout == EROFS_INODE_FLAT_INLINE
+                               ? static_cast<uint64_t>(node.nblocks) * blksz
+                               : node.size;
+    bool ok = block_bytes == 0 || copy_range(fd, 0, image_fd,
+                                             static_cast<uint64_t>(node.blkaddr) * blksz,
+                                             block_bytes);
+    if (ok && node.layout == EROFS_INODE_FLAT_INLINE) {
+        ok = pread_full(fd, tail_dst, node.size - block_bytes, block_bytes);
+    }
+    if (!ok) {
+        LOG_ERROR("erofs: failed to copy " + node.source.string() + ": " + strerror(errno));
+    }
+    close(fd);
+    return ok;
+}
+
+static size_t image_block_size() {
+    long page = sysconf(_SC_PAGESIZE);
+    // Older kernels only mount EROFS whose block size equals the page size
+    if (page >= 4096 && page <= 65536 && (page & (page - 1)) == 0) {
+        return static_cast<size_t>(page);
+    }
+    return 4096;
+}
+
+static bool write_all_at(int fd, const uint8_t* data, size_t len, uint64_t offset) {
+    while (len > 0) {
+        ssize_t n = pwrite(fd, data, len, offset);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        data += n;
+        len -= n;
+        offset += n;
+    }
+    return true;
+}
+
+bool write_erofs_image(const std::vector<ErofsRoot>& roots, const fs::path& image_path,
+                       size_t threads, ErofsWriteStats* stats) {
+    const size_t blksz = image_block_size();
+    uint8_t blkszbits = 0;
+    while ((static_cast<size_t>(1) << blkszbits) < blksz) {
+        blkszbits++;
+    }
+    const time_t build_time = time(nullptr);
+
+    // 1. Collect the tree. Node 0 is the image root; it is laid out first so its nid fits
+    //    the superblock's 16-bit root_nid
+    std::vector<ErofsNode> nodes(1);
+    ErofsNode& root = nodes[0];
+    root.st.st_mode = S_IFDIR | 0755;
+    root.st.st_mtime = build_time;
+    root.nlink = 2;
+    append_xattr(root.xattrs, 6, "selinux",
+                 std::string(DEFAULT_SELINUX_CONTEXT, strlen(DEFAULT_SELINUX_CONTEXT) + 1));
+
+    std::map<std::pair<dev_t, ino_t>, size_t> hardlinks;
+    for (const auto& r : roots) {
+        ErofsNode top;
+        if (lstat(r.source.c_str(), &top.st) != 0 || !S_ISDIR(top.st.st_mode)) {
+            LOG_ERROR("erofs: source is not a directory: " + r.source.string());
+            return false;
+        }
+        top.source = r.source;
+        top.nlink = 2;
+        top.xattrs = encode_xattrs(r.source);
+        size_t index = nodes.size();
+        nodes.push_back(std::move(top));
+        nodes[0].children.emplace_back(r.name, index);
+        nodes[0].nlink++;
+        if (!scan_tree(nodes, index, r.source, r.label, hardlinks)) {
+            return false;
+        }
+    }
+    for (auto& node : nodes) {
+        std::sort(node.children.begin(), node.children.end());
+        auto dup = std::adjacent_find(
+            node.children.begin(), node.children.end(),
+            [](const auto& a, const auto& b) { return a.first == b.first; });
+        if (dup != node.children.end()) {
+            LOG_ERROR("erofs: duplicate entry " + dup->first);
+            return false;
+        }
+    }
+
+    // 2. Size every inode and lay out the metadata area. Inline tails must share a block
+    //    with their inode, so an inode that would straddle a boundary moves to the next one.
+    // Slot 0 stays empty: readdir hides entries whose inode number is 0
+    uint64_t meta_used = EROFS_ISLOT_SIZE;
+    uint64_t data_bytes = 0;
+    for (size_t i = 0; i < nodes.size(); ++i) {
+        ErofsNode& node = nodes[i];
+        mode_t type = node.st.st_mode & S_IFMT;
+        if (type == S_IFREG) {
+            node.size = static_cast<uint64_t>(node.st.st_size);
+        } else if (type == S_IFLNK) {
+            node.size = node.link_target.size();
+        } else if (type == S_IFDIR) {
+            node.size = dir_size(nodes, i, blksz);
+        }
+        if (type == S_IFREG || type == S_IFLNK) {
+            data_bytes += node.size;
+        }
+
+        node.extended = node.st.st_uid > 0xffff || node.st.st_gid > 0xffff ||
+                        node.size > 0xffffffffULL || node.nlink > 0xffff;
+        size_t inode_size = node.extended ? EROFS_INODE_EXTENDED_SIZE : EROFS_INODE_COMPACT_SIZE;
+        uint64_t meta_size = inode_size + node.xattrs.size();
+        uint64_t tail = node.size % blksz;
+        if (tail > 0 && meta_size + tail <= blksz) {
+            node.layout = EROFS_INODE_FLAT_INLINE;
+            node.nblocks = static_cast<uint32_t>(node.size / blksz);
+            meta_size += tail;
+        } else {
+            node.layout = EROFS_INODE_FLAT_PLAIN;
+            node.nblocks = static_cast<uint32_t>(align_up(node.size, blksz) / blksz);
+        }
+
+        uint64_t offset = align_up(meta_used, EROFS_ISLOT_SIZE);
+        if (meta_size <= blksz && offset % blksz + meta_size > blksz) {
+            offset = align_up(offset, blksz);
+        }
+        node.meta_offset = offset;
+        meta_used = offset + meta_size;
+    }
+
+    // 3. Data blocks follow the metadata area
+    const uint32_t meta_blkaddr = 1;
+    uint64_t next_block = meta_blkaddr + align_up(meta_used, blksz) / blksz;
+    for (auto& node : nodes) {
+        if (node.nblocks > 0) {
+            node.blkaddr = static_cast<uint32_t>(next_block);
+            next_block += node.nblocks;
+        }
+    }
+    if (next_block > 0xffffffffULL) {
+        LOG_ERROR("erofs: image too large");
+        return false;
+    }
+
+    // 4. Serialize inodes, xattrs, directories and symlinks into the metadata area
+    std::vector<uint8_t> meta(align_up(meta_used, blksz), 0);
+    std::vector<size_t> file_jobs;
+    for (size_t i = 0; i < nodes.size(); ++i) {
+        ErofsNode& node = nodes[i];
+        uint8_t* p = meta.data() + node.meta_offset;
+        mode_t type = node.st.st_mode & S_IFMT;
+
+        uint32_t i_u = node.blkaddr;
+        if (type == S_IFCHR || type == S_IFBLK) {
+            dev_t rdev = node.st.st_rdev;
+            i_u = (minor(rdev) & 0xff) | (major(rdev) << 8) | ((minor(rdev) & ~0xffu) << 12);
+        } else if (type == S_IFIFO || type == S_IFSOCK) {
+            i_u = 0;
+        }
+        // i_xattr_icount counts 4-byte slots past the 12-byte body header
+        uint16_t xattr_icount = 0;
+        if (!node.xattrs.empty()) {
+            xattr_icount = static_cast<uint16_t>(
+                (node.xattrs.size() - EROFS_XATTR_IBODY_HEADER_SIZE) / EROFS_XATTR_ENTRY_SIZE + 1);
+        }
+        uint32_t ino = static_cast<uint32_t>(i + 1);
+
+        size_t inode_size;
+        if (node.extended) {
+            put16(p, static_cast<uint16_t>(node.layout << 1 | 1));
+            put16(p + 2, xattr_icount);
+            put16(p + 4, static_cast<uint16_t>(node.st.st_mode));
+            put64(p + 8, node.size);
+            put32(p + 16, i_u);
+            put32(p + 20, ino);
+            put32(p + 24, node.st.st_uid);
+            put32(p + 28, node.st.st_gid);
+            put64(p + 32, static_cast<uint64_t>(node.st.st_mtime));
+            put32(p + 40, static_cast<uint32_t>(node.st.st_mtim.tv_nsec));
+            put32(p + 44, node.nlink);
+            inode_size = EROFS_INODE_EXTENDED_SIZE;
+        } else {
+            // Compact inodes carry no timestamps; they report the image build time
+            put16(p, static_cast<uint16_t>(node.layout << 1));
+            put16(p + 2, xattr_icount);
+            put16(p + 4, static_cast<uint16_t>(node.st.st_mode));
+            put16(p + 6, static_cast<uint16_t>(node.nlink));
+            put32(p + 8, static_cast<uint32_t>(node.size));
+            put32(p + 16, i_u);
+            put32(p + 20, ino);
+            put16(p + 24, static_cast<uint16_t>(node.st.st_uid));
+            put16(p + 26, static_cast<uint16_t>(node.st.st_gid));
+            inode_size = EROFS_INODE_COMPACT_SIZE;
+        }
+        if (!node.xattrs.empty()) {
+            memcpy(p + inode_size, node.xattrs.data(), node.xattrs.size());
+        }
+        uint8_t* tail_dst = p + inode_size + node.xattrs.size();
+        uint64_t block_bytes = static_cast<uint64_t>(node.nblocks) * blksz;
+
+        if (type == S_IFDIR) {
+            build_dir_data(nodes, i, blksz);
+            if (node.layout == EROFS_INODE_FLAT_INLINE) {
+                memcpy(tail_dst, node.dir_data.data() + block_bytes, node.size - block_bytes);
+            }
+        } else if (type == S_IFLNK) {
+            if (node.layout == EROFS_INODE_FLAT_INLINE) {
+                memcpy(tail_dst, node.link_target.data(), node.size);
+            }
+        } else if (type == S_IFREG && node.size > 0) {
+            file_jobs.push_back(i);
+        }
+    }
+
+    uint8_t sb[EROFS_SUPER_SIZE] = {};
+    put32(sb, EROFS_SUPER_MAGIC_V1);
+    sb[12] = blkszbits;
+    put16(sb + 14, static_cast<uint16_t>(nodes[0].meta_offset / EROFS_ISLOT_SIZE));
+    put64(sb + 16, nodes.size());
+    put64(sb + 24, static_cast<uint64_t>(build_time));
+    put32(sb + 36, static_cast<uint32_t>(next_block));
+    put32(sb + 40, meta_blkaddr);
+
+    // 5. Write everything into a temporary image
+    fs::path tmp_path = image_path;
+    tmp_path += ".tmp";
+    int fd = open(tmp_path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        LOG_ERROR("erofs: cannot create " + tmp_path.string() + ": " + strerror(errno));
+        return false;
+    }
+    bool ok = ftruncate(fd, static_cast<off_t>(next_block * blksz)) == 0;
+
+    // File payloads land in disjoint block ranges and tail slots, so streams never overlap
+    std::atomic<size_t> next_job{0};
+    std::atomic<bool> copy_ok{true};
+    auto copy_worker = [&]() {
+        while (copy_ok) {
+            size_t job = next_job++;
+            if (job >= file_jobs.size()) {
+                break;
+            }
+            const ErofsNode& node = nodes[file_jobs[job]];
+            size_t inode_size =
+                node.extended ? EROFS_INODE_EXTENDED_SIZE : EROFS_INODE_COMPACT_SIZE;
+            uint8_t* tail_dst = meta.data() + node.meta_offset + inode_size + node.xattrs.size();
+            if (!write_file_data(node, fd, blksz, tail_dst)) {
+                copy_ok = false;
+            }
+        }
+    };
+
+    if (ok) {
+        size_t workers = std::max<size_t>(1, std::min(threads, file_jobs.size()));
+        std::vector<std::thread> pool;
+        for (size_t i = 1; i < workers; ++i) {
+            try {
+                pool.emplace_back(copy_worker);
+            } catch (const std::system_error& e) {
+                LOG_WARN("erofs: failed to spawn copy stream: " + std::string(e.what()));
+                break;
+            }
+        }
+        copy_worker();
+        for (auto& t : pool) {
+            t.join();
+        }
+        ok = copy_ok;
+    }
+
+    for (size_t i = 0; ok && i < nodes.size(); ++i) {
+        const ErofsNode& node = nodes[i];
+        if (S_ISLNK(node.st.st_mode) && node.layout == EROFS_INODE_FLAT_PLAIN &&
+            node.size > 0) {
+            ok = write_all_at(fd, reinterpret_cast<const uint8_t*>(node.link_target.data()),
+                              node.size, static_cast<uint64_t>(node.blkaddr) * blksz);
+        } else if (S_ISDIR(node.st.st_mode) && node.nblocks > 0) {
+            uint64_t len = node.layout == EROFS_INODE_FLAT_INLINE
+                               ? static_cast<uint64_t>(node.nblocks) * blksz
+                               : node.size;
+            ok = write_all_at(fd, node.dir_data.data(), len,
+                              static_cast<uint64_t>(node.blkaddr) * blksz);
+        }
+    }
+
+    ok = ok && write_all_at(fd, meta.data(), meta.size(), meta_blkaddr * blksz);
+    ok = ok && write_all_at(fd, sb, sizeof(sb), EROFS_SUPER_OFFSET);
+    ok = ok && fsync(fd) == 0;
+    if (!ok) {
+        LOG_ERROR("erofs: failed to write " + tmp_path.string() + ": " + strerror(errno));
+    }
+    close(fd);
+
+    if (!ok || rename(tmp_path.c_str(), image_path.c_str()) != 0) {
+        unlink(tmp_path.c_str());
+        return false;
+    }
+
+    if (stats) {
+        stats->inodes = nodes.size();
+        stats->data_bytes = data_bytes;
+        stats->image_bytes = next_block * blksz;
+    }
+    return true;
+}
+
+}  // namespace hymo
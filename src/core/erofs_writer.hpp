@@ -0,0 +1,41 @@
+// core/erofs_writer.hpp - In-process EROFS image writer
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+namespace hymo {
+
+// Label for an entry below a root, by path relative to its source; "" keeps the source's
+// own security.selinux. Called parents first.
+using ErofsLabeler = std::function<std::string(const std::string& rel, bool is_dir)>;
+
+// One top-level directory of the image and the tree it is read from
+struct ErofsRoot {
+    std::string name;
+    fs::path source;
+    ErofsLabeler label;  // Optional
+};
+
+struct ErofsWriteStats {
+    uint64_t inodes = 0;
+    uint64_t data_bytes = 0;   // Regular file and symlink payload
+    uint64_t image_bytes = 0;  // Final image size
+};
+
+// Write an uncompressed EROFS image whose root holds one directory per entry of `roots`.
+// Inodes are compact where attributes allow, tail data is inlined next to its inode and
+// xattrs are carried over, with security.selinux taken from the root's labeler where it
+// gives one. Hardlinks inside the input share
+// one inode. File data is copied on up to `threads` streams. The image is written to a
+// temporary file and renamed over `image_path` only when complete.
+bool write_erofs_image(const std::vector<ErofsRoot>& roots, const fs::path& image_path,
+                       size_t threads, ErofsWriteStats* stats = nullptr);
+
+}  // namespace hymo
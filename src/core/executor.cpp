@@ -1,10 +1,18 @@
 // core/executor.cpp - Mount execution implementation
 #include "executor.hpp"
 #include <algorithm>
+#include <cerrno>
+#include <ctime>
+#include <functional>
+#include <system_error>
+#include <thread>
 #include "../defs.hpp"
 #include "../mount/magic.hpp"
+#include "../mount/mount_utils.hpp"
 #include "../mount/overlay.hpp"
 #include "../utils.hpp"
+#include "overlay_history.hpp"
+#include "trace.hpp"
 
 namespace hymo {
 
@@ -22,48 +30,177 @@ static fs::path extract_module_root(const fs::path& partition_path) {
     return fs::path();
 }
 
-ExecutionResult execute_plan(const MountPlan& plan, const Config& config, bool hymofs_active) {
-    if (!plan.hymofs_module_ids.empty()) {
-        LOG_INFO("HymoFS modules handled by Fast Path controller.");
+// Outcome of one independent group of overlay operations
+struct OverlayGroupResult {
+    std::vector<fs::path> magic_paths;
+    std::vector<std::string> fallback_ids;
+    std::vector<OverlayOutcome> outcomes;
+};
+
+// True if `inner` equals `outer` or lies below it
+static bool is_nested_target(const std::string& inner, const std::string& outer) {
+    if (inner == outer) {
+        return true;
     }
+    std::string prefix = outer.back() == '/' ? outer : outer + "/";
+    return inner.compare(0, prefix.size(), prefix) == 0;
+}
 
-    std::vector<fs::path> magic_queue = plan.magic_module_paths;
+// Partition overlay operations into groups whose targets do not nest into each other's.
+// Each group is ordered parent-first so nested targets mount after their parent.
+static std::vector<std::vector<const OverlayOperation*>> group_overlay_ops(
+    const std::vector<OverlayOperation>& ops) {
+    std::vector<std::vector<const OverlayOperation*>> groups;
 
-    std::vector<std::string> final_overlay_ids = plan.overlay_module_ids;
-    std::vector<std::string> fallback_ids;
+    for (const auto& op : ops) {
+        std::vector<const OverlayOperation*> merged{&op};
+        for (auto it = groups.begin(); it != groups.end();) {
+            bool related = std::any_of(it->begin(), it->end(), [&op](const OverlayOperation* o) {
+                return is_nested_target(op.target, o->target) ||
+                       is_nested_target(o->target, op.target);
+            });
+            if (related) {
+                merged.insert(merged.end(), it->begin(), it->end());
+                it = groups.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        groups.push_back(std::move(merged));
+    }
+
+    for (auto& group : groups) {
+        std::stable_sort(group.begin(), group.end(),
+                         [](const OverlayOperation* a, const OverlayOperation* b) {
+                             return a->target < b->target;
+                         });
+    }
+
+    return groups;
+}
+
+static bool is_transient_mount_error(int err) {
+    return err == EBUSY || err == ENOENT || err == EINTR;
+}
 
-    // Execute Overlay Operations
-    for (const auto& op : plan.overlay_ops) {
+static void run_overlay_group(const std::vector<const OverlayOperation*>& group,
+                              const Config& config,
+                              const std::vector<std::string>& all_partitions,
+                              OverlayGroupResult& result) {
+    std::string kernel_release = current_kernel_release();
+    for (const auto* op : group) {
         std::vector<std::string> lowerdir_strings;
-        for (const auto& p : op.lowerdirs) {
+        for (const auto& p : op->lowerdirs) {
             lowerdir_strings.push_back(p.string());
         }
 
-        LOG_DEBUG("Mounting " + op.target + " [OVERLAY] (" +
+        TRACE_SCOPE("overlay_target", "target", op->target);
+        LOG_DEBUG("Mounting " + op->target + " [OVERLAY] (" +
                   std::to_string(lowerdir_strings.size()) + " layers)");
 
-        std::vector<std::string> all_partitions = BUILTIN_PARTITIONS;
-        for (const auto& part : config.partitions) {
-            all_partitions.push_back(part);
+        bool mounted = false;
+        try {
+            int err = mount_overlay(op->target, lowerdir_strings, config.mountsource,
+                                    std::nullopt, std::nullopt, config.disable_umount,
+                                    all_partitions, op->layer_index);
+            mounted = err == 0;
+
+            // A busy, vanished or interrupted target says nothing about the next boot
+            if (!is_transient_mount_error(err)) {
+                OverlayOutcome outcome;
+                outcome.target = op->target;
+                outcome.layer_hash = op->layer_hash;
+                outcome.kernel_release = kernel_release;
+                outcome.error = err;
+                outcome.timestamp = static_cast<int64_t>(time(nullptr));
+                result.outcomes.push_back(outcome);
+            }
+        } catch (const std::exception& e) {
+            LOG_ERROR("Overlay mount for " + op->target + " threw: " + e.what());
         }
 
-        if (!mount_overlay(op.target, lowerdir_strings, config.mountsource, std::nullopt,
-                           std::nullopt, config.disable_umount, all_partitions)) {
-            LOG_WARN("OverlayFS failed for " + op.target + ". Triggering fallback.");
+        if (!mounted) {
+            LOG_WARN("OverlayFS failed for " + op->target + ". Triggering fallback.");
 
             // Fallback: Add all involved modules to magic queue
-            for (const auto& layer_path : op.lowerdirs) {
+            for (const auto& layer_path : op->lowerdirs) {
                 fs::path root = extract_module_root(layer_path);
                 if (!root.empty()) {
-                    magic_queue.push_back(root);
+                    result.magic_paths.push_back(root);
                     std::string id = extract_id(layer_path);
                     if (!id.empty()) {
-                        fallback_ids.push_back(id);
+                        result.fallback_ids.push_back(id);
                     }
                 }
             }
         }
     }
+}
+
+ExecutionResult execute_plan(const MountPlan& plan, const Config& config, bool hymofs_active) {
+    if (!plan.hymofs_module_ids.empty()) {
+        LOG_INFO("HymoFS modules handled by Fast Path controller.");
+    }
+
+    int mounts_before = count_mounts();
+    std::vector<fs::path> magic_queue = plan.magic_module_paths;
+
+    std::vector<std::string> final_overlay_ids = plan.overlay_module_ids;
+    std::vector<std::string> fallback_ids;
+
+    std::vector<std::string> all_partitions = BUILTIN_PARTITIONS;
+    for (const auto& part : config.partitions) {
+        all_partitions.push_back(part);
+    }
+
+    // Execute Overlay Operations: independent partitions mount concurrently
+    TraceSpan overlay_span("overlay");
+    auto groups = group_overlay_ops(plan.overlay_ops);
+    std::vector<OverlayGroupResult> group_results(groups.size());
+
+    if (groups.size() > 1) {
+        LOG_DEBUG("Mounting " + std::to_string(plan.overlay_ops.size()) + " overlay targets in " +
+                  std::to_string(groups.size()) + " parallel groups");
+
+        std::vector<std::thread> workers;
+        workers.reserve(groups.size());
+        for (size_t i = 0; i < groups.size(); ++i) {
+            try {
+                workers.emplace_back(run_overlay_group, std::cref(groups[i]), std::cref(config),
+                                     std::cref(all_partitions), std::ref(group_results[i]));
+            } catch (const std::system_error& e) {
+                LOG_WARN("Failed to spawn overlay worker, mounting inline: " +
+                         std::string(e.what()));
+                run_overlay_group(groups[i], config, all_partitions, group_results[i]);
+            }
+        }
+        for (auto& worker : workers) {
+            worker.join();
+        }
+    } else if (!groups.empty()) {
+        run_overlay_group(groups[0], config, all_partitions, group_results[0]);
+    }
+
+    // Merge per-group fallbacks in a stable order
+    OverlayHistory history;
+    bool has_outcomes = false;
+    for (const auto& result : group_results) {
+        magic_queue.insert(magic_queue.end(), result.magic_paths.begin(),
+                           result.magic_paths.end());
+        fallback_ids.insert(fallback_ids.end(), result.fallback_ids.begin(),
+                            result.fallback_ids.end());
+        if (!result.outcomes.empty() && !has_outcomes) {
+            history = load_overlay_history();
+            has_outcomes = true;
+        }
+        for (const auto& outcome : result.outcomes) {
+            history.record(outcome);
+        }
+    }
+    if (has_outcomes) {
+        history.save();
+    }
+    overlay_span.end();
 
     // Adjust ID lists based on fallbacks
     if (!fallback_ids.empty()) {
@@ -84,6 +221,7 @@ ExecutionResult execute_plan(const MountPlan& plan, const Config& config, bool h
     std::vector<std::string> final_magic_ids;
 
     if (!magic_queue.empty()) {
+        TRACE_SCOPE("magic_mount");
         fs::path tempdir = select_temp_dir();
         if (!config.tempdir.empty()) {
             fs::path candidate = config.tempdir;
@@ -135,7 +273,16 @@ ExecutionResult execute_plan(const MountPlan& plan, const Config& config, bool h
     final_magic_ids.erase(std::unique(final_magic_ids.begin(), final_magic_ids.end()),
                           final_magic_ids.end());
 
-    return ExecutionResult{final_overlay_ids, final_magic_ids};
+    int mounts_after = count_mounts();
+    int mounts_added = mounts_before >= 0 && mounts_after >= 0 ? mounts_after - mounts_before : 0;
+    if (plan.predicted_mounts > 0) {
+        LOG_INFO("Mount footprint: " + std::to_string(mounts_added) + " added, " +
+                 std::to_string(plan.predicted_mounts) + " predicted");
+    } else if (mounts_added > 0) {
+        LOG_INFO("Mount footprint: " + std::to_string(mounts_added) + " added");
+    }
+
+    return ExecutionResult{final_overlay_ids, final_magic_ids, mounts_added};
 }
 
 }  // namespace hymo
@@ -11,6 +11,7 @@ namespace hymo {
 struct ExecutionResult {
   std::vector<std::string> overlay_module_ids;
   std::vector<std::string> magic_module_ids;
+  int mounts_added = 0; // Growth of the mount table across the run
 };
 
 ExecutionResult execute_plan(const MountPlan& plan, const Config& config, bool hymofs_active);
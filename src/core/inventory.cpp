@@ -5,6 +5,7 @@
 #include <sstream>
 #include "../defs.hpp"
 #include "../utils.hpp"
+#include "trace.hpp"
 
 #include <set>
 
@@ -68,6 +69,7 @@ static void parse_module_rules(const fs::path& module_path, Module& module) {
 }
 
 std::vector<Module> scan_modules(const fs::path& source_dir, const Config& config) {
+    TRACE_SCOPE("scan");
     std::vector<Module> modules;
 
     if (!fs::exists(source_dir)) {
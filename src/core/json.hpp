@@ -1,278 +1,769 @@
 #pragma once
-#include <algorithm>
-#include <iomanip>
-#include <iostream>
-#include <map>
-#include <sstream>
+#include <charconv>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <stdexcept>
 #include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
 #include <variant>
 #include <vector>
 
 namespace hymo {
 namespace json {
 
+// Order matches the alternatives of Value's storage
 enum class Type { Null, Bool, Number, String, Array, Object };
 
-struct Value;
+class Value;
 
 using Array = std::vector<Value>;
-using Object = std::map<std::string, Value>;
 
-struct Value {
-    Type type = Type::Null;
-    bool b = false;
-    double n = 0;
-    std::string s;
-    Array a;
-    Object o;
+// Members in insertion order. Objects here hold a handful of keys, where a scan over
+// contiguous storage beats a node-based map and output keeps the order it was built in.
+class Object {
+public:
+    using Member = std::pair<std::string, Value>;
+    using const_iterator = std::vector<Member>::const_iterator;
+
+    // Defined below Value, which must be complete first
+    size_t size() const;
+    bool empty() const;
+    const_iterator begin() const;
+    const_iterator end() const;
+
+    const_iterator find(std::string_view key) const;
+    size_t count(std::string_view key) const;
+    // Throws std::out_of_range when absent
+    const Value& at(std::string_view key) const;
+    Value& operator[](std::string_view key);
 
+private:
+    std::vector<Member> members_;
+};
+
+class Value {
+public:
     Value() = default;
-    Value(bool v) : type(Type::Bool), b(v) {}
-    Value(int v) : type(Type::Number), n(static_cast<double>(v)) {}
-    Value(double v) : type(Type::Number), n(v) {}
-    Value(const char* v) : type(Type::String), s(v) {}
-    Value(const std::string& v) : type(Type::String), s(v) {}
-    Value(const Array& v) : type(Type::Array), a(v) {}
-    Value(const Object& v) : type(Type::Object), o(v) {}
+    Value(bool v) : data_(v) {}
+    Value(int v) : data_(static_cast<double>(v)) {}
+    Value(double v) : data_(v) {}
+    Value(const char* v) : data_(std::string(v)) {}
+    Value(std::string v) : data_(std::move(v)) {}
+    Value(Array v) : data_(std::move(v)) {}
+    Value(Object v) : data_(std::move(v)) {}
 
     static Value object() { return Value(Object{}); }
     static Value array() { return Value(Array{}); }
 
-    Value& operator[](const std::string& key) {
-        if (type != Type::Object) {
-            type = Type::Object;
-            o.clear();
+    Type type() const { return static_cast<Type>(data_.index()); }
+
+    // Turns a non-object into an empty object first
+    Value& operator[](std::string_view key) {
+        if (type() != Type::Object) {
+            data_ = Object{};
         }
-        return o[key];
+        return std::get<Object>(data_)[key];
     }
 
-    // For arrays, need careful overload handling or separate method
-    void push_back(const Value& v) {
-        if (type != Type::Array) {
-            type = Type::Array;
-            a.clear();
+    // Turns a non-array into an empty array first
+    void push_back(Value v) {
+        if (type() != Type::Array) {
+            data_ = Array{};
         }
-        a.push_back(v);
+        std::get<Array>(data_).push_back(std::move(v));
     }
 
-    bool as_bool() const { return b; }
-    double as_number() const { return n; }
-    std::string as_string() const { return s; }
-    const Array& as_array() const { return a; }
-    const Object& as_object() const { return o; }
+    // Accessors return an empty value of the requested type on a type mismatch
+    bool as_bool() const {
+        const bool* v = std::get_if<bool>(&data_);
+        return v ? *v : false;
+    }
+    double as_number() const {
+        const double* v = std::get_if<double>(&data_);
+        return v ? *v : 0;
+    }
+    const std::string& as_string() const {
+        static const std::string empty;
+        const std::string* v = std::get_if<std::string>(&data_);
+        return v ? *v : empty;
+    }
+    const Array& as_array() const {
+        static const Array empty;
+        const Array* v = std::get_if<Array>(&data_);
+        return v ? *v : empty;
+    }
+    const Object& as_object() const {
+        static const Object empty;
+        const Object* v = std::get_if<Object>(&data_);
+        return v ? *v : empty;
+    }
+
+private:
+    std::variant<std::monostate, bool, double, std::string, Array, Object> data_;
 };
 
-inline std::string escape_string(const std::string& s) {
-    std::ostringstream ss;
-    ss << '"';
-    for (char c : s) {
-        if (c == '"')
-            ss << "\\\"";
-        else if (c == '\\')
-            ss << "\\\\";
-        else if (c == '\b')
-            ss << "\\b";
-        else if (c == '\f')
-            ss << "\\f";
-        else if (c == '\n')
-            ss << "\\n";
-        else if (c == '\r')
-            ss << "\\r";
-        else if (c == '\t')
-            ss << "\\t";
-        else if ((unsigned char)c < 0x20) {
-            ss << "\\u" << std::setfill('0') << std::setw(4) << std::hex << (int)(unsigned char)c;
-        } else
-            ss << c;
-    }
-    ss << '"';
-    return ss.str();
+inline size_t Object::size() const {
+    return members_.size();
+}
+
+inline bool Object::empty() const {
+    return members_.empty();
+}
+
+inline Object::const_iterator Object::begin() const {
+    return members_.begin();
+}
+
+inline Object::const_iterator Object::end() const {
+    return members_.end();
+}
+
+inline size_t Object::count(std::string_view key) const {
+    return find(key) != end() ? 1 : 0;
 }
 
-inline std::string dump(const Value& v, int indent = -1, int level = 0) {
-    switch (v.type) {
+inline Object::const_iterator Object::find(std::string_view key) const {
+    for (auto it = members_.begin(); it != members_.end(); ++it) {
+        if (it->first == key) {
+            return it;
+        }
+    }
+    return members_.end();
+}
+
+inline const Value& Object::at(std::string_view key) const {
+    auto it = find(key);
+    if (it == members_.end()) {
+        throw std::out_of_range("json: no member " + std::string(key));
+    }
+    return it->second;
+}
+
+inline Value& Object::operator[](std::string_view key) {
+    for (auto& member : members_) {
+        if (member.first == key) {
+            return member.second;
+        }
+    }
+    members_.emplace_back(std::string(key), Value());
+    return members_.back().second;
+}
+
+// Append `s` to `out` as a quoted JSON string
+inline void append_escaped(std::string& out, std::string_view s) {
+    static constexpr char hex[] = "0123456789abcdef";
+    out += '"';
+    size_t run = 0;  // Start of the pending run of characters that need no escaping
+    for (size_t i = 0; i < s.size(); ++i) {
+        unsigned char c = static_cast<unsigned char>(s[i]);
+        if (c >= 0x20 && c != '"' && c != '\\') {
+            continue;
+        }
+        out.append(s.data() + run, i - run);
+        run = i + 1;
+        switch (c) {
+        case '"':
+            out += "\\\"";
+            break;
+        case '\\':
+            out += "\\\\";
+            break;
+        case '\b':
+            out += "\\b";
+            break;
+        case '\f':
+            out += "\\f";
+            break;
+        case '\n':
+            out += "\\n";
+            break;
+        case '\r':
+            out += "\\r";
+            break;
+        case '\t':
+            out += "\\t";
+            break;
+        default: {
+            char esc[6] = {'\\', 'u', '0', '0', hex[c >> 4], hex[c & 0xf]};
+            out.append(esc, sizeof(esc));
+        }
+        }
+    }
+    out.append(s.data() + run, s.size() - run);
+    out += '"';
+}
+
+inline std::string escape_string(std::string_view s) {
+    std::string out;
+    out.reserve(s.size() + 2);
+    append_escaped(out, s);
+    return out;
+}
+
+// Streaming writer that appends straight to `out`: no intermediate tree and no per-value
+// allocations. Commas, indentation and escaping are handled here, so callers only emit
+// structure. `indent` < 0 writes compact output. Nesting is limited to 64 levels.
+//
+//   std::string out;
+//   json::Writer w(out);
+//   w.begin_object().field("mode", mode).field("pid", pid).end_object();
+class Writer {
+public:
+    explicit Writer(std::string& out, int indent = -1) : out_(out), indent_(indent) {}
+
+    Writer& begin_object() { return open('{'); }
+    Writer& end_object() { return close('}'); }
+    Writer& begin_array() { return open('['); }
+    Writer& end_array() { return close(']'); }
+
+    Writer& key(std::string_view k) {
+        separate();
+        append_escaped(out_, k);
+        out_ += ':';
+        if (indent_ >= 0) {
+            out_ += ' ';
+        }
+        after_key_ = true;
+        return *this;
+    }
+
+    Writer& value(std::string_view v) {
+        separate();
+        append_escaped(out_, v);
+        return *this;
+    }
+    Writer& value(const char* v) { return value(std::string_view(v)); }
+    Writer& value(const std::string& v) { return value(std::string_view(v)); }
+    Writer& value(bool v) {
+        separate();
+        out_ += v ? "true" : "false";
+        return *this;
+    }
+    Writer& value(double v) {
+        separate();
+        append_number(v);
+        return *this;
+    }
+    template <typename T, typename = std::enable_if_t<std::is_integral_v<T>>>
+    Writer& value(T v) {
+        separate();
+        char buf[24];
+        auto result = std::to_chars(buf, buf + sizeof(buf), v);
+        out_.append(buf, result.ptr);
+        return *this;
+    }
+    Writer& value(const Value& v);
+    Writer& null() {
+        separate();
+        out_ += "null";
+        return *this;
+    }
+    // Already-serialized JSON, inserted as one value
+    Writer& raw(std::string_view json) {
+        separate();
+        out_.append(json.data(), json.size());
+        return *this;
+    }
+
+    template <typename T>
+    Writer& field(std::string_view k, const T& v) {
+        key(k);
+        return value(v);
+    }
+
+    template <typename Range>
+    Writer& string_array(std::string_view k, const Range& items) {
+        key(k).begin_array();
+        for (const auto& item : items) {
+            value(std::string_view(item));
+        }
+        return end_array();
+    }
+
+private:
+    void newline() {
+        out_ += '\n';
+        out_.append(static_cast<size_t>(depth_ * indent_), ' ');
+    }
+
+    // Emit what precedes a key or a value at the current position
+    void separate() {
+        if (after_key_) {
+            after_key_ = false;
+            return;
+        }
+        if (depth_ == 0) {
+            return;
+        }
+        uint64_t bit = uint64_t{1} << (depth_ - 1);
+        if (fresh_ & bit) {
+            fresh_ &= ~bit;
+        } else {
+            out_ += ',';
+        }
+        if (indent_ >= 0) {
+            newline();
+        }
+    }
+
+    Writer& open(char c) {
+        separate();
+        out_ += c;
+        ++depth_;
+        fresh_ |= uint64_t{1} << (depth_ - 1);
+        return *this;
+    }
+
+    Writer& close(char c) {
+        uint64_t bit = uint64_t{1} << (depth_ - 1);
+        bool empty = fresh_ & bit;
+        fresh_ &= ~bit;
+        --depth_;
+        if (!empty && indent_ >= 0) {
+            newline();
+        }
+        out_ += c;
+        return *this;
+    }
+
+    void append_number(double v) {
+        char buf[32];
+        int n;
+        // Integral values (counts, sizes, timestamps) print without a fraction
+        if (v >= -9007199254740992.0 && v <= 9007199254740992.0 &&
+            v == static_cast<double>(static_cast<long long>(v))) {
+            n = static_cast<int>(
+                std::to_chars(buf, buf + sizeof(buf), static_cast<long long>(v)).ptr - buf);
+        } else if (v != v || v - v != 0) {
+            n = snprintf(buf, sizeof(buf), "null");  // NaN and infinities are not JSON
+        } else {
+            n = snprintf(buf, sizeof(buf), "%.15g", v);
+        }
+        out_.append(buf, static_cast<size_t>(n));
+    }
+
+    std::string& out_;
+    int indent_;
+    int depth_ = 0;
+    uint64_t fresh_ = 0;  // Bit per open container: nothing written into it yet
+    bool after_key_ = false;
+};
+
+inline Writer& Writer::value(const Value& v) {
+    switch (v.type()) {
     case Type::Null:
-        return "null";
+        return null();
     case Type::Bool:
-        return v.b ? "true" : "false";
-    case Type::Number: {
-        std::string s = std::to_string(v.n);
-        // Remove trailing zeros for integers represented as double
-        s.erase(s.find_last_not_of('0') + 1, std::string::npos);
-        if (s.back() == '.')
-            s.pop_back();
-        return s;
-    }
+        return value(v.as_bool());
+    case Type::Number:
+        return value(v.as_number());
     case Type::String:
-        return escape_string(v.s);
-    case Type::Array: {
-        if (v.a.empty())
-            return "[]";
-        std::ostringstream ss;
-        ss << "[" << (indent >= 0 ? "\n" : "");
-        for (size_t i = 0; i < v.a.size(); ++i) {
-            if (indent >= 0)
-                ss << std::string((level + 1) * indent, ' ');
-            ss << dump(v.a[i], indent, level + 1);
-            if (i < v.a.size() - 1)
-                ss << "," << (indent >= 0 ? "\n" : " ");
-        }
-        if (indent >= 0)
-            ss << "\n" << std::string(level * indent, ' ');
-        ss << "]";
-        return ss.str();
-    }
-    case Type::Object: {
-        if (v.o.empty())
-            return "{}";
-        std::ostringstream ss;
-        ss << "{" << (indent >= 0 ? "\n" : "");
-        size_t i = 0;
-        for (const auto& kv : v.o) {
-            if (indent >= 0)
-                ss << std::string((level + 1) * indent, ' ');
-            ss << escape_string(kv.first) << ":" << (indent >= 0 ? " " : "");
-            ss << dump(kv.second, indent, level + 1);
-            if (i < v.o.size() - 1)
-                ss << "," << (indent >= 0 ? "\n" : " ");
-            i++;
-        }
-        if (indent >= 0)
-            ss << "\n" << std::string(level * indent, ' ');
-        ss << "}";
-        return ss.str();
-    }
-    }
-    return "";
+        return value(std::string_view(v.as_string()));
+    case Type::Array:
+        begin_array();
+        for (const auto& item : v.as_array()) {
+            value(item);
+        }
+        return end_array();
+    case Type::Object:
+        begin_object();
+        for (const auto& [k, item] : v.as_object()) {
+            key(k);
+            value(item);
+        }
+        return end_object();
+    }
+    return *this;
 }
 
-class Parser {
-    const std::string& str;
-    size_t pos = 0;
+inline std::string dump(const Value& v, int indent = -1) {
+    std::string out;
+    Writer(out, indent).value(v);
+    return out;
+}
 
-    void skip_whitespace() {
-        while (pos < str.size() && std::isspace(str[pos]))
-            pos++;
-    }
+enum class Token {
+    BeginObject,
+    EndObject,
+    BeginArray,
+    EndArray,
+    Key,
+    String,
+    Number,
+    Bool,
+    Null,
+    End,    // Input fully consumed after one complete value
+    Error,  // Malformed input; every later call returns Error too
+};
+
+// Pull parser: next() yields one token at a time without building a tree, so a reader can
+// pick out the members it knows and skip() the rest. Key and String payloads are unescaped
+// into a reused buffer, valid until the following call. Nesting is limited to 64 levels.
+class Reader {
+public:
+    explicit Reader(std::string_view text) : text_(text) {}
 
-    Value parse_value() {
+    Token next() {
+        if (expect_ == Expect::Failed) {
+            return Token::Error;
+        }
         skip_whitespace();
-        if (pos >= str.size())
-            return Value();
-
-        char c = str[pos];
-        if (c == 'n') {
-            pos += 4;
-            return Value();
-        }  // null
-        if (c == 't') {
-            pos += 4;
-            return Value(true);
-        }
-        if (c == 'f') {
-            pos += 5;
-            return Value(false);
-        }
-        if (c == '"')
-            return parse_string();
-        if (c == '[')
-            return parse_array();
-        if (c == '{')
-            return parse_object();
-        if (c == '-' || std::isdigit(c))
-            return parse_number();
-        return Value();
-    }
+        if (expect_ == Expect::Done) {
+            return pos_ == text_.size() ? Token::End : fail();
+        }
+        if (pos_ >= text_.size()) {
+            return fail();
+        }
+        char c = text_[pos_];
 
-    Value parse_string() {
-        std::string s;
-        pos++;  // skip "
-        while (pos < str.size()) {
-            char c = str[pos++];
-            if (c == '"')
-                break;
-            if (c == '\\') {
-                if (pos >= str.size())
-                    break;
-                char next = str[pos++];
-                if (next == 'n')
-                    s += '\n';
-                else if (next == 't')
-                    s += '\t';
-                else if (next == '"')
-                    s += '"';
-                else if (next == '\\')
-                    s += '\\';
-                else
-                    s += next;
+        if (expect_ == Expect::CommaOrEnd) {
+            if (c == ',') {
+                ++pos_;
+                skip_whitespace();
+                expect_ = in_object() ? Expect::Key : Expect::Value;
+                if (pos_ >= text_.size()) {
+                    return fail();
+                }
+                c = text_[pos_];
             } else {
-                s += c;
+                return close(c);
+            }
+        } else if (expect_ == Expect::KeyOrEnd) {
+            if (c == '}') {
+                return close(c);
+            }
+            expect_ = Expect::Key;
+        } else if (expect_ == Expect::ValueOrEnd) {
+            if (c == ']') {
+                return close(c);
             }
+            expect_ = Expect::Value;
         }
-        return Value(s);
-    }
 
-    Value parse_number() {
-        size_t start = pos;
-        while (pos < str.size() && (std::isdigit(str[pos]) || str[pos] == '-' || str[pos] == '.'))
-            pos++;
-        std::string num_str = str.substr(start, pos - start);
-        return Value(std::stod(num_str));
+        if (expect_ == Expect::Key) {
+            if (c != '"' || !read_string()) {
+                return fail();
+            }
+            skip_whitespace();
+            if (pos_ >= text_.size() || text_[pos_] != ':') {
+                return fail();
+            }
+            ++pos_;
+            expect_ = Expect::Value;
+            return Token::Key;
+        }
+        return read_value(c);
     }
 
-    Value parse_array() {
-        Value v;
-        v.type = Type::Array;
-        pos++;  // skip [
+    const std::string& string() const { return string_; }
+    double number() const { return number_; }
+    bool boolean() const { return boolean_; }
+    size_t offset() const { return pos_; }
 
-        while (pos < str.size()) {
-            skip_whitespace();
-            if (str[pos] == ']') {
-                pos++;
+    // Consume the value that starts with the next token, e.g. after an unwanted Key
+    bool skip() {
+        int depth = 0;
+        do {
+            switch (next()) {
+            case Token::BeginObject:
+            case Token::BeginArray:
+                ++depth;
+                break;
+            case Token::EndObject:
+            case Token::EndArray:
+                --depth;
+                break;
+            case Token::End:
+            case Token::Error:
+                return false;
+            default:
                 break;
             }
-            v.a.push_back(parse_value());
-            skip_whitespace();
-            if (str[pos] == ',')
-                pos++;
+        } while (depth > 0);
+        return true;
+    }
+
+private:
+    enum class Expect { Value, Key, KeyOrEnd, ValueOrEnd, CommaOrEnd, Done, Failed };
+
+    static constexpr int MAX_DEPTH = 64;
+
+    bool in_object() const { return (objects_ >> (depth_ - 1)) & 1; }
+
+    Token fail() {
+        expect_ = Expect::Failed;
+        return Token::Error;
+    }
+
+    void skip_whitespace() {
+        while (pos_ < text_.size() && (text_[pos_] == ' ' || text_[pos_] == '\n' ||
+                                       text_[pos_] == '\r' || text_[pos_] == '\t')) {
+            ++pos_;
         }
-        return v;
     }
 
-    Value parse_object() {
-        Value v;
-        v.type = Type::Object;
-        pos++;  // skip {
+    void value_done() { expect_ = depth_ == 0 ? Expect::Done : Expect::CommaOrEnd; }
 
-        while (pos < str.size()) {
-            skip_whitespace();
-            if (str[pos] == '}') {
-                pos++;
+    Token open(bool object) {
+        if (depth_ == MAX_DEPTH) {
+            return fail();
+        }
+        ++pos_;
+        uint64_t bit = uint64_t{1} << depth_;
+        objects_ = object ? (objects_ | bit) : (objects_ & ~bit);
+        ++depth_;
+        expect_ = object ? Expect::KeyOrEnd : Expect::ValueOrEnd;
+        return object ? Token::BeginObject : Token::BeginArray;
+    }
+
+    Token close(char c) {
+        bool object = in_object();
+        if (c != (object ? '}' : ']')) {
+            return fail();
+        }
+        ++pos_;
+        --depth_;
+        value_done();
+        return object ? Token::EndObject : Token::EndArray;
+    }
+
+    bool match(std::string_view word) {
+        if (text_.compare(pos_, word.size(), word) != 0) {
+            return false;
+        }
+        pos_ += word.size();
+        return true;
+    }
+
+    Token read_value(char c) {
+        Token token;
+        switch (c) {
+        case '{':
+            return open(true);
+        case '[':
+            return open(false);
+        case '"':
+            if (!read_string()) {
+                return fail();
+            }
+            token = Token::String;
+            break;
+        case 't':
+        case 'f':
+            boolean_ = c == 't';
+            if (!match(boolean_ ? "true" : "false")) {
+                return fail();
+            }
+            token = Token::Bool;
+            break;
+        case 'n':
+            if (!match("null")) {
+                return fail();
+            }
+            token = Token::Null;
+            break;
+        default:
+            if (!read_number()) {
+                return fail();
+            }
+            token = Token::Number;
+        }
+        value_done();
+        return token;
+    }
+
+    bool read_number() {
+        size_t start = pos_;
+        while (pos_ < text_.size()) {
+            char c = text_[pos_];
+            if ((c >= '0' && c <= '9') || c == '-' || c == '+' || c == '.' || c == 'e' ||
+                c == 'E') {
+                ++pos_;
+            } else {
                 break;
             }
+        }
+        char buf[64];
+        size_t len = pos_ - start;
+        if (len == 0 || len >= sizeof(buf)) {
+            return false;
+        }
+        text_.copy(buf, len, start);
+        buf[len] = '\0';
+        char* end = nullptr;
+        number_ = strtod(buf, &end);
+        return end == buf + len;
+    }
 
-            Value key = parse_string();
-            skip_whitespace();
-            if (str[pos] == ':')
-                pos++;
+    bool read_hex4(uint32_t& out) {
+        if (text_.size() - pos_ < 4) {
+            return false;
+        }
+        out = 0;
+        for (int i = 0; i < 4; ++i) {
+            char c = text_[pos_++];
+            out <<= 4;
+            if (c >= '0' && c <= '9') {
+                out |= static_cast<uint32_t>(c - '0');
+            } else if (c >= 'a' && c <= 'f') {
+                out |= static_cast<uint32_t>(c - 'a' + 10);
+            } else if (c >= 'A' && c <= 'F') {
+                out |= static_cast<uint32_t>(c - 'A' + 10);
+            } else {
+                return false;
+            }
+        }
+        return true;
+    }
 
-            Value val = parse_value();
-            v.o[key.s] = val;
+    void append_utf8(uint32_t cp) {
+        if (cp < 0x80) {
+            string_ += static_cast<char>(cp);
+        } else if (cp < 0x800) {
+            string_ += static_cast<char>(0xc0 | (cp >> 6));
+            string_ += static_cast<char>(0x80 | (cp & 0x3f));
+        } else if (cp < 0x10000) {
+            string_ += static_cast<char>(0xe0 | (cp >> 12));
+            string_ += static_cast<char>(0x80 | ((cp >> 6) & 0x3f));
+            string_ += static_cast<char>(0x80 | (cp & 0x3f));
+        } else {
+            string_ += static_cast<char>(0xf0 | (cp >> 18));
+            string_ += static_cast<char>(0x80 | ((cp >> 12) & 0x3f));
+            string_ += static_cast<char>(0x80 | ((cp >> 6) & 0x3f));
+            string_ += static_cast<char>(0x80 | (cp & 0x3f));
+        }
+    }
 
-            skip_whitespace();
-            if (str[pos] == ',')
-                pos++;
+    bool read_string() {
+        string_.clear();
+        ++pos_;  // opening quote
+        size_t run = pos_;
+        while (pos_ < text_.size()) {
+            char c = text_[pos_];
+            if (c == '"') {
+                string_.append(text_.data() + run, pos_ - run);
+                ++pos_;
+                return true;
+            }
+            if (static_cast<unsigned char>(c) < 0x20) {
+                return false;  // Control characters must be escaped
+            }
+            if (c != '\\') {
+                ++pos_;
+                continue;
+            }
+            string_.append(text_.data() + run, pos_ - run);
+            if (++pos_ >= text_.size()) {
+                return false;
+            }
+            char esc = text_[pos_++];
+            switch (esc) {
+            case 'n':
+                string_ += '\n';
+                break;
+            case 't':
+                string_ += '\t';
+                break;
+            case 'r':
+                string_ += '\r';
+                break;
+            case 'b':
+                string_ += '\b';
+                break;
+            case 'f':
+                string_ += '\f';
+                break;
+            case '"':
+            case '\\':
+            case '/':
+                string_ += esc;
+                break;
+            case 'u': {
+                uint32_t cp;
+                if (!read_hex4(cp)) {
+                    return false;
+                }
+                if (cp >= 0xdc00 && cp < 0xe000) {
+                    return false;  // Low surrogate without a high one
+                }
+                if (cp >= 0xd800 && cp < 0xdc00) {
+                    uint32_t low;
+                    if (text_.compare(pos_, 2, "\\u") != 0) {
+                        return false;
+                    }
+                    pos_ += 2;
+                    if (!read_hex4(low) || low < 0xdc00 || low >= 0xe000) {
+                        return false;
+                    }
+                    cp = 0x10000 + ((cp - 0xd800) << 10) + (low - 0xdc00);
+                }
+                append_utf8(cp);
+                break;
+            }
+            default:
+                return false;
+            }
+            run = pos_;
         }
-        return v;
+        return false;
     }
 
-public:
-    Parser(const std::string& s) : str(s) {}
-    Value parse() { return parse_value(); }
+    std::string_view text_;
+    size_t pos_ = 0;
+    Expect expect_ = Expect::Value;
+    int depth_ = 0;
+    uint64_t objects_ = 0;  // Bit per open container: set for objects
+    std::string string_;
+    double number_ = 0;
+    bool boolean_ = false;
 };
 
-inline Value parse(const std::string& s) {
-    return Parser(s).parse();
+// Build a tree from the token at hand; throws std::runtime_error on malformed input
+inline Value read_tree(Reader& reader, Token token) {
+    switch (token) {
+    case Token::Null:
+        return Value();
+    case Token::Bool:
+        return Value(reader.boolean());
+    case Token::Number:
+        return Value(reader.number());
+    case Token::String:
+        return Value(reader.string());
+    case Token::BeginArray: {
+        Array items;
+        for (Token t = reader.next(); t != Token::EndArray; t = reader.next()) {
+            items.push_back(read_tree(reader, t));
+        }
+        return Value(std::move(items));
+    }
+    case Token::BeginObject: {
+        Object members;
+        for (Token t = reader.next(); t != Token::EndObject; t = reader.next()) {
+            if (t != Token::Key) {
+                throw std::runtime_error("Invalid JSON at offset " +
+                                         std::to_string(reader.offset()));
+            }
+            std::string key = reader.string();
+            members[key] = read_tree(reader, reader.next());
+        }
+        return Value(std::move(members));
+    }
+    default:
+        break;
+    }
+    throw std::runtime_error("Invalid JSON at offset " + std::to_string(reader.offset()));
+}
+
+inline Value parse(std::string_view text) {
+    Reader reader(text);
+    Value root = read_tree(reader, reader.next());
+    if (reader.next() != Token::End) {
+        throw std::runtime_error("Invalid JSON at offset " + std::to_string(reader.offset()));
+    }
+    return root;
 }
 
 }  // namespace json
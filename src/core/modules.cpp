@@ -7,6 +7,7 @@
 #include "../mount/hymofs.hpp"
 #include "../utils.hpp"
 #include "inventory.hpp"
+#include "trace.hpp"
 #include "json.hpp"  // Changed include
 
 namespace hymo {
@@ -25,6 +26,7 @@ static bool has_content(const fs::path& module_path,
 void update_module_description(bool success, const std::string& storage_mode, bool nuke_active,
                                size_t overlay_count, size_t magic_count, size_t hymofs_count,
                                const std::string& warning_msg, bool hymofs_active) {
+    TRACE_SCOPE("description");
     if (!fs::exists(MODULE_PROP_FILE)) {
         LOG_WARN("module.prop not found, skipping update");
         return;
@@ -98,44 +100,30 @@ void print_module_list(const Config& config) {
         }
     }
 
-    json::Value root = json::Value::object();
-    root["count"] = json::Value((int)filtered_modules.size());
-
-    json::Value mods_arr = json::Value::array();
+    const char* auto_strategy = HymoFS::is_available() ? "hymofs" : "overlay";
 
+    std::string out;
+    json::Writer w(out, 2);
+    w.begin_object().field("count", filtered_modules.size()).key("modules").begin_array();
     for (const auto& mod : filtered_modules) {
-        std::string strategy = mod.mode;
-        if (strategy == "auto") {
-            if (HymoFS::is_available())
-                strategy = "hymofs";
-            else
-                strategy = "overlay";
-        }
-
-        json::Value m = json::Value::object();
-        m["id"] = json::Value(mod.id);
-        m["path"] = json::Value(mod.source_path.string());
-        m["mode"] = json::Value(mod.mode);
-        m["strategy"] = json::Value(strategy);
-        m["name"] = json::Value(mod.name);
-        m["version"] = json::Value(mod.version);
-        m["author"] = json::Value(mod.author);
-        m["description"] = json::Value(mod.description);
-
-        json::Value rules_arr = json::Value::array();
+        w.begin_object()
+            .field("id", mod.id)
+            .field("path", mod.source_path.string())
+            .field("mode", mod.mode)
+            .field("strategy", mod.mode == "auto" ? auto_strategy : mod.mode.c_str())
+            .field("name", mod.name)
+            .field("version", mod.version)
+            .field("author", mod.author)
+            .field("description", mod.description)
+            .key("rules")
+            .begin_array();
         for (const auto& r : mod.rules) {
-            json::Value robj = json::Value::object();
-            robj["path"] = json::Value(r.path);
-            robj["mode"] = json::Value(r.mode);
-            rules_arr.push_back(robj);
+            w.begin_object().field("path", r.path).field("mode", r.mode).end_object();
         }
-        m["rules"] = rules_arr;
-
-        mods_arr.push_back(m);
+        w.end_array().end_object();
     }
-
-    root["modules"] = mods_arr;
-    std::cout << json::dump(root, 2) << "\n";
+    w.end_array().end_object();
+    std::cout << out << "\n";
 }
 
 }  // namespace hymo
@@ -0,0 +1,174 @@
+// core/overlay_history.cpp - Persisted per-target overlay outcomes implementation
+#include "overlay_history.hpp"
+#include <sys/utsname.h>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string_view>
+#include "../defs.hpp"
+#include "../utils.hpp"
+#include "json.hpp"
+
+namespace hymo {
+
+static json::Value outcome_to_json(const OverlayOutcome& entry) {
+    json::Value e = json::Value::object();
+    e["target"] = json::Value(entry.target);
+    e["layer_hash"] = json::Value(entry.layer_hash);
+    e["kernel_release"] = json::Value(entry.kernel_release);
+    e["errno"] = json::Value(entry.error);
+    e["error"] = json::Value(entry.error ? std::string(strerror(entry.error)) : std::string());
+    e["failed"] = json::Value(entry.failed());
+    e["timestamp"] = json::Value(static_cast<double>(entry.timestamp));
+    return e;
+}
+
+const OverlayOutcome* OverlayHistory::find_failure(const std::string& target,
+                                                   const std::string& layer_hash,
+                                                   const std::string& kernel_release) const {
+    for (const auto& entry : entries) {
+        if (entry.target == target && entry.failed() && entry.layer_hash == layer_hash &&
+            entry.kernel_release == kernel_release) {
+            return &entry;
+        }
+    }
+    return nullptr;
+}
+
+void OverlayHistory::record(const OverlayOutcome& outcome) {
+    for (auto& entry : entries) {
+        if (entry.target == outcome.target) {
+            entry = outcome;
+            return;
+        }
+    }
+    entries.push_back(outcome);
+}
+
+bool OverlayHistory::save() const {
+    ensure_dir_exists(fs::path(OVERLAY_HISTORY_FILE).parent_path());
+
+    json::Value arr = json::Value::array();
+    for (const auto& entry : entries) {
+        arr.push_back(outcome_to_json(entry));
+    }
+
+    // Replaced by rename, so a crash mid-write cannot cost the history of every target
+    if (!write_file_atomic(OVERLAY_HISTORY_FILE, json::dump(arr, 2) + "\n")) {
+        LOG_WARN("Failed to save overlay history");
+        return false;
+    }
+    return true;
+}
+
+OverlayHistory load_overlay_history() {
+    OverlayHistory history;
+
+    std::ifstream file(OVERLAY_HISTORY_FILE);
+    if (!file.is_open()) {
+        return history;
+    }
+
+    std::stringstream buffer;
+    buffer << file.rdbuf();
+
+    try {
+        auto root = json::parse(buffer.str());
+        if (root.type() != json::Type::Array) {
+            return history;
+        }
+        for (const auto& val : root.as_array()) {
+            if (val.type() != json::Type::Object) {
+                continue;
+            }
+            const auto& o = val.as_object();
+            if (!o.count("target")) {
+                continue;
+            }
+            OverlayOutcome entry;
+            entry.target = o.at("target").as_string();
+            if (o.count("layer_hash"))
+                entry.layer_hash = o.at("layer_hash").as_string();
+            if (o.count("kernel_release"))
+                entry.kernel_release = o.at("kernel_release").as_string();
+            if (o.count("errno"))
+                entry.error = static_cast<int>(o.at("errno").as_number());
+            if (o.count("timestamp"))
+                entry.timestamp = static_cast<int64_t>(o.at("timestamp").as_number());
+            history.entries.push_back(entry);
+        }
+    } catch (...) {
+        LOG_WARN("Failed to parse overlay history, starting fresh");
+        history.entries.clear();
+    }
+
+    return history;
+}
+
+// FNV-1a 64, followed by a separator so ["ab","c"] and ["a","bc"] differ
+static void fnv_mix(uint64_t& hash, std::string_view bytes) {
+    for (unsigned char c : bytes) {
+        hash ^= c;
+        hash *= 0x100000001b3ULL;
+    }
+    hash ^= ':';
+    hash *= 0x100000001b3ULL;
+}
+
+static std::string to_hex(uint64_t hash) {
+    char buf[17];
+    snprintf(buf, sizeof(buf), "%016llx", static_cast<unsigned long long>(hash));
+    return std::string(buf);
+}
+
+std::string module_content_fingerprint(const fs::path& module_root) {
+    for (const char* name : {".hymo_manifest", "module.prop"}) {
+        std::ifstream file(module_root / name, std::ios::binary);
+        if (!file.is_open()) {
+            continue;
+        }
+        std::stringstream buffer;
+        buffer << file.rdbuf();
+        uint64_t hash = 0xcbf29ce484222325ULL;
+        fnv_mix(hash, name);
+        fnv_mix(hash, buffer.str());
+        return to_hex(hash);
+    }
+    return "";
+}
+
+std::string hash_layer_set(const std::vector<std::string>& layers,
+                           const std::vector<std::string>& fingerprints) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < layers.size(); ++i) {
+        fnv_mix(hash, layers[i]);
+        fnv_mix(hash, i < fingerprints.size() ? fingerprints[i] : std::string());
+    }
+    return to_hex(hash);
+}
+
+std::string current_kernel_release() {
+    struct utsname uts;
+    if (uname(&uts) != 0) {
+        return "";
+    }
+    return uts.release;
+}
+
+std::string export_overlay_history_json() {
+    auto history = load_overlay_history();
+
+    json::Value root = json::Value::object();
+    root["kernel_release"] = json::Value(current_kernel_release());
+
+    json::Value arr = json::Value::array();
+    for (const auto& entry : history.entries) {
+        arr.push_back(outcome_to_json(entry));
+    }
+    root["entries"] = arr;
+
+    return json::dump(root);
+}
+
+}  // namespace hymo
@@ -0,0 +1,51 @@
+// core/overlay_history.hpp - Persisted per-target overlay outcomes
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+namespace hymo {
+
+// Last overlay attempt for one target with one set of inputs
+struct OverlayOutcome {
+    std::string target;
+    std::string layer_hash;      // Digest of the ordered lowerdir set
+    std::string kernel_release;  // uname release the attempt ran on
+    int error = 0;               // errno of the failure, 0 on success
+    int64_t timestamp = 0;
+
+    bool failed() const { return error != 0; }
+};
+
+struct OverlayHistory {
+    std::vector<OverlayOutcome> entries;
+
+    // Known failure for exactly these inputs, or nullptr
+    const OverlayOutcome* find_failure(const std::string& target, const std::string& layer_hash,
+                                       const std::string& kernel_release) const;
+    // Replace the entry for outcome.target
+    void record(const OverlayOutcome& outcome);
+    bool save() const;
+};
+
+OverlayHistory load_overlay_history();
+
+// Digest of what a module in storage contributes: its sync manifest, which records every
+// source file's size and timestamps, or its module.prop where storage keeps no manifest
+std::string module_content_fingerprint(const fs::path& module_root);
+
+// Stable digest of an ordered layer list and the content fingerprint of each layer's module,
+// so an updated module earns its targets a fresh overlay attempt
+std::string hash_layer_set(const std::vector<std::string>& layers,
+                           const std::vector<std::string>& fingerprints);
+
+std::string current_kernel_release();
+
+// JSON dump for `hymod api overlay-history`
+std::string export_overlay_history_json();
+
+}  // namespace hymo
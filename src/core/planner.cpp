@@ -4,11 +4,15 @@
 #include <sys/stat.h>
 #include <sys/sysmacros.h>
 #include <algorithm>
+#include <cstring>
 #include <map>
 #include <set>
 #include "../defs.hpp"
 #include "../mount/hymofs.hpp"
+#include "../mount/magic.hpp"
 #include "../utils.hpp"
+#include "overlay_history.hpp"
+#include "trace.hpp"
 #include "user_rules.hpp"
 
 namespace hymo {
@@ -29,6 +33,18 @@ bool MountPlan::is_covered_by_overlay(const std::string& path) const {
     return false;
 }
 
+void OverlayOperation::add_layer(const fs::path& layer) {
+    lowerdirs.push_back(layer);
+    // mount_overlay() only consults layers where a child mount has to be restored
+    if (!child_mounts_read) {
+        child_mounts = child_mount_relatives(target);
+        child_mounts_read = true;
+    }
+    if (!child_mounts.empty()) {
+        layer_index.push_back(build_layer_index(layer, child_mounts));
+    }
+}
+
 static bool has_files(const fs::path& path) {
     if (!fs::exists(path) || !fs::is_directory(path)) {
         return false;
@@ -91,8 +107,8 @@ static std::string resolve_path_for_hymofs(const std::string& path_str) {
     }
 }
 
-MountPlan generate_plan(const Config& config, const std::vector<Module>& modules,
-                        const fs::path& storage_root) {
+static MountPlan build_plan(const Config& config, const std::vector<Module>& modules,
+                            const fs::path& storage_root, bool use_hymofs) {
     MountPlan plan;
 
     std::map<std::string, std::vector<fs::path>> overlay_layers;
@@ -105,12 +121,8 @@ MountPlan generate_plan(const Config& config, const std::vector<Module>& modules
         target_partitions.push_back(part);
     }
 
-    HymoFSStatus status = HymoFS::check_status();
-    bool use_hymofs = (status == HymoFSStatus::Available) ||
-                      (config.ignore_protocol_mismatch && (status == HymoFSStatus::KernelTooOld ||
-                                                           status == HymoFSStatus::ModuleTooOld));
-
     for (const auto& module : modules) {
+        TRACE_SCOPE("plan_module", "module", module.id);
         fs::path content_path = storage_root / module.id;
 
         if (!fs::exists(content_path))
@@ -248,6 +260,17 @@ MountPlan generate_plan(const Config& config, const std::vector<Module>& modules
         }
     }
 
+    // Targets whose overlay failed before with the same layers and kernel go straight to
+    // magic mount; any change in either input earns them a fresh attempt.
+    OverlayHistory history;
+    std::string kernel_release;
+    if (!overlay_layers.empty()) {
+        history = load_overlay_history();
+        kernel_release = current_kernel_release();
+    }
+    std::set<std::string> doomed_ids;
+    std::map<std::string, std::string> fingerprints;  // module id -> content fingerprint
+
     // Construct Overlay Operations (only if not using HymoFS)
     for (auto& [target, layers] : overlay_layers) {
         if (layers.empty())
@@ -270,7 +293,47 @@ MountPlan generate_plan(const Config& config, const std::vector<Module>& modules
             continue;
         }
 
-        plan.overlay_ops.push_back(OverlayOperation{target_path.string(), layers});
+        std::vector<std::string> layer_strings;
+        std::vector<std::string> layer_fingerprints;
+        for (const auto& layer : layers) {
+            layer_strings.push_back(layer.string());
+            fs::path rel = layer.lexically_relative(storage_root);
+            std::string id = rel.empty() ? std::string() : rel.begin()->string();
+            auto found = fingerprints.find(id);
+            if (found == fingerprints.end()) {
+                found =
+                    fingerprints.emplace(id, module_content_fingerprint(storage_root / id)).first;
+            }
+            layer_fingerprints.push_back(found->second);
+        }
+        std::string layer_hash = hash_layer_set(layer_strings, layer_fingerprints);
+
+        if (const auto* failure =
+                history.find_failure(target_path.string(), layer_hash, kernel_release)) {
+            LOG_INFO("Overlay on " + target_path.string() + " failed before (" +
+                     strerror(failure->error) + "), routing to Magic Mount");
+            for (const auto& layer : layers) {
+                fs::path module_root = layer.parent_path();
+                if (module_root.empty())
+                    continue;
+                magic_paths.insert(module_root);
+                magic_ids.insert(module_root.filename().string());
+                doomed_ids.insert(module_root.filename().string());
+            }
+            continue;
+        }
+
+        OverlayOperation op;
+        op.target = target_path.string();
+        op.layer_hash = layer_hash;
+        for (const auto& layer : layers) {
+            op.add_layer(layer);
+        }
+        plan.overlay_ops.push_back(std::move(op));
+    }
+
+    for (const auto& id : doomed_ids) {
+        overlay_ids.erase(id);
     }
 
     plan.magic_module_paths.assign(magic_paths.begin(), magic_paths.end());
@@ -280,6 +343,76 @@ MountPlan generate_plan(const Config& config, const std::vector<Module>& modules
     return plan;
 }
 
+static int predict_plan_mounts(const Config& config, const MountPlan& plan) {
+    int count = 0;
+    for (const auto& op : plan.overlay_ops) {
+        count += predict_overlay_mounts(op.target);
+    }
+    if (!plan.magic_module_paths.empty()) {
+        count += predict_magic_mounts(plan.magic_module_paths, config.partitions);
+    }
+    return count;
+}
+
+// Switch every module in `ids` that has no per-path rules to `mode`; false if none changed
+static bool coarsen_modules(std::vector<Module>& modules, const std::vector<std::string>& ids,
+                            const std::string& mode) {
+    bool changed = false;
+    for (auto& module : modules) {
+        if (module.rules.empty() && module.mode != mode &&
+            std::find(ids.begin(), ids.end(), module.id) != ids.end()) {
+            module.mode = mode;
+            changed = true;
+        }
+    }
+    return changed;
+}
+
+MountPlan generate_plan(const Config& config, const std::vector<Module>& modules,
+                        const fs::path& storage_root) {
+    TRACE_SCOPE("plan");
+    HymoFSStatus status = HymoFS::check_status();
+    bool use_hymofs = (status == HymoFSStatus::Available) ||
+                      (config.ignore_protocol_mismatch && (status == HymoFSStatus::KernelTooOld ||
+                                                           status == HymoFSStatus::ModuleTooOld));
+
+    MountPlan plan = build_plan(config, modules, storage_root, use_hymofs);
+    // Predicting walks every magic module's tree, so it is only paid for with a budget set;
+    // otherwise only the measured growth is reported
+    if (config.max_mounts <= 0) {
+        return plan;
+    }
+    plan.predicted_mounts = predict_plan_mounts(config, plan);
+    if (plan.predicted_mounts <= config.max_mounts) {
+        return plan;
+    }
+
+    // Over budget: move whole modules to cheaper strategies, costliest first. Magic mount
+    // pays for every file and mirrored stock entry; HymoFS adds no mounts at all, and
+    // without it a module can still share the single overlay of each partition.
+    std::vector<Module> coarse = modules;
+    auto coarsen = [&](std::vector<std::string> ids, const std::string& mode) {
+        if (plan.predicted_mounts <= config.max_mounts || !coarsen_modules(coarse, ids, mode)) {
+            return;
+        }
+        int before = plan.predicted_mounts;
+        plan = build_plan(config, coarse, storage_root, use_hymofs);
+        plan.predicted_mounts = predict_plan_mounts(config, plan);
+        LOG_INFO("Mount budget " + std::to_string(config.max_mounts) + ": moved modules to " +
+                 mode + ", predicted mounts " + std::to_string(before) + " -> " +
+                 std::to_string(plan.predicted_mounts));
+    };
+    coarsen(plan.magic_module_ids, use_hymofs ? "hymofs" : "overlay");
+    if (use_hymofs) {
+        coarsen(plan.overlay_module_ids, "hymofs");
+    }
+    if (plan.predicted_mounts > config.max_mounts) {
+        LOG_WARN("Plan still needs " + std::to_string(plan.predicted_mounts) +
+                 " mounts, over the budget of " + std::to_string(config.max_mounts));
+    }
+    return plan;
+}
+
 struct AddRule {
     std::string src;
     std::string target;
@@ -290,6 +423,7 @@ void update_hymofs_mappings(const Config& config, const std::vector<Module>& mod
                             const fs::path& storage_root, MountPlan& plan) {
     if (!HymoFS::is_available())
         return;
+    TRACE_SCOPE("hymofs_rules");
 
     // Clear existing mappings
     HymoFS::clear_rules();
@@ -337,13 +471,15 @@ void update_hymofs_mappings(const Config& config, const std::vector<Module>& mod
         if (!is_hymofs)
             continue;
 
+        TRACE_SCOPE("hymofs_module", "module", module.id);
         fs::path mod_path = storage_root / module.id;
 
-        // Determine default mode for this module
+        // Determine default mode for this module. A module without rules is only listed
+        // here as a whole, including when the mount budget moved it off its configured mode;
+        // with rules, they decide per path
         std::string default_mode = module.mode;
-        if (default_mode == "auto")
-            default_mode = "hymofs";  // If it's in hymofs_module_ids, default is
-                                      // effectively hymofs unless overridden
+        if (default_mode == "auto" || module.rules.empty())
+            default_mode = "hymofs";
 
         for (const auto& part : target_partitions) {
             fs::path part_root = mod_path / part;
@@ -403,7 +539,7 @@ void update_hymofs_mappings(const Config& config, const std::vector<Module>& mod
                                     }
                                 }
                                 if (!exists && fs::exists(layer_path)) {
-                                    op.lowerdirs.push_back(layer_path);
+                                    op.add_layer(layer_path);
                                 }
                             }
                             break;
@@ -473,6 +609,7 @@ void update_hymofs_mappings(const Config& config, const std::vector<Module>& mod
     }
 
     // Apply rules: Add files first (auto-injects parents), then hide
+    TRACE_SCOPE("hymofs_push", "step");
     for (const auto& rule : add_rules) {
         HymoFS::add_rule(rule.src, rule.target, rule.type);
     }
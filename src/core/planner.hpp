@@ -2,6 +2,7 @@
 #pragma once
 
 #include "../conf/config.hpp"
+#include "../mount/overlay.hpp"
 #include "inventory.hpp"
 #include <filesystem>
 #include <map>
@@ -15,6 +16,14 @@ struct OverlayOperation {
   std::string target;
   std::vector<fs::path>
       lowerdirs; // Ordered from top to bottom (higher priority first)
+  // Parallel to lowerdirs, or empty when the target has no child mounts to restore
+  std::vector<LayerPathIndex> layer_index;
+  std::string layer_hash; // Identifies the planned layer set in overlay history
+
+  std::vector<std::string> child_mounts; // Relative to target, read by the first add_layer
+  bool child_mounts_read = false;
+
+  void add_layer(const fs::path &layer);
 };
 
 struct MountPlan {
@@ -23,6 +32,7 @@ struct MountPlan {
   std::vector<std::string> overlay_module_ids;
   std::vector<std::string> magic_module_ids;
   std::vector<std::string> hymofs_module_ids;
+  int predicted_mounts = 0; // Mounts execute_plan() is expected to add; 0 without max_mounts
 
   bool is_covered_by_overlay(const std::string &path) const;
 };
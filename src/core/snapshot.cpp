@@ -0,0 +1,247 @@
+// core/snapshot.cpp - Binary snapshot writer and mmap reader
+#include "snapshot.hpp"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include "../utils.hpp"
+
+namespace hymo {
+
+static constexpr char SNAPSHOT_MAGIC[4] = {'H', 'Y', 'S', 'N'};
+static constexpr uint32_t ENTRY_STRING = 0;
+static constexpr uint32_t ENTRY_LIST = 1;
+
+void SnapshotBuilder::set(const std::string& key, std::string_view value) {
+    entries_[key] = {ENTRY_STRING, std::string(value)};
+}
+
+void SnapshotBuilder::set_bool(const std::string& key, bool value) {
+    entries_[key] = {ENTRY_STRING, value ? "1" : "0"};
+}
+
+void SnapshotBuilder::set_int(const std::string& key, long long value) {
+    entries_[key] = {ENTRY_STRING, std::to_string(value)};
+}
+
+void SnapshotBuilder::set_list(const std::string& key, const std::vector<std::string>& items) {
+    std::string packed;
+    for (const auto& item : items) {
+        packed += item;
+        packed += '\0';
+    }
+    entries_[key] = {ENTRY_LIST, std::move(packed)};
+}
+
+bool SnapshotBuilder::write(const fs::path& path, SnapshotKind kind,
+                            std::string_view source) const {
+    size_t pool_off = sizeof(SnapshotHeader) + entries_.size() * sizeof(SnapshotEntry);
+    size_t pool_size = source.size();
+    for (const auto& [key, value] : entries_) {
+        pool_size += key.size() + value.second.size();
+    }
+    if (pool_off + pool_size > UINT32_MAX) {
+        return false;
+    }
+
+    std::string out(pool_off, '\0');
+    out.reserve(pool_off + pool_size);
+    auto append = [&out](std::string_view bytes) {
+        auto off = static_cast<uint32_t>(out.size());
+        out.append(bytes.data(), bytes.size());
+        return off;
+    };
+
+    SnapshotHeader header = {};
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.version = SNAPSHOT_VERSION;
+    header.kind = static_cast<uint16_t>(kind);
+    header.entry_count = static_cast<uint32_t>(entries_.size());
+    header.source_off = append(source);
+    header.source_len = static_cast<uint32_t>(source.size());
+
+    // std::map iterates in key order, which is the order readers binary-search
+    size_t slot = sizeof(SnapshotHeader);
+    for (const auto& [key, value] : entries_) {
+        SnapshotEntry entry;
+        entry.key_off = append(key);
+        entry.key_len = static_cast<uint32_t>(key.size());
+        entry.value_off = append(value.second);
+        entry.value_len = static_cast<uint32_t>(value.second.size());
+        entry.type = value.first;
+        memcpy(&out[slot], &entry, sizeof(entry));
+        slot += sizeof(entry);
+    }
+
+    header.total_size = out.size();
+    memcpy(&out[0], &header, sizeof(header));
+    return write_file_atomic(path, out);
+}
+
+SnapshotView::~SnapshotView() {
+    close();
+}
+
+void SnapshotView::close() {
+    if (data_) {
+        munmap(const_cast<char*>(data_), size_);
+    }
+    data_ = nullptr;
+    size_ = 0;
+    entries_ = nullptr;
+    count_ = 0;
+}
+
+bool SnapshotView::open(const fs::path& path, SnapshotKind kind) {
+    close();
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(SnapshotHeader)) {
+        ::close(fd);
+        return false;
+    }
+    size_t size = static_cast<size_t>(st.st_size);
+    void* map = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (map == MAP_FAILED) {
+        return false;
+    }
+    data_ = static_cast<const char*>(map);
+    size_ = size;
+
+    // Writers replace the file by rename, so a mapped snapshot never changes underneath us;
+    // these checks only reject foreign, stale-format or damaged files
+    SnapshotHeader header;
+    memcpy(&header, data_, sizeof(header));
+    size_t table_end = sizeof(header) + static_cast<size_t>(header.entry_count) *
+                                            sizeof(SnapshotEntry);
+    if (memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) != 0 ||
+        header.version != SNAPSHOT_VERSION || header.kind != static_cast<uint16_t>(kind) ||
+        header.total_size != size_ || table_end > size_ ||
+        static_cast<size_t>(header.source_off) + header.source_len > size_) {
+        close();
+        return false;
+    }
+    entries_ = reinterpret_cast<const SnapshotEntry*>(data_ + sizeof(header));
+    count_ = header.entry_count;
+    for (uint32_t i = 0; i < count_; ++i) {
+        const SnapshotEntry& entry = entries_[i];
+        if (static_cast<size_t>(entry.key_off) + entry.key_len > size_ ||
+            static_cast<size_t>(entry.value_off) + entry.value_len > size_) {
+            close();
+            return false;
+        }
+    }
+    return true;
+}
+
+bool SnapshotView::open_fresh(const fs::path& path, SnapshotKind kind, std::string_view source) {
+    if (!open(path, kind)) {
+        return false;
+    }
+    if (this->source() != source) {
+        close();
+        return false;
+    }
+    return true;
+}
+
+std::string_view SnapshotView::source() const {
+    if (!data_) {
+        return {};
+    }
+    SnapshotHeader header;
+    memcpy(&header, data_, sizeof(header));
+    return std::string_view(data_ + header.source_off, header.source_len);
+}
+
+std::string_view SnapshotView::key_of(const SnapshotEntry& entry) const {
+    return std::string_view(data_ + entry.key_off, entry.key_len);
+}
+
+std::string_view SnapshotView::value_of(const SnapshotEntry& entry) const {
+    return std::string_view(data_ + entry.value_off, entry.value_len);
+}
+
+const SnapshotEntry* SnapshotView::find(std::string_view key) const {
+    const SnapshotEntry* end = entries_ + count_;
+    const SnapshotEntry* it = std::lower_bound(
+        entries_, end, key,
+        [this](const SnapshotEntry& entry, std::string_view k) { return key_of(entry) < k; });
+    if (it == end || key_of(*it) != key) {
+        return nullptr;
+    }
+    return it;
+}
+
+bool SnapshotView::has(std::string_view key) const {
+    return find(key) != nullptr;
+}
+
+std::string_view SnapshotView::get(std::string_view key, std::string_view fallback) const {
+    const SnapshotEntry* entry = find(key);
+    if (!entry || entry->type != ENTRY_STRING) {
+        return fallback;
+    }
+    return value_of(*entry);
+}
+
+bool SnapshotView::get_bool(std::string_view key, bool fallback) const {
+    std::string_view value = get(key);
+    if (value.empty()) {
+        return fallback;
+    }
+    return value == "1";
+}
+
+long long SnapshotView::get_int(std::string_view key, long long fallback) const {
+    std::string value(get(key));
+    if (value.empty()) {
+        return fallback;
+    }
+    char* end = nullptr;
+    long long parsed = strtoll(value.c_str(), &end, 10);
+    return *end == '\0' ? parsed : fallback;
+}
+
+std::vector<std::string> SnapshotView::get_list(std::string_view key) const {
+    std::vector<std::string> items;
+    const SnapshotEntry* entry = find(key);
+    if (!entry || entry->type != ENTRY_LIST) {
+        return items;
+    }
+    std::string_view packed = value_of(*entry);
+    while (!packed.empty()) {
+        size_t nul = packed.find('\0');
+        if (nul == std::string_view::npos) {
+            break;
+        }
+        items.emplace_back(packed.substr(0, nul));
+        packed.remove_prefix(nul + 1);
+    }
+    return items;
+}
+
+std::vector<std::string_view> SnapshotView::keys_with_prefix(std::string_view prefix) const {
+    std::vector<std::string_view> keys;
+    const SnapshotEntry* end = entries_ + count_;
+    const SnapshotEntry* it = std::lower_bound(
+        entries_, end, prefix,
+        [this](const SnapshotEntry& entry, std::string_view k) { return key_of(entry) < k; });
+    for (; it != end; ++it) {
+        std::string_view key = key_of(*it);
+        if (key.substr(0, prefix.size()) != prefix) {
+            break;
+        }
+        keys.push_back(key.substr(prefix.size()));
+    }
+    return keys;
+}
+
+}  // namespace hymo
@@ -0,0 +1,97 @@
+// core/snapshot.hpp - Binary snapshots of the JSON config and state files
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <map>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+namespace hymo {
+
+// A snapshot is a flat, sorted key/value table derived from one or more JSON files. It is
+// tagged with a signature of those files (see file_signature) and is only trusted while the
+// signature still matches; the JSON files stay the source of truth.
+//
+// Layout (native endian, all offsets from the start of the file):
+//   SnapshotHeader
+//   SnapshotEntry[entry_count], sorted by key
+//   string pool: source signature, keys and values
+// Lists are stored as their items, each followed by a NUL byte.
+enum class SnapshotKind : uint16_t { Config = 1, State = 2, UserRules = 3 };
+
+constexpr uint16_t SNAPSHOT_VERSION = 1;
+
+struct SnapshotHeader {
+    char magic[4];  // "HYSN"
+    uint16_t version;
+    uint16_t kind;
+    uint32_t entry_count;
+    uint32_t source_off;
+    uint32_t source_len;
+    uint32_t reserved;
+    uint64_t total_size;
+};
+
+struct SnapshotEntry {
+    uint32_t key_off;
+    uint32_t key_len;
+    uint32_t value_off;
+    uint32_t value_len;
+    uint32_t type;  // 0 = string, 1 = list
+};
+
+class SnapshotBuilder {
+public:
+    void set(const std::string& key, std::string_view value);
+    void set_bool(const std::string& key, bool value);
+    void set_int(const std::string& key, long long value);
+    void set_list(const std::string& key, const std::vector<std::string>& items);
+
+    // Serialize and atomically replace `path`
+    bool write(const fs::path& path, SnapshotKind kind, std::string_view source) const;
+
+private:
+    std::map<std::string, std::pair<uint32_t, std::string>> entries_;
+};
+
+// Read-only view over an mmapped snapshot. Lookups are a binary search over the entry table
+// and return views into the mapping, valid for the lifetime of the SnapshotView.
+class SnapshotView {
+public:
+    SnapshotView() = default;
+    ~SnapshotView();
+    SnapshotView(const SnapshotView&) = delete;
+    SnapshotView& operator=(const SnapshotView&) = delete;
+
+    // Map `path` and check its header; false if missing, truncated or of another kind/version
+    bool open(const fs::path& path, SnapshotKind kind);
+    // Map `path` and accept it only if it was built from sources with this signature
+    bool open_fresh(const fs::path& path, SnapshotKind kind, std::string_view source);
+
+    std::string_view source() const;
+    bool has(std::string_view key) const;
+    std::string_view get(std::string_view key, std::string_view fallback = {}) const;
+    bool get_bool(std::string_view key, bool fallback) const;
+    long long get_int(std::string_view key, long long fallback) const;
+    std::vector<std::string> get_list(std::string_view key) const;
+    // Keys starting with `prefix`, in sorted order, with the prefix stripped
+    std::vector<std::string_view> keys_with_prefix(std::string_view prefix) const;
+
+private:
+    void close();
+    const SnapshotEntry* find(std::string_view key) const;
+    std::string_view key_of(const SnapshotEntry& entry) const;
+    std::string_view value_of(const SnapshotEntry& entry) const;
+
+    const char* data_ = nullptr;
+    size_t size_ = 0;
+    const SnapshotEntry* entries_ = nullptr;
+    uint32_t count_ = 0;
+};
+
+}  // namespace hymo
@@ -4,140 +4,160 @@
 #include <sstream>
 #include "../defs.hpp"
 #include "../utils.hpp"
+#include "json.hpp"
+#include "snapshot.hpp"
 
 namespace hymo {
 
+static void write_state_snapshot(const RuntimeState& state, const std::string& source) {
+    SnapshotBuilder snap;
+    snap.set("storage_mode", state.storage_mode);
+    snap.set("storage_decision", state.storage_decision);
+    snap.set("mount_point", state.mount_point);
+    snap.set_bool("nuke_active", state.nuke_active);
+    snap.set_bool("hymofs_mismatch", state.hymofs_mismatch);
+    snap.set("mismatch_message", state.mismatch_message);
+    snap.set_list("overlay_module_ids", state.overlay_module_ids);
+    snap.set_list("magic_module_ids", state.magic_module_ids);
+    snap.set_list("hymofs_module_ids", state.hymofs_module_ids);
+    snap.set_list("active_mounts", state.active_mounts);
+    snap.set_int("pid", state.pid);
+    if (!snap.write(STATE_SNAPSHOT_FILE, SnapshotKind::State, source)) {
+        LOG_DEBUG("Could not write runtime state snapshot");
+    }
+}
+
+static RuntimeState state_from_snapshot(const SnapshotView& snap) {
+    RuntimeState state;
+    state.storage_mode = std::string(snap.get("storage_mode"));
+    state.storage_decision = std::string(snap.get("storage_decision"));
+    state.mount_point = std::string(snap.get("mount_point"));
+    state.nuke_active = snap.get_bool("nuke_active", false);
+    state.hymofs_mismatch = snap.get_bool("hymofs_mismatch", false);
+    state.mismatch_message = std::string(snap.get("mismatch_message"));
+    state.overlay_module_ids = snap.get_list("overlay_module_ids");
+    state.magic_module_ids = snap.get_list("magic_module_ids");
+    state.hymofs_module_ids = snap.get_list("hymofs_module_ids");
+    state.active_mounts = snap.get_list("active_mounts");
+    state.pid = static_cast<int>(snap.get_int("pid", 0));
+    return state;
+}
+
 bool RuntimeState::save() const {
     ensure_dir_exists(fs::path(STATE_FILE).parent_path());
 
-    std::ofstream file(STATE_FILE);
-    if (!file.is_open()) {
+    std::string out;
+    json::Writer w(out, 2);
+    w.begin_object()
+        .field("storage_mode", storage_mode)
+        .field("storage_decision", storage_decision)
+        .field("mount_point", mount_point)
+        .field("nuke_active", nuke_active)
+        .field("hymofs_mismatch", hymofs_mismatch)
+        .field("mismatch_message", mismatch_message)
+        .string_array("overlay_module_ids", overlay_module_ids)
+        .string_array("magic_module_ids", magic_module_ids)
+        .string_array("hymofs_module_ids", hymofs_module_ids)
+        .string_array("active_mounts", active_mounts)
+        .field("pid", pid)
+        .end_object();
+    out += "\n";
+
+    if (!write_file_atomic(STATE_FILE, out)) {
         LOG_ERROR("Failed to save runtime state");
         return false;
     }
+    write_state_snapshot(*this, file_signature(STATE_FILE));
+    return true;
+}
 
-    file << "{\n";
-    file << "  \"storage_mode\": \"" << storage_mode << "\",\n";
-    file << "  \"mount_point\": \"" << mount_point << "\",\n";
-    file << "  \"nuke_active\": " << (nuke_active ? "true" : "false") << ",\n";
-    file << "  \"hymofs_mismatch\": " << (hymofs_mismatch ? "true" : "false") << ",\n";
-    file << "  \"mismatch_message\": \"" << mismatch_message << "\",\n";
-
-    file << "  \"overlay_module_ids\": [";
-    for (size_t i = 0; i < overlay_module_ids.size(); ++i) {
-        file << "\"" << overlay_module_ids[i] << "\"";
-        if (i < overlay_module_ids.size() - 1)
-            file << ", ";
-    }
-    file << "],\n";
-
-    file << "  \"magic_module_ids\": [";
-    for (size_t i = 0; i < magic_module_ids.size(); ++i) {
-        file << "\"" << magic_module_ids[i] << "\"";
-        if (i < magic_module_ids.size() - 1)
-            file << ", ";
+// Reads the array following a key; false if the value is not an array of strings
+static bool read_string_array(json::Reader& reader, std::vector<std::string>& out) {
+    if (reader.next() != json::Token::BeginArray) {
+        return false;
     }
-    file << "],\n";
-
-    file << "  \"hymofs_module_ids\": [";
-    for (size_t i = 0; i < hymofs_module_ids.size(); ++i) {
-        file << "\"" << hymofs_module_ids[i] << "\"";
-        if (i < hymofs_module_ids.size() - 1)
-            file << ", ";
+    for (json::Token t = reader.next(); t != json::Token::EndArray; t = reader.next()) {
+        if (t != json::Token::String) {
+            return false;
+        }
+        out.push_back(reader.string());
     }
-    file << "],\n";
+    return true;
+}
 
-    file << "  \"active_mounts\": [";
-    for (size_t i = 0; i < active_mounts.size(); ++i) {
-        file << "\"" << active_mounts[i] << "\"";
-        if (i < active_mounts.size() - 1)
-            file << ", ";
+static bool read_string(json::Reader& reader, std::string& out) {
+    if (reader.next() != json::Token::String) {
+        return false;
     }
-    file << "],\n";
-
-    file << "  \"pid\": " << pid << "\n";
-
-    file << "}\n";
-
+    out = reader.string();
     return true;
 }
 
-static std::vector<std::string> parse_json_array(const std::string& line) {
-    std::vector<std::string> result;
-    auto start = line.find("[");
-    auto end = line.find("]");
-    if (start == std::string::npos || end == std::string::npos)
-        return result;
-
-    std::string content = line.substr(start + 1, end - start - 1);
-    std::stringstream ss(content);
-    std::string item;
-    while (std::getline(ss, item, ',')) {
-        size_t first_quote = item.find("\"");
-        size_t last_quote = item.rfind("\"");
-        if (first_quote != std::string::npos && last_quote != std::string::npos &&
-            last_quote > first_quote) {
-            result.push_back(item.substr(first_quote + 1, last_quote - first_quote - 1));
-        }
+static bool read_bool(json::Reader& reader, bool& out) {
+    if (reader.next() != json::Token::Bool) {
+        return false;
     }
-    return result;
+    out = reader.boolean();
+    return true;
 }
 
 RuntimeState load_runtime_state() {
     RuntimeState state;
 
-    if (!fs::exists(STATE_FILE)) {
-        return state;
+    std::string source = file_signature(STATE_FILE);
+    SnapshotView snap;
+    if (snap.open_fresh(STATE_SNAPSHOT_FILE, SnapshotKind::State, source)) {
+        return state_from_snapshot(snap);
     }
 
     std::ifstream file(STATE_FILE);
     if (!file.is_open()) {
         return state;
     }
+    std::stringstream buffer;
+    buffer << file.rdbuf();
+    std::string content = buffer.str();
 
-    std::string line;
-    while (std::getline(file, line)) {
-        line.erase(0, line.find_first_not_of(" \t"));
-
-        if (line.find("\"storage_mode\"") != std::string::npos) {
-            auto start = line.find(": \"") + 3;
-            auto end = line.find("\"", start);
-            if (end != std::string::npos) {
-                state.storage_mode = line.substr(start, end - start);
-            }
-        } else if (line.find("\"mount_point\"") != std::string::npos) {
-            auto start = line.find(": \"") + 3;
-            auto end = line.find("\"", start);
-            if (end != std::string::npos) {
-                state.mount_point = line.substr(start, end - start);
-            }
-        } else if (line.find("\"nuke_active\"") != std::string::npos) {
-            state.nuke_active = line.find("true") != std::string::npos;
-        } else if (line.find("\"hymofs_mismatch\"") != std::string::npos) {
-            state.hymofs_mismatch = line.find("true") != std::string::npos;
-        } else if (line.find("\"overlay_module_ids\"") != std::string::npos) {
-            state.overlay_module_ids = parse_json_array(line);
-        } else if (line.find("\"magic_module_ids\"") != std::string::npos) {
-            state.magic_module_ids = parse_json_array(line);
-        } else if (line.find("\"hymofs_module_ids\"") != std::string::npos) {
-            state.hymofs_module_ids = parse_json_array(line);
-        } else if (line.find("\"active_mounts\"") != std::string::npos) {
-            state.active_mounts = parse_json_array(line);
-        } else if (line.find("\"pid\"") != std::string::npos) {
-            if (line.find(":") != std::string::npos) {
-                try {
-                    std::string val = line.substr(line.find(":") + 1);
-                    // Remove trailing comma if any
-                    if (val.find(",") != std::string::npos)
-                        val = val.substr(0, val.find(","));
-                    state.pid = std::stoi(val);
-                } catch (...) {
-                    state.pid = 0;
-                }
-            }
+    json::Reader reader(content);
+    if (reader.next() != json::Token::BeginObject) {
+        return state;
+    }
+    bool ok = true;
+    while (ok && reader.next() == json::Token::Key) {
+        std::string key = reader.string();
+        if (key == "storage_mode") {
+            ok = read_string(reader, state.storage_mode);
+        } else if (key == "storage_decision") {
+            ok = read_string(reader, state.storage_decision);
+        } else if (key == "mount_point") {
+            ok = read_string(reader, state.mount_point);
+        } else if (key == "mismatch_message") {
+            ok = read_string(reader, state.mismatch_message);
+        } else if (key == "nuke_active") {
+            ok = read_bool(reader, state.nuke_active);
+        } else if (key == "hymofs_mismatch") {
+            ok = read_bool(reader, state.hymofs_mismatch);
+        } else if (key == "overlay_module_ids") {
+            ok = read_string_array(reader, state.overlay_module_ids);
+        } else if (key == "magic_module_ids") {
+            ok = read_string_array(reader, state.magic_module_ids);
+        } else if (key == "hymofs_module_ids") {
+            ok = read_string_array(reader, state.hymofs_module_ids);
+        } else if (key == "active_mounts") {
+            ok = read_string_array(reader, state.active_mounts);
+        } else if (key == "pid") {
+            ok = reader.next() == json::Token::Number;
+            state.pid = ok ? static_cast<int>(reader.number()) : 0;
+        } else {
+            ok = reader.skip();
         }
     }
+    if (!ok) {
+        LOG_WARN("Runtime state file is malformed");
+        return state;
+    }
 
+    write_state_snapshot(state, source);
     return state;
 }
 
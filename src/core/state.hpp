@@ -8,6 +8,7 @@ namespace hymo {
 
 struct RuntimeState {
     std::string storage_mode;
+    std::string storage_decision;  // Why storage_mode was chosen
     std::string mount_point;
     std::vector<std::string> overlay_module_ids;
     std::vector<std::string> magic_module_ids;
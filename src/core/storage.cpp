@@ -1,28 +1,43 @@
 // core/storage.cpp - Storage backend (Tmpfs/Ext4/EROFS)
 #include "storage.hpp"
 #include <fcntl.h>
+#include <linux/fs.h>
 #include <sched.h>
+#include <sys/ioctl.h>
 #include <sys/mount.h>
+#include <sys/resource.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/sysinfo.h>
+#include <sys/sysmacros.h>
 #include <sys/vfs.h>
 #include <sys/wait.h>
 #include <unistd.h>
+#include <algorithm>
 #include <cstdio>
 #include <cstring>
+#include <fstream>
 #include <iostream>
+#include <memory>
+#include <sstream>
+#include <thread>
 #include "../defs.hpp"
+#include "../mount/mount_utils.hpp"
 #include "../utils.hpp"
+#include "erofs_writer.hpp"
 #include "json.hpp"
 #include "state.hpp"
+#include "sync.hpp"
+#include "trace.hpp"
 
 #include <cinttypes>
 
 namespace hymo {
 
-static bool try_setup_tmpfs(const fs::path& target) {
+static bool try_setup_tmpfs(const fs::path& target, uint64_t size_bytes) {
     LOG_DEBUG("Attempting Tmpfs...");
 
-    if (!mount_tmpfs(target)) {
+    if (!mount_tmpfs(target, size_bytes)) {
         LOG_WARN("Tmpfs mount failed.");
         return false;
     }
@@ -37,6 +52,33 @@ static bool try_setup_tmpfs(const fs::path& target) {
     }
 }
 
+// Expose the module directory itself, read-only, instead of a synced copy
+static bool try_setup_direct(const fs::path& target, const fs::path& module_dir) {
+    LOG_DEBUG("Attempting direct snapshot of " + module_dir.string() + "...");
+
+    if (module_dir.empty() || !fs::is_directory(module_dir)) {
+        LOG_WARN("Module directory unavailable for direct mode.");
+        return false;
+    }
+
+    if (mount(module_dir.c_str(), target.c_str(), nullptr, MS_BIND | MS_REC, nullptr) != 0) {
+        LOG_WARN("Direct bind failed: " + std::string(strerror(errno)));
+        return false;
+    }
+    // Keep later mounts under /data from showing up in the snapshot and vice versa
+    mount(nullptr, target.c_str(), nullptr, MS_PRIVATE | MS_REC, nullptr);
+
+    if (mount(nullptr, target.c_str(), nullptr, MS_REMOUNT | MS_BIND | MS_RDONLY, nullptr) != 0) {
+        LOG_WARN("Failed to make direct snapshot read-only: " + std::string(strerror(errno)));
+        umount2(target.c_str(), MNT_DETACH);
+        return false;
+    }
+
+    queue_unmountable(target);
+    LOG_INFO("Direct mode active (read-only snapshot, no sync).");
+    return true;
+}
+
 // Fix ownership and SELinux context for the storage root
 static void repair_storage_root_permissions(const fs::path& target) {
     LOG_DEBUG("Repairing storage root permissions...");
@@ -58,9 +100,53 @@ static void repair_storage_root_permissions(const fs::path& target) {
     }
 }
 
+// Image sizing: content plus a quarter on top, a fixed cushion, and a floor
+static constexpr uint64_t IMAGE_MIN_BYTES = 128ULL << 20;
+static constexpr uint64_t IMAGE_HEADROOM_BYTES = 64ULL << 20;
+static constexpr uint64_t IMAGE_SIZE_ALIGN = 16ULL << 20;
+
+// Bytes the module tree occupies once copied into an ext4 filesystem
+static uint64_t module_content_bytes(const fs::path& module_dir) {
+    uint64_t content = 0;
+    walk_tree(module_dir, [&content](const WalkEntry& e) {
+        struct stat st;
+        if (fstatat(e.parent_fd, e.name, &st, AT_SYMLINK_NOFOLLOW) != 0) {
+            return false;
+        }
+        // Whole 4K blocks for data, plus an ext4 inode
+        content += (static_cast<uint64_t>(st.st_size) + 4095) / 4096 * 4096 + 256;
+        return true;
+    });
+    return content;
+}
+
+static uint64_t image_size_for_content(uint64_t content) {
+    uint64_t size = content + content / 4 + IMAGE_HEADROOM_BYTES;
+    size = (size + IMAGE_SIZE_ALIGN - 1) / IMAGE_SIZE_ALIGN * IMAGE_SIZE_ALIGN;
+    return std::max(size, IMAGE_MIN_BYTES);
+}
+
+uint64_t estimate_image_size(const fs::path& module_dir) {
+    return image_size_for_content(module_content_bytes(module_dir));
+}
+
+// mke2fs is not on PATH in every context hymod runs from; PATH is only the last resort
+static std::string find_mke2fs() {
+    const char* paths[] = {"/system/bin/mke2fs", "/sbin/mke2fs"};
+    for (const auto& p : paths) {
+        if (access(p, X_OK) == 0) {
+            return p;
+        }
+    }
+    return "mke2fs";
+}
+
 // Remove static to expose it
-bool create_image(const fs::path& base_dir) {
-    LOG_INFO("Creating modules.img...");
+bool create_image(const fs::path& base_dir, uint64_t size_bytes, const fs::path& module_dir) {
+    if (size_bytes == 0) {
+        size_bytes = estimate_image_size(module_dir);
+    }
+    LOG_INFO("Creating modules.img (" + std::to_string(size_bytes >> 20) + "M)...");
     fs::path img_file = base_dir / "modules.img";
 
     // Ensure directory exists
@@ -73,50 +159,41 @@ bool create_image(const fs::path& base_dir) {
         fs::remove(img_file);
     }
 
-    // 1. Create file with dd
-    // Use dd instead of truncate for better compatibility and to avoid sparse file issues
-    // Try standard paths first
-    const char* dd_paths[] = {"/system/bin/dd", "/sbin/dd"};
-    std::string dd_bin = "dd";
-    for (const auto& p : dd_paths) {
-        if (access(p, X_OK) == 0) {
-            dd_bin = p;
-            break;
-        }
-    }
-
-    std::string dd_cmd =
-        dd_bin + " if=/dev/zero of=" + img_file.string() + " bs=1M count=2048 >/dev/null 2>&1";
-    if (std::system(dd_cmd.c_str()) != 0) {
-        LOG_ERROR("Failed to create image file with dd (" + dd_bin + ")");
+    // 1. Create the file. F2FS compression can only be turned off while it is still empty.
+    int fd = open(img_file.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        LOG_ERROR("Failed to create image file: " + std::string(strerror(errno)));
         return false;
     }
-
-    // 2. Disable F2FS compression (if supported)
-    const char* chattr_paths[] = {"/system/bin/chattr", "/system/xbin/chattr", "/sbin/chattr"};
-    std::string chattr_bin = "chattr";
-    for (const auto& p : chattr_paths) {
-        if (access(p, X_OK) == 0) {
-            chattr_bin = p;
-            break;
-        }
+    int attr = 0;
+    if (ioctl(fd, FS_IOC_GETFLAGS, &attr) == 0 && (attr & FS_COMPR_FL)) {
+        attr &= ~FS_COMPR_FL;
+        ioctl(fd, FS_IOC_SETFLAGS, &attr);
     }
-    std::string chattr_cmd = chattr_bin + " -c " + img_file.string() + " >/dev/null 2>&1";
-    std::system(chattr_cmd.c_str());
 
-    // 3. Find mke2fs
-    const char* mke2fs_paths[] = {"/system/bin/mke2fs", "/sbin/mke2fs"};
-    std::string mke2fs_bin = "mke2fs";  // fallback to PATH
-    for (const auto& p : mke2fs_paths) {
-        if (access(p, X_OK) == 0) {
-            mke2fs_bin = p;
-            break;
-        }
+    // 2. Reserve the space without writing it. A sparse file is the last resort, since the
+    //    loop device would fail writes once the data partition fills up.
+    bool sized = fallocate(fd, 0, 0, static_cast<off_t>(size_bytes)) == 0;
+    if (!sized && (errno == EOPNOTSUPP || errno == ENOSYS)) {
+        LOG_WARN("fallocate unsupported, creating a sparse image");
+        sized = ftruncate(fd, static_cast<off_t>(size_bytes)) == 0;
     }
+    if (!sized) {
+        LOG_ERROR("Failed to size image file: " + std::string(strerror(errno)));
+        close(fd);
+        fs::remove(img_file);
+        return false;
+    }
+    close(fd);
 
-    // 4. Format
+    // 3. Format
     // -t ext4 -O ^has_journal,^metadata_csum,^64bit -F
-    std::string mkfs_cmd = mke2fs_bin + " -t ext4 -O ^has_journal,^metadata_csum,^64bit -F " +
+    // -b/-i: 4K blocks even on small images, and an inode per block so a right-sized image
+    //        cannot run out of inodes before it runs out of space
+    // nodiscard: discarding a regular file punches holes and would undo the reservation
+    std::string mkfs_cmd = find_mke2fs() +
+                           " -t ext4 -b 4096 -i 4096 -O ^has_journal,^metadata_csum,^64bit"
+                           " -E nodiscard -F " +
                            img_file.string() + " >/dev/null 2>&1";
 
     if (std::system(mkfs_cmd.c_str()) != 0) {
@@ -129,16 +206,43 @@ bool create_image(const fs::path& base_dir) {
     return true;
 }
 
-static bool is_erofs_available() {
-    return access("/system/bin/mkfs.erofs", X_OK) == 0 ||
-           access("/vendor/bin/mkfs.erofs", X_OK) == 0 || access("/sbin/mkfs.erofs", X_OK) == 0;
+static std::string find_mkfs_erofs() {
+    const char* paths[] = {"/system/bin/mkfs.erofs", "/vendor/bin/mkfs.erofs", "/sbin/mkfs.erofs"};
+    for (const auto& p : paths) {
+        if (access(p, X_OK) == 0) {
+            return p;
+        }
+    }
+    return "";
 }
 
-static bool create_erofs_image(const fs::path& modules_dir, const fs::path& image_path) {
-    LOG_INFO("Creating EROFS image from " + modules_dir.string());
+// Same stream count the module sync uses
+static size_t erofs_write_streams(int sync_jobs) {
+    if (sync_jobs > 0) {
+        return static_cast<size_t>(sync_jobs);
+    }
+    return std::max(1u, std::min(std::thread::hardware_concurrency(), 4u));
+}
 
-    if (!fs::exists(modules_dir)) {
-        LOG_ERROR("Modules directory not found: " + modules_dir.string());
+static bool write_native_erofs_image(const std::vector<ErofsRoot>& roots,
+                                     const fs::path& image_path, size_t streams) {
+    ErofsWriteStats stats;
+    if (!write_erofs_image(roots, image_path, streams, &stats)) {
+        return false;
+    }
+    LOG_INFO("EROFS image written: " + std::to_string(stats.inodes) + " inodes, " +
+             std::to_string(stats.data_bytes) + " data bytes, " +
+             std::to_string(stats.image_bytes) + " bytes on disk");
+    return true;
+}
+
+// Fallback for when the in-process writer fails. `compressor` is an mkfs.erofs -z argument;
+// the boot path uses plain lz4 and leaves lz4hc to the background repack.
+static bool create_erofs_image_mkfs(const fs::path& modules_dir, const fs::path& image_path,
+                                    const std::string& compressor = "lz4") {
+    std::string mkfs = find_mkfs_erofs();
+    if (mkfs.empty()) {
+        LOG_ERROR("mkfs.erofs not found");
         return false;
     }
 
@@ -146,9 +250,8 @@ static bool create_erofs_image(const fs::path& modules_dir, const fs::path& imag
         fs::remove(image_path);
     }
 
-    // Compress with lz4hc
-    std::string cmd =
-        "mkfs.erofs -zlz4hc,9 " + image_path.string() + " " + modules_dir.string() + " 2>&1";
+    std::string cmd = mkfs + " -z" + compressor + " " + image_path.string() + " " +
+                      modules_dir.string() + " 2>&1";
 
     FILE* pipe = popen(cmd.c_str(), "r");
     if (!pipe) {
@@ -172,16 +275,202 @@ static bool create_erofs_image(const fs::path& modules_dir, const fs::path& imag
     return true;
 }
 
+// Stamp kept next to an EROFS image: the fingerprint of the tree it was built from and how
+// it is packed ("plain", "lz4" or "lz4hc"). An image whose fingerprint still matches the
+// modules is mounted as is.
+struct ErofsStamp {
+    std::string fingerprint;
+    std::string packing;
+};
+
+static fs::path erofs_stamp_path(const fs::path& image_path) {
+    return fs::path(image_path.string() + ".stamp");
+}
+
+static bool load_erofs_stamp(const fs::path& image_path, ErofsStamp& stamp) {
+    std::ifstream file(erofs_stamp_path(image_path));
+    return file && std::getline(file, stamp.fingerprint) && std::getline(file, stamp.packing) &&
+           !stamp.fingerprint.empty();
+}
+
+static bool save_erofs_stamp(const fs::path& image_path, const ErofsStamp& stamp) {
+    fs::path final_path = erofs_stamp_path(image_path);
+    fs::path tmp_path = final_path.string() + ".tmp";
+    {
+        std::ofstream file(tmp_path, std::ios::trunc);
+        if (!(file << stamp.fingerprint << "\n" << stamp.packing << "\n")) {
+            return false;
+        }
+    }
+    return rename(tmp_path.c_str(), final_path.c_str()) == 0;
+}
+
+// Digest of what an image built from `roots` would contain: names, types, modes, owners,
+// sizes and timestamps of every entry. ctime is included because relabelling and other
+// xattr changes move it. Costs one lstat per entry, like an up-to-date sync.
+static std::string fingerprint_erofs_roots(const std::vector<ErofsRoot>& roots) {
+    uint64_t hash = 1469598103934665603ULL;
+    auto mix = [&hash](const void* data, size_t len) {
+        const unsigned char* p = static_cast<const unsigned char*>(data);
+        for (size_t i = 0; i < len; ++i) {
+            hash = (hash ^ p[i]) * 1099511628211ULL;
+        }
+    };
+    auto mix_stat = [&mix](const struct stat& st) {
+        int64_t fields[] = {static_cast<int64_t>(st.st_mode),
+                            static_cast<int64_t>(st.st_uid),
+                            static_cast<int64_t>(st.st_gid),
+                            static_cast<int64_t>(st.st_size),
+                            static_cast<int64_t>(st.st_ino),
+                            static_cast<int64_t>(st.st_rdev),
+                            static_cast<int64_t>(st.st_mtim.tv_sec),
+                            static_cast<int64_t>(st.st_mtim.tv_nsec),
+                            static_cast<int64_t>(st.st_ctim.tv_sec),
+                            static_cast<int64_t>(st.st_ctim.tv_nsec)};
+        mix(fields, sizeof(fields));
+    };
+
+    // Images are laid out for the page size, so a different one means a different image
+    long page = sysconf(_SC_PAGESIZE);
+    mix("hymo-erofs 2", 12);
+    mix(&page, sizeof(page));
+    // Labels come from the live system, which only changes with an OTA
+    for (const char* prop : {"/system/build.prop", "/vendor/build.prop"}) {
+        std::string signature = file_signature(prop);
+        mix(signature.c_str(), signature.size() + 1);
+    }
+
+    for (const auto& root : roots) {
+        mix(root.name.c_str(), root.name.size() + 1);
+        struct stat st;
+        if (lstat(root.source.c_str(), &st) != 0) {
+            return "";
+        }
+        mix_stat(st);
+        bool walked = walk_tree(root.source, [&](const WalkEntry& e) {
+            struct stat entry_st;
+            if (fstatat(e.parent_fd, e.name, &entry_st, AT_SYMLINK_NOFOLLOW) != 0) {
+                return false;
+            }
+            mix(e.rel.c_str(), e.rel.size() + 1);
+            mix_stat(entry_st);
+            return true;
+        });
+        if (!walked) {
+            return "";
+        }
+    }
+
+    char buf[17];
+    snprintf(buf, sizeof(buf), "%016llx", static_cast<unsigned long long>(hash));
+    return buf;
+}
+
+static bool boot_completed() {
+    FILE* pipe = popen("getprop sys.boot_completed 2>/dev/null", "r");
+    if (!pipe) {
+        return false;
+    }
+    char buf[8] = {};
+    bool done = fgets(buf, sizeof(buf), pipe) && buf[0] == '1';
+    pclose(pipe);
+    return done;
+}
+
+// Repack the image with lz4hc from its own mount once the device has finished booting.
+// Runs in a detached idle-priority process. The repacked image only replaces the original
+// if the stamp still carries the same fingerprint, so a rebuild in the meantime wins.
+static void schedule_erofs_recompress(const fs::path& mnt_dir, const fs::path& image_path,
+                                      const std::string& fingerprint) {
+    std::string mkfs = find_mkfs_erofs();
+    if (mkfs.empty()) {
+        LOG_DEBUG("mkfs.erofs not found, EROFS image stays as written");
+        return;
+    }
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        LOG_WARN("Failed to fork EROFS repack: " + std::string(strerror(errno)));
+        return;
+    }
+    if (pid > 0) {
+        waitpid(pid, nullptr, 0);
+        LOG_INFO("EROFS image will be repacked with lz4hc after boot");
+        return;
+    }
+
+    // Double fork so the worker belongs to init and is never left as a zombie
+    if (fork() != 0) {
+        _exit(0);
+    }
+    setsid();
+    setpriority(PRIO_PROCESS, 0, 19);
+#ifdef SYS_ioprio_set
+    syscall(SYS_ioprio_set, 1 /* IOPRIO_WHO_PROCESS */, 0, 3 << 13 /* IOPRIO_CLASS_IDLE */);
+#endif // #ifdef SYS_ioprio_set
+
+    // Give up after half an hour rather than linger on a device that never reports boot
+    for (int i = 0; i < 360 && !boot_completed(); ++i) {
+        sleep(5);
+    }
+
+    fs::path tmp_path = image_path.string() + ".lz4hc";
+    std::string cmd = mkfs + " -zlz4hc,9 " + tmp_path.string() + " " + mnt_dir.string() +
+                      " >/dev/null 2>&1";
+    ErofsStamp stamp;
+    if (std::system(cmd.c_str()) == 0 && load_erofs_stamp(image_path, stamp) &&
+        stamp.fingerprint == fingerprint &&
+        rename(tmp_path.c_str(), image_path.c_str()) == 0) {
+        stamp.packing = "lz4hc";
+        save_erofs_stamp(image_path, stamp);
+        LOG_INFO("EROFS image repacked with lz4hc");
+    } else {
+        unlink(tmp_path.c_str());
+    }
+    _exit(0);
+}
+
+static bool create_erofs_image(const fs::path& modules_dir, const fs::path& image_path) {
+    LOG_INFO("Creating EROFS image from " + modules_dir.string());
+
+    if (!fs::exists(modules_dir)) {
+        LOG_ERROR("Modules directory not found: " + modules_dir.string());
+        return false;
+    }
+
+    std::vector<ErofsRoot> roots;
+    try {
+        for (const auto& entry : fs::directory_iterator(modules_dir)) {
+            if (entry.is_directory() && !entry.is_symlink()) {
+                roots.push_back({entry.path().filename().string(), entry.path(), {}});
+            }
+        }
+    } catch (const std::exception& e) {
+        LOG_ERROR("Failed to list " + modules_dir.string() + ": " + e.what());
+        return false;
+    }
+
+    if (write_native_erofs_image(roots, image_path, erofs_write_streams(0))) {
+        return true;
+    }
+    LOG_WARN("In-process EROFS writer failed, trying mkfs.erofs");
+    return create_erofs_image_mkfs(modules_dir, image_path);
+}
+
 static bool try_setup_erofs(const fs::path& target, const fs::path& modules_dir,
                             const fs::path& image_path) {
     LOG_DEBUG("Attempting EROFS...");
 
-    if (!is_erofs_available()) {
-        LOG_WARN("mkfs.erofs not found.");
+    if (!is_erofs_supported()) {
+        LOG_WARN("Kernel lacks EROFS support.");
         return false;
     }
 
-    if (!create_erofs_image(modules_dir, image_path)) {
+    // A stamped image is a real module image from an earlier boot: mounting it proves EROFS
+    // works just as well, and rebuilding it here would throw away what the next step reuses
+    ErofsStamp stamp;
+    bool have_image = fs::exists(image_path) && load_erofs_stamp(image_path, stamp);
+    if (!have_image && !create_erofs_image(modules_dir, image_path)) {
         LOG_WARN("Failed to create EROFS image.");
         return false;
     }
@@ -192,27 +481,72 @@ static bool try_setup_erofs(const fs::path& target, const fs::path& modules_dir,
     }
 
     // Register unmountable path for proper cleanup
-    send_unmountable(target);
+    queue_unmountable(target);
 
-    LOG_INFO("EROFS active (read-only, compressed)");
+    LOG_INFO("EROFS active (read-only)");
     return true;
 }
 
-StorageHandle setup_erofs_storage(const fs::path& mnt_dir, const fs::path& source_dir,
-                                  const fs::path& image_path) {
-    LOG_DEBUG("Setting up EROFS storage at " + mnt_dir.string() + " from " + source_dir.string());
+StorageHandle setup_erofs_storage(const fs::path& mnt_dir, const std::vector<Module>& modules,
+                                  const fs::path& staging_dir, const fs::path& image_path,
+                                  const Config& config) {
+    TRACE_SCOPE("erofs_build");
+    LOG_DEBUG("Setting up EROFS storage at " + mnt_dir.string() + " from " +
+              std::to_string(modules.size()) + " modules");
 
     if (fs::exists(mnt_dir)) {
         umount2(mnt_dir.c_str(), MNT_DETACH);
     }
     ensure_dir_exists(mnt_dir);
 
-    if (!is_erofs_available()) {
-        throw std::runtime_error("mkfs.erofs not found");
+    if (!is_erofs_supported()) {
+        throw std::runtime_error("Kernel lacks EROFS support");
     }
 
-    if (!create_erofs_image(source_dir, image_path)) {
-        throw std::runtime_error("Failed to create EROFS image");
+    // Labels are resolved while the image is written; the module sources are left as they are
+    std::vector<std::string> partitions = BUILTIN_PARTITIONS;
+    partitions.insert(partitions.end(), config.partitions.begin(), config.partitions.end());
+    std::vector<ErofsRoot> roots;
+    roots.reserve(modules.size());
+    for (const auto& module : modules) {
+        auto resolver = std::make_shared<ModuleContextResolver>(partitions);
+        roots.push_back({module.id, module.source_path,
+                         [resolver](const std::string& rel, bool is_dir) {
+                             return resolver->resolve(rel, is_dir);
+                         }});
+    }
+
+    ErofsStamp stamp;
+    std::string fingerprint = fingerprint_erofs_roots(roots);
+    if (!fingerprint.empty() && fs::exists(image_path) && load_erofs_stamp(image_path, stamp) &&
+        stamp.fingerprint == fingerprint) {
+        LOG_INFO("EROFS image is up to date (" + stamp.packing + "), reusing it");
+    } else {
+        // Drop the stamp first so an interrupted build is never mistaken for a current one
+        unlink(erofs_stamp_path(image_path).c_str());
+        stamp.fingerprint = fingerprint;
+
+        LOG_INFO("Writing EROFS image for " + std::to_string(modules.size()) + " modules...");
+        if (write_native_erofs_image(roots, image_path, erofs_write_streams(config.sync_jobs))) {
+            stamp.packing = "plain";
+            // A staging copy left from mkfs.erofs builds is dead weight now
+            if (fs::exists(staging_dir)) {
+                std::error_code ec;
+                fs::remove_all(staging_dir, ec);
+            }
+        } else {
+            LOG_WARN("In-process EROFS writer failed, staging modules for mkfs.erofs");
+            ensure_dir_exists(staging_dir);
+            perform_sync(modules, staging_dir, config);
+            if (!create_erofs_image_mkfs(staging_dir, image_path)) {
+                throw std::runtime_error("Failed to create EROFS image");
+            }
+            stamp.packing = "lz4";
+        }
+
+        if (!fingerprint.empty() && !save_erofs_stamp(image_path, stamp)) {
+            LOG_WARN("Failed to save EROFS image stamp");
+        }
     }
 
     if (!mount_image(image_path, mnt_dir, "erofs", "loop,ro,noatime")) {
@@ -220,18 +554,24 @@ StorageHandle setup_erofs_storage(const fs::path& mnt_dir, const fs::path& sourc
     }
 
     // Register unmountable path for proper cleanup
-    send_unmountable(mnt_dir);
+    queue_unmountable(mnt_dir);
+
+    LOG_INFO("EROFS active (read-only)");
 
-    LOG_INFO("EROFS active (read-only, compressed)");
-    return StorageHandle{mnt_dir, "erofs"};
+    if (config.erofs_recompress && !stamp.fingerprint.empty() && stamp.packing != "lz4hc") {
+        schedule_erofs_recompress(mnt_dir, image_path, stamp.fingerprint);
+    }
+    return StorageHandle{mnt_dir, "erofs", {}};
 }
 
-static std::string setup_ext4_image(const fs::path& target, const fs::path& image_path) {
+static std::string setup_ext4_image(const fs::path& target, const fs::path& image_path,
+                                    const fs::path& module_dir) {
     LOG_DEBUG("Falling back to Ext4...");
 
+    uint64_t wanted_size = estimate_image_size(module_dir);
     if (!fs::exists(image_path)) {
         LOG_WARN("modules.img missing, recreating...");
-        if (!create_image(image_path.parent_path())) {
+        if (!create_image(image_path.parent_path(), wanted_size, module_dir)) {
             throw std::runtime_error("Failed to create modules.img");
         }
     }
@@ -248,15 +588,153 @@ static std::string setup_ext4_image(const fs::path& target, const fs::path& imag
         }
     }
 
+    // Make room before the sync when modules outgrew the image
+    if (!grow_mounted_image(image_path, target, wanted_size)) {
+        LOG_WARN("Could not grow modules.img; sync may run out of space");
+    }
+
     // Register unmountable path for proper cleanup
-    send_unmountable(target);
+    queue_unmountable(target);
 
     LOG_INFO("Ext4 active.");
     return "ext4";
 }
 
+static std::string read_sysfs(const std::string& path) {
+    std::ifstream file(path);
+    std::string value;
+    std::getline(file, value);
+    return value;
+}
+
+static bool write_sysfs(const std::string& path, const std::string& value) {
+    int fd = open(path.c_str(), O_WRONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    bool ok = write(fd, value.data(), value.size()) == static_cast<ssize_t>(value.size());
+    close(fd);
+    return ok;
+}
+
+struct MemoryInfo {
+    uint64_t total = 0;
+    uint64_t available = 0;
+};
+
+// MemAvailable accounts for reclaimable page cache; sysinfo() only knows free RAM and
+// buffers, so it is the fallback on kernels too old to report it.
+static MemoryInfo read_memory_info() {
+    MemoryInfo mem;
+    struct sysinfo info;
+    if (sysinfo(&info) == 0) {
+        mem.total = static_cast<uint64_t>(info.totalram) * info.mem_unit;
+        mem.available = static_cast<uint64_t>(info.freeram + info.bufferram) * info.mem_unit;
+    }
+
+    std::ifstream meminfo("/proc/meminfo");
+    std::string key;
+    uint64_t kib = 0;
+    while (meminfo >> key >> kib) {
+        if (key == "MemAvailable:") {
+            mem.available = kib << 10;
+            break;
+        }
+        meminfo.ignore(64, '\n');
+    }
+    return mem;
+}
+
+// Content plus room for files modules create at runtime: a quarter again, kept between
+// 16M and 256M, rounded up to whole megabytes
+static uint64_t tmpfs_size_for_content(uint64_t content) {
+    uint64_t margin = std::clamp<uint64_t>(content / 4, 16ULL << 20, 256ULL << 20);
+    uint64_t size = content + margin;
+    return (size + (1ULL << 20) - 1) & ~((1ULL << 20) - 1);
+}
+
+// RAM that in-memory storage may claim: the configured share of total memory, and never
+// more than half of what is available right now
+static uint64_t ram_storage_budget(const MemoryInfo& mem, int max_ram_percent) {
+    int percent = std::clamp(max_ram_percent, 1, 90);
+    return std::min(mem.total / 100 * percent, mem.available / 2);
+}
+
+static std::string megabytes(uint64_t bytes) {
+    return std::to_string(bytes >> 20) + "M";
+}
+
+// ext4 on a freshly added zram device. Only written blocks take memory and they are held
+// compressed; mounting with discard hands deleted blocks back.
+static bool try_setup_zram(const fs::path& target, uint64_t content) {
+    LOG_DEBUG("Attempting zram...");
+
+    std::string id = read_sysfs("/sys/class/zram-control/hot_add");
+    if (id.empty() || id.find_first_not_of("0123456789") != std::string::npos) {
+        LOG_WARN("zram device hot-add unavailable.");
+        return false;
+    }
+    std::string sys_dir = "/sys/block/zram" + id;
+    auto release = [&id] { write_sysfs("/sys/class/zram-control/hot_remove", id); };
+
+    // lz4 decompresses fastest, which suits read-mostly module files
+    std::istringstream algorithms(read_sysfs(sys_dir + "/comp_algorithm"));
+    std::string algorithm;
+    while (algorithms >> algorithm) {
+        if (algorithm == "lz4" || algorithm == "[lz4]") {
+            write_sysfs(sys_dir + "/comp_algorithm", "lz4");
+            break;
+        }
+    }
+
+    if (!write_sysfs(sys_dir + "/disksize", std::to_string(image_size_for_content(content)))) {
+        LOG_WARN("Failed to size zram" + id + ": " + strerror(errno));
+        release();
+        return false;
+    }
+
+    // ueventd creates the node asynchronously; make our own if it is slow to appear
+    std::vector<fs::path> candidates = {"/dev/block/zram" + id, "/dev/zram" + id};
+    std::string dev;
+    int found = wait_for_any_path(candidates, 1000);
+    if (found >= 0) {
+        dev = candidates[found].string();
+    }
+    if (dev.empty()) {
+        unsigned int maj = 0, min = 0;
+        dev = std::string(RUN_DIR) + "zram" + id;
+        if (sscanf(read_sysfs(sys_dir + "/dev").c_str(), "%u:%u", &maj, &min) != 2 ||
+            mknod(dev.c_str(), S_IFBLK | 0600, makedev(maj, min)) != 0) {
+            LOG_WARN("No device node for zram" + id);
+            release();
+            return false;
+        }
+    }
+
+    std::string mkfs_cmd = find_mke2fs() +
+                           " -t ext4 -b 4096 -O ^has_journal,^metadata_csum,^64bit -F " + dev +
+                           " >/dev/null 2>&1";
+    if (std::system(mkfs_cmd.c_str()) != 0) {
+        LOG_WARN("Failed to format zram" + id);
+        release();
+        return false;
+    }
+
+    if (mount(dev.c_str(), target.c_str(), "ext4", MS_NOATIME, "discard") != 0) {
+        LOG_WARN("zram mount failed: " + std::string(strerror(errno)));
+        release();
+        return false;
+    }
+
+    queue_unmountable(target);
+    LOG_INFO("zram active (compressed RAM, zram" + id + ").");
+    return true;
+}
+
 StorageHandle setup_storage(const fs::path& mnt_dir, const fs::path& image_path,
-                            FilesystemType fs_type) {
+                            FilesystemType fs_type, const fs::path& module_dir,
+                            int tmpfs_max_ram_percent) {
+    TRACE_SCOPE("storage");
     LOG_DEBUG("Setting up storage at " + mnt_dir.string());
 
     if (fs::exists(mnt_dir)) {
@@ -265,13 +743,46 @@ StorageHandle setup_storage(const fs::path& mnt_dir, const fs::path& image_path,
     ensure_dir_exists(mnt_dir);
 
     std::string mode;
+    std::string decision;
     fs::path erofs_image = image_path.parent_path() / "modules.erofs";
     fs::path modules_dir = image_path.parent_path() / "modules";
 
+    // Only walked and measured when a RAM-backed mode is considered
+    uint64_t content = 0;
+    MemoryInfo mem;
+    uint64_t budget = 0;
+    bool measured = false;
+    auto measure = [&]() {
+        if (!measured) {
+            content = module_content_bytes(module_dir);
+            mem = read_memory_info();
+            budget = ram_storage_budget(mem, tmpfs_max_ram_percent);
+            measured = true;
+            LOG_DEBUG("Module content " + megabytes(content) + ", RAM " + megabytes(mem.total) +
+                      " (" + megabytes(mem.available) + " available), in-memory budget " +
+                      megabytes(budget));
+        }
+    };
+    auto memory_figures = [&]() {
+        return "; budget " + megabytes(budget) + " (" + std::to_string(tmpfs_max_ram_percent) +
+               "% of " + megabytes(mem.total) + " RAM, " + megabytes(mem.available) +
+               " available)";
+    };
+
     // Helper functions for readability
     auto do_tmpfs = [&]() {
-        if (try_setup_tmpfs(mnt_dir)) {
+        measure();
+        uint64_t size = tmpfs_size_for_content(content);
+        if (mem.total > 0 && size > budget) {
+            decision = "tmpfs of " + megabytes(size) + " for " + megabytes(content) +
+                       " of modules does not fit" + memory_figures();
+            LOG_WARN(decision);
+            return false;
+        }
+        if (try_setup_tmpfs(mnt_dir, size)) {
             mode = "tmpfs";
+            decision =
+                "tmpfs sized " + megabytes(size) + " for " + megabytes(content) + memory_figures();
             return true;
         }
         return false;
@@ -285,12 +796,48 @@ StorageHandle setup_storage(const fs::path& mnt_dir, const fs::path& image_path,
         return false;
     };
 
+    auto do_zram = [&]() {
+        measure();
+        if (try_setup_zram(mnt_dir, content)) {
+            mode = "zram";
+            decision = (decision.empty() ? "" : decision + "; ") + "zram for " +
+                       megabytes(content) + " of modules";
+            return true;
+        }
+        return false;
+    };
+
+    // Compressed RAM is the next step down from tmpfs while modules still fit in the
+    // budget at a typical 2:1 lz4 ratio
+    auto zram_fits = [&]() {
+        measure();
+        return mem.total > 0 && content / 2 <= budget;
+    };
+
     auto do_ext4 = [&]() {
-        mode = setup_ext4_image(mnt_dir, image_path);
+        mode = setup_ext4_image(mnt_dir, image_path, module_dir);
         return true;
     };
 
     switch (fs_type) {
+    case FilesystemType::DIRECT:
+        if (try_setup_direct(mnt_dir, module_dir)) {
+            mode = "direct";
+        } else {
+            LOG_WARN("Direct mode unavailable, falling back to auto preference");
+            if (!do_tmpfs() && !do_erofs())
+                do_ext4();
+        }
+        break;
+
+    case FilesystemType::ZRAM:
+        if (!do_zram()) {
+            LOG_WARN("zram setup failed, falling back to auto preference");
+            if (!do_tmpfs() && !do_erofs())
+                do_ext4();
+        }
+        break;
+
     case FilesystemType::EXT4:
         do_ext4();
         break;
@@ -305,23 +852,75 @@ StorageHandle setup_storage(const fs::path& mnt_dir, const fs::path& image_path,
     case FilesystemType::TMPFS:
         if (!do_tmpfs()) {
             LOG_WARN("Tmpfs setup failed (or no xattr), falling back to auto preference");
-            if (!do_erofs())
+            if (!(zram_fits() && do_zram()) && !do_erofs())
                 do_ext4();
         }
         break;
 
     case FilesystemType::AUTO:
     default:
-        // Try: Tmpfs -> EROFS -> Ext4
+        // Try: Tmpfs -> zram -> EROFS -> Ext4, RAM-backed modes only within budget
         if (!do_tmpfs()) {
-            if (!do_erofs()) {
+            if (!(zram_fits() && do_zram()) && !do_erofs()) {
                 do_ext4();
             }
         }
         break;
     }
 
-    return StorageHandle{mnt_dir, mode};
+    if (mode != "tmpfs" && mode != "zram") {
+        decision = (decision.empty() ? "" : decision + "; ") + mode + " selected";
+    }
+    return StorageHandle{mnt_dir, mode, decision};
+}
+
+bool grow_storage_for(const fs::path& mount_point, const std::string& mode,
+                      const std::vector<Module>& modules, int tmpfs_max_ram_percent) {
+    // Copies are replaced file by file, so only the growth over the old copies has to fit
+    uint64_t incoming = 0;
+    uint64_t outgoing = 0;
+    for (const auto& module : modules) {
+        incoming += module_content_bytes(module.source_path);
+        outgoing += module_content_bytes(mount_point / module.id);
+    }
+    uint64_t growth = incoming > outgoing ? incoming - outgoing : 0;
+
+    struct statfs sfs;
+    if (statfs(mount_point.c_str(), &sfs) != 0) {
+        return false;
+    }
+    uint64_t total = static_cast<uint64_t>(sfs.f_blocks) * sfs.f_bsize;
+    uint64_t available = static_cast<uint64_t>(sfs.f_bavail) * sfs.f_bsize;
+    // The same quarter on top that images are sized with
+    if (growth + growth / 4 <= available) {
+        return true;
+    }
+    uint64_t content = total - available + growth;
+
+    if (mode == "tmpfs") {
+        uint64_t size = tmpfs_size_for_content(content);
+        MemoryInfo mem = read_memory_info();
+        uint64_t budget = ram_storage_budget(mem, tmpfs_max_ram_percent);
+        if (mem.total > 0 && size > budget) {
+            LOG_WARN("tmpfs of " + megabytes(size) + " would exceed the in-memory budget of " +
+                     megabytes(budget));
+            return false;
+        }
+        std::string options = "size=" + std::to_string(size);
+        if (mount("tmpfs", mount_point.c_str(), "tmpfs", MS_REMOUNT, options.c_str()) != 0) {
+            LOG_WARN("Failed to resize tmpfs: " + std::string(strerror(errno)));
+            return false;
+        }
+        LOG_INFO("Resized tmpfs storage to " + megabytes(size));
+        return true;
+    }
+    if (mode == "ext4") {
+        return grow_mounted_image(fs::path(BASE_DIR) / "modules.img", mount_point,
+                                  image_size_for_content(content));
+    }
+    LOG_WARN(mode + " storage cannot grow; " + megabytes(growth) + " more needed, " +
+             megabytes(available) + " free");
+    return false;
 }
 
 void finalize_storage_permissions(const fs::path& storage_root) {
@@ -431,6 +1030,10 @@ void print_storage_status() {
     root["avail"] = json::Value(format_size(free_bytes));
     root["percent"] = json::Value(percent);
     root["mode"] = json::Value(fs_type);
+    if (!state.storage_decision.empty()) {
+        root["decision"] = json::Value(state.storage_decision);
+    }
+    root["dedup_saved_bytes"] = json::Value(static_cast<double>(dedup_saved_bytes(path)));
 
     std::cout << json::dump(root) << "\n";
 }
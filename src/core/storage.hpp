@@ -1,9 +1,12 @@
 // core/storage.hpp - Storage management
 #pragma once
 
+#include <cstdint>
 #include <filesystem>
 #include <string>
+#include <vector>
 #include "../conf/config.hpp"
+#include "inventory.hpp"
 
 namespace fs = std::filesystem;
 
@@ -11,20 +14,39 @@ namespace hymo {
 
 struct StorageHandle {
     fs::path mount_point;
-    std::string mode;  // tmpfs, ext4, erofs
+    std::string mode;      // tmpfs, ext4, erofs, direct, zram
+    std::string decision;  // Sizing and memory figures behind `mode`, for RuntimeState
 };
 
+// In "direct" mode `mnt_dir` is a read-only bind snapshot of `module_dir` and no content
+// needs to be synced into it. tmpfs is sized from the content of `module_dir` and is only
+// used while that fits in `tmpfs_max_ram_percent` of RAM and half of what is available;
+// otherwise compressed (zram) or on-disk storage is chosen instead.
 StorageHandle setup_storage(const fs::path& mnt_dir, const fs::path& image_path,
-                            FilesystemType fs_type);
-
-// Build an EROFS image from `source_dir` and mount it read-only at `mnt_dir`.
-// This is intended for mirror flows where content must be synced to a writable
-// staging directory before creating the compressed EROFS image.
-StorageHandle setup_erofs_storage(const fs::path& mnt_dir, const fs::path& source_dir,
-                                  const fs::path& image_path);
-
-// Exposed for CLI tools
-bool create_image(const fs::path& base_dir);
+                            FilesystemType fs_type, const fs::path& module_dir,
+                            int tmpfs_max_ram_percent = 25);
+
+// Build an EROFS image with one directory per module and mount it read-only at `mnt_dir`.
+// The image is written in-process straight from the module directories, with SELinux
+// labels resolved as it is written; the module sources are not relabelled. Only if that
+// fails are the modules synced into `staging_dir` and packed with mkfs.erofs.
+StorageHandle setup_erofs_storage(const fs::path& mnt_dir, const std::vector<Module>& modules,
+                                  const fs::path& staging_dir, const fs::path& image_path,
+                                  const Config& config);
+
+// Exposed for CLI tools. A size of 0 sizes the image from the content of `module_dir`.
+bool create_image(const fs::path& base_dir, uint64_t size_bytes = 0,
+                  const fs::path& module_dir = "/data/adb/modules");
+
+// ext4 image size that fits `module_dir` with headroom
+uint64_t estimate_image_size(const fs::path& module_dir);
+
+// Make room in the writable storage mounted at `mount_point` before the copies of `modules`
+// are refreshed: a tmpfs is remounted larger, within the same in-memory budget as at boot,
+// and the ext4 image is grown in place. zram devices have a fixed size. False if the
+// content would not fit.
+bool grow_storage_for(const fs::path& mount_point, const std::string& mode,
+                      const std::vector<Module>& modules, int tmpfs_max_ram_percent);
 
 void finalize_storage_permissions(const fs::path& storage_root);
 
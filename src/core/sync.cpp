@@ -1,9 +1,26 @@
 // core/sync.cpp - Module content sync
 #include "sync.hpp"
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/xattr.h>
+#include <unistd.h>
+#include <algorithm>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <deque>
 #include <fstream>
+#include <functional>
+#include <memory>
+#include <mutex>
 #include <set>
+#include <system_error>
+#include <thread>
+#include <unordered_map>
 #include "../defs.hpp"
 #include "../utils.hpp"
+#include "trace.hpp"
 
 namespace hymo {
 
@@ -19,36 +36,759 @@ static bool has_content(const fs::path& module_path,
     return false;
 }
 
-// Check if module needs sync by comparing module.prop
-static bool should_sync(const fs::path& src, const fs::path& dst) {
-    if (!fs::exists(dst)) {
-        return true;  // New module
+// Per-module manifest of what was last copied into storage. Each entry records the
+// source attributes at copy time so an unchanged tree can be confirmed with stats alone.
+static constexpr const char* MANIFEST_NAME = ".hymo_manifest";
+static constexpr const char* MANIFEST_HEADER = "hymo-manifest 2";
+
+// Upper bound on file bytes queued or being copied at once
+static constexpr uint64_t SYNC_INFLIGHT_BYTES = 64ULL * 1024 * 1024;
+
+struct SyncStats {
+    size_t copied = 0;
+    size_t removed = 0;
+    size_t unchanged = 0;
+    uint64_t bytes_copied = 0;
+    uint64_t bytes_linked = 0;  // Served from the dedup store instead of copied
+
+    bool changed() const { return copied != 0 || removed != 0; }
+};
+
+struct ManifestEntry {
+    char type = 'F';  // F(ile), D(irectory), L(ink)
+    uint32_t mode = 0;
+    uint32_t uid = 0;
+    uint32_t gid = 0;
+    uint64_t size = 0;
+    int64_t mtime_ns = 0;
+    int64_t ctime_ns = 0;
+    uint64_t hash = 0;        // Content digest, 0 until a comparison needed it
+    uint64_t xattr_hash = 0;  // Digest of the xattrs sync copies, 0 when there are none
+};
+
+using Manifest = std::unordered_map<std::string, ManifestEntry>;
+
+static int64_t to_ns(const struct timespec& ts) {
+    return static_cast<int64_t>(ts.tv_sec) * 1000000000LL + ts.tv_nsec;
+}
+
+static ManifestEntry entry_from_stat(const struct stat& st) {
+    ManifestEntry entry;
+    if (S_ISDIR(st.st_mode)) {
+        entry.type = 'D';
+    } else if (S_ISLNK(st.st_mode)) {
+        entry.type = 'L';
     }
+    entry.mode = st.st_mode & 07777;
+    entry.uid = st.st_uid;
+    entry.gid = st.st_gid;
+    entry.size = static_cast<uint64_t>(st.st_size);
+    entry.mtime_ns = to_ns(st.st_mtim);
+    entry.ctime_ns = to_ns(st.st_ctim);
+    return entry;
+}
 
-    fs::path src_prop = src / "module.prop";
-    fs::path dst_prop = dst / "module.prop";
+// Returns false when there is no usable manifest
+static bool load_manifest(const fs::path& dst, Manifest& manifest) {
+    std::ifstream file(dst / MANIFEST_NAME);
+    if (!file.is_open()) {
+        return false;
+    }
 
-    if (!fs::exists(src_prop) || !fs::exists(dst_prop)) {
-        return true;  // Force sync if prop missing
+    std::string line;
+    if (!std::getline(file, line) || line != MANIFEST_HEADER) {
+        return false;
     }
 
-    try {
-        std::ifstream src_file(src_prop, std::ios::binary);
-        std::ifstream dst_file(dst_prop, std::ios::binary);
+    while (std::getline(file, line)) {
+        // type mode uid gid size mtime ctime hash xattr_hash <TAB> path
+        size_t tab = line.find('\t');
+        if (tab == std::string::npos || tab + 1 >= line.size()) {
+            return false;
+        }
+        ManifestEntry entry;
+        unsigned long long size = 0, hash = 0, xattr_hash = 0;
+        long long mtime = 0, ctime_val = 0;
+        unsigned int mode = 0, uid = 0, gid = 0;
+        if (sscanf(line.c_str(), "%c %o %u %u %llu %lld %lld %llx %llx", &entry.type, &mode, &uid,
+                   &gid, &size, &mtime, &ctime_val, &hash, &xattr_hash) != 9) {
+            return false;
+        }
+        entry.mode = mode;
+        entry.uid = uid;
+        entry.gid = gid;
+        entry.size = size;
+        entry.mtime_ns = mtime;
+        entry.ctime_ns = ctime_val;
+        entry.hash = hash;
+        entry.xattr_hash = xattr_hash;
+        manifest[line.substr(tab + 1)] = entry;
+    }
+    return true;
+}
 
-        std::string src_content((std::istreambuf_iterator<char>(src_file)),
-                                std::istreambuf_iterator<char>());
-        std::string dst_content((std::istreambuf_iterator<char>(dst_file)),
-                                std::istreambuf_iterator<char>());
+static bool save_manifest(const fs::path& dst, const Manifest& manifest) {
+    fs::path final_path = dst / MANIFEST_NAME;
+    fs::path tmp_path = dst / (std::string(MANIFEST_NAME) + ".tmp");
 
-        return src_content != dst_content;
-    } catch (...) {
-        return true;
+    FILE* file = fopen(tmp_path.c_str(), "we");
+    if (!file) {
+        return false;
+    }
+    fprintf(file, "%s\n", MANIFEST_HEADER);
+    for (const auto& [rel, entry] : manifest) {
+        fprintf(file, "%c %o %u %u %llu %lld %lld %llx %llx\t%s\n", entry.type, entry.mode,
+                entry.uid, entry.gid, static_cast<unsigned long long>(entry.size),
+                static_cast<long long>(entry.mtime_ns), static_cast<long long>(entry.ctime_ns),
+                static_cast<unsigned long long>(entry.hash),
+                static_cast<unsigned long long>(entry.xattr_hash), rel.c_str());
+    }
+    bool ok = fflush(file) == 0 && fsync(fileno(file)) == 0;
+    ok = (fclose(file) == 0) && ok;
+
+    if (!ok || rename(tmp_path.c_str(), final_path.c_str()) != 0) {
+        unlink(tmp_path.c_str());
+        return false;
+    }
+    return true;
+}
+
+// FNV-1a over file contents; 0 on read failure
+static uint64_t hash_file(const fs::path& path) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return 0;
+    }
+
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    std::vector<unsigned char> buf(128 * 1024);
+    ssize_t n;
+    while ((n = read(fd, buf.data(), buf.size())) > 0) {
+        for (ssize_t i = 0; i < n; ++i) {
+            hash ^= buf[i];
+            hash *= 0x100000001b3ULL;
+        }
+    }
+    close(fd);
+    return n < 0 ? 0 : (hash ? hash : 1);
+}
+
+static bool same_bytes(const fs::path& a, const fs::path& b) {
+    int fd_a = open(a.c_str(), O_RDONLY | O_CLOEXEC);
+    int fd_b = open(b.c_str(), O_RDONLY | O_CLOEXEC);
+    bool same = fd_a >= 0 && fd_b >= 0;
+
+    std::vector<char> buf_a(64 * 1024), buf_b(64 * 1024);
+    while (same) {
+        ssize_t n = read(fd_a, buf_a.data(), buf_a.size());
+        if (n <= 0) {
+            same = n == 0 && read(fd_b, buf_b.data(), 1) == 0;
+            break;
+        }
+        ssize_t got = 0;
+        while (got < n) {
+            ssize_t m = read(fd_b, buf_b.data() + got, static_cast<size_t>(n - got));
+            if (m <= 0) {
+                break;
+            }
+            got += m;
+        }
+        same = got == n && memcmp(buf_a.data(), buf_b.data(), static_cast<size_t>(n)) == 0;
+    }
+
+    if (fd_a >= 0)
+        close(fd_a);
+    if (fd_b >= 0)
+        close(fd_b);
+    return same;
+}
+
+// Decide whether a source file that matches `old` in size but not in timestamps still has
+// the same content as its copy, filling in digests along the way. A digest match is only
+// a hint; the bytes are compared before a copy is skipped.
+static bool same_content(const fs::path& src, const fs::path& dst, const ManifestEntry& old,
+                         ManifestEntry& current) {
+    current.hash = hash_file(src);
+    if (current.hash == 0) {
+        return false;
+    }
+    uint64_t stored = old.hash ? old.hash : hash_file(dst);
+    return stored == current.hash && same_bytes(src, dst);
+}
+
+// Names of the xattrs sync carries over, sorted; the SELinux label is repaired separately
+static std::vector<std::string> copied_xattr_names(const fs::path& path) {
+    std::vector<std::string> names;
+    ssize_t len = llistxattr(path.c_str(), nullptr, 0);
+    if (len <= 0) {
+        return names;
+    }
+    std::string list(static_cast<size_t>(len), '\0');
+    len = llistxattr(path.c_str(), &list[0], list.size());
+    for (ssize_t off = 0; off < len;) {
+        std::string name(list.c_str() + off);
+        off += static_cast<ssize_t>(name.size()) + 1;
+        if (name != SELINUX_XATTR) {
+            names.push_back(std::move(name));
+        }
+    }
+    std::sort(names.begin(), names.end());
+    return names;
+}
+
+static bool read_xattr(const fs::path& path, const std::string& name, std::string& value) {
+    ssize_t len = lgetxattr(path.c_str(), name.c_str(), nullptr, 0);
+    if (len < 0) {
+        return false;
+    }
+    value.assign(static_cast<size_t>(len), '\0');
+    len = lgetxattr(path.c_str(), name.c_str(), &value[0], value.size());
+    if (len < 0) {
+        return false;
+    }
+    value.resize(static_cast<size_t>(len));
+    return true;
+}
+
+// FNV-1a over the carried xattrs, names and values; 0 when there are none
+static uint64_t hash_xattrs(const fs::path& path) {
+    std::vector<std::string> names = copied_xattr_names(path);
+    if (names.empty()) {
+        return 0;
+    }
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    auto mix = [&hash](const std::string& bytes) {
+        for (unsigned char c : bytes) {
+            hash ^= c;
+            hash *= 0x100000001b3ULL;
+        }
+        hash *= 0x100000001b3ULL;  // NUL separator
+    };
+    std::string value;
+    for (const auto& name : names) {
+        if (read_xattr(path, name, value)) {
+            mix(name);
+            mix(value);
+        }
+    }
+    return hash ? hash : 1;
+}
+
+// Give dst the owner, mode and (with `xattrs`) carried xattrs of src without rewriting
+// its data
+static void refresh_metadata(const fs::path& src, const fs::path& dst, const struct stat& src_st,
+                             bool xattrs) {
+    if (lchown(dst.c_str(), src_st.st_uid, src_st.st_gid) != 0) {
+        LOG_VERBOSE("sync: lchown failed for " + dst.string());
+    }
+    // After lchown, which clears set-id bits
+    if (!S_ISLNK(src_st.st_mode)) {
+        chmod(dst.c_str(), src_st.st_mode & 07777);
+    }
+    if (!xattrs) {
+        return;
+    }
+    for (const auto& name : copied_xattr_names(dst)) {
+        lremovexattr(dst.c_str(), name.c_str());
+    }
+    std::string value;
+    for (const auto& name : copied_xattr_names(src)) {
+        if (read_xattr(src, name, value) &&
+            lsetxattr(dst.c_str(), name.c_str(), value.data(), value.size(), 0) != 0) {
+            LOG_VERBOSE("sync: xattr " + name + " not copied to " + dst.string() + ": " +
+                        strerror(errno));
+        }
+    }
+}
+
+// Content-addressed store shared by every module in one storage root. Identical files
+// become hardlinks to a single object, keyed by content plus everything that would make
+// the copies differ afterwards: mode, owner, xattrs and the path that decides their SELinux
+// label.
+static constexpr const char* DEDUP_STORE_NAME = ".hymo_cas";
+
+static std::string dedup_object_name(uint64_t content_hash, const struct stat& st,
+                                     uint64_t xattr_hash, const std::string& rel) {
+    // Files present on the live system take their own label during context repair;
+    // the rest inherit from their directory
+    std::string label_path = rel;
+    if (access(("/" + rel).c_str(), F_OK) != 0) {
+        size_t slash = rel.rfind('/');
+        label_path = slash == std::string::npos ? std::string() : rel.substr(0, slash);
+    }
+
+    uint64_t meta = 0xcbf29ce484222325ULL;
+    auto mix = [&meta](const void* data, size_t len) {
+        const auto* bytes = static_cast<const unsigned char*>(data);
+        for (size_t i = 0; i < len; ++i) {
+            meta ^= bytes[i];
+            meta *= 0x100000001b3ULL;
+        }
+    };
+    mode_t mode = st.st_mode & 07777;
+    mix(&mode, sizeof(mode));
+    mix(&st.st_uid, sizeof(st.st_uid));
+    mix(&st.st_gid, sizeof(st.st_gid));
+    mix(&xattr_hash, sizeof(xattr_hash));
+    mix(label_path.data(), label_path.size());
+
+    char name[64];
+    snprintf(name, sizeof(name), "%016llx-%llx-%016llx",
+             static_cast<unsigned long long>(content_hash),
+             static_cast<unsigned long long>(st.st_size), static_cast<unsigned long long>(meta));
+    return name;
+}
+
+// Place src at dst through the store. Returns false only if dst could not be produced;
+// `linked` reports whether an existing object was reused.
+static bool dedup_copy(const fs::path& src, const fs::path& dst, const std::string& rel,
+                       const fs::path& store, bool& linked) {
+    linked = false;
+
+    struct stat st;
+    uint64_t content_hash = 0;
+    if (lstat(src.c_str(), &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0 ||
+        (content_hash = hash_file(src)) == 0) {
+        return copy_node(src, dst);
+    }
+
+    fs::path object = store / dedup_object_name(content_hash, st, hash_xattrs(src), rel);
+
+    struct stat obj_st;
+    if (lstat(object.c_str(), &obj_st) == 0 && S_ISREG(obj_st.st_mode) &&
+        obj_st.st_size == st.st_size && same_bytes(src, object)) {
+        unlink(dst.c_str());
+        if (link(object.c_str(), dst.c_str()) == 0) {
+            linked = true;
+            return true;
+        }
+    }
+
+    if (!copy_node(src, dst)) {
+        return false;
+    }
+    // Publish as a new object; losing a race to an identical copy is harmless
+    link(dst.c_str(), object.c_str());
+    return true;
+}
+
+// Drop objects no module links to any more
+static void collect_dedup_garbage(const fs::path& store) {
+    walk_tree(store, [](const WalkEntry& e) {
+        struct stat st;
+        if (fstatat(e.parent_fd, e.name, &st, AT_SYMLINK_NOFOLLOW) == 0 && S_ISREG(st.st_mode) &&
+            st.st_nlink == 1) {
+            unlinkat(e.parent_fd, e.name, 0);
+        }
+        return false;
+    });
+}
+
+uint64_t dedup_saved_bytes(const fs::path& storage_root) {
+    uint64_t saved = 0;
+    walk_tree(storage_root / DEDUP_STORE_NAME, [&saved](const WalkEntry& e) {
+        struct stat st;
+        // One link is the store's own, one is the copy that would exist anyway
+        if (fstatat(e.parent_fd, e.name, &st, AT_SYMLINK_NOFOLLOW) == 0 && S_ISREG(st.st_mode) &&
+            st.st_nlink > 2) {
+            saved += static_cast<uint64_t>(st.st_size) * (st.st_nlink - 2);
+        }
+        return false;
+    });
+    return saved;
+}
+
+static void remove_stale(const fs::path& path) {
+    std::error_code ec;
+    fs::remove_all(path, ec);
+    if (ec) {
+        LOG_WARN("Failed to remove stale " + path.string() + ": " + ec.message());
+    }
+}
+
+// Bounded pool for file copies. submit() blocks while the bytes queued or in flight
+// exceed the budget, so a large module cannot pile up unbounded dirty data. With no
+// workers, tasks run inline on the submitting thread.
+class CopyPool {
+public:
+    CopyPool(size_t workers, uint64_t max_inflight_bytes) : max_bytes_(max_inflight_bytes) {
+        for (size_t i = 0; i < workers; ++i) {
+            try {
+                threads_.emplace_back(&CopyPool::worker_loop, this);
+            } catch (const std::system_error& e) {
+                LOG_WARN("Failed to spawn sync worker: " + std::string(e.what()));
+                break;
+            }
+        }
+    }
+
+    ~CopyPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+        }
+        work_cv_.notify_all();
+        for (auto& thread : threads_) {
+            thread.join();
+        }
+    }
+
+    size_t workers() const { return threads_.size(); }
+
+    void submit(uint64_t size, std::function<void()> task) {
+        if (threads_.empty()) {
+            task();
+            return;
+        }
+
+        std::unique_lock<std::mutex> lock(mutex_);
+        space_cv_.wait(lock, [&] { return inflight_ == 0 || inflight_ + size <= max_bytes_; });
+        inflight_ += size;
+        pending_++;
+        queue_.push_back(Job{size, std::move(task)});
+        lock.unlock();
+        work_cv_.notify_one();
+    }
+
+    void wait() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        idle_cv_.wait(lock, [&] { return pending_ == 0; });
+    }
+
+private:
+    struct Job {
+        uint64_t size;
+        std::function<void()> task;
+    };
+
+    void worker_loop() {
+        while (true) {
+            std::unique_lock<std::mutex> lock(mutex_);
+            work_cv_.wait(lock, [&] { return stopping_ || !queue_.empty(); });
+            if (queue_.empty()) {
+                return;
+            }
+            Job job = std::move(queue_.front());
+            queue_.pop_front();
+            lock.unlock();
+
+            job.task();
+
+            lock.lock();
+            inflight_ -= job.size;
+            pending_--;
+            bool idle = pending_ == 0;
+            lock.unlock();
+            space_cv_.notify_all();
+            if (idle) {
+                idle_cv_.notify_all();
+            }
+        }
+    }
+
+    uint64_t max_bytes_;
+    uint64_t inflight_ = 0;
+    size_t pending_ = 0;
+    bool stopping_ = false;
+    std::deque<Job> queue_;
+    std::vector<std::thread> threads_;
+    std::mutex mutex_;
+    std::condition_variable work_cv_;
+    std::condition_variable space_cv_;
+    std::condition_variable idle_cv_;
+};
+
+// One module's sync: the walk runs on the caller's thread and queues changed files on
+// the pool; finish_module_sync() applies deletions and the manifest once copies drain.
+struct ModuleSyncJob {
+    fs::path src;
+    fs::path dst;
+    fs::path dedup_store;  // Empty when dedup is off
+    Manifest old_manifest;
+    Manifest new_manifest;
+    bool have_manifest = false;
+    bool manifest_dirty = false;   // new_manifest differs from what is on disk
+    bool manifest_removed = false;  // on-disk manifest dropped before touching the tree
+    std::mutex mutex;  // Guards stats and ok against pool callbacks
+    SyncStats stats;
+    bool ok = true;
+};
+
+// Storage is about to change: a crash from here on must not leave a manifest claiming
+// the old tree is current
+static void invalidate_manifest(ModuleSyncJob& job) {
+    job.manifest_dirty = true;
+    if (job.have_manifest && !job.manifest_removed) {
+        unlink((job.dst / MANIFEST_NAME).c_str());
+        job.manifest_removed = true;
     }
 }
 
+static void start_module_sync(ModuleSyncJob& job, CopyPool& pool) {
+    const fs::path& src = job.src;
+    const fs::path& dst = job.dst;
+
+    job.have_manifest = fs::exists(dst) && load_manifest(dst, job.old_manifest);
+    if (!job.have_manifest && fs::exists(dst)) {
+        // Unknown contents: start clean rather than trusting what is there
+        LOG_DEBUG("No manifest for " + dst.string() + ", resyncing from scratch");
+        remove_stale(dst);
+    }
+
+    if (!ensure_dir_exists(dst)) {
+        LOG_ERROR("sync: failed to create " + dst.string());
+        job.ok = false;
+        return;
+    }
+
+    job.new_manifest.reserve(job.old_manifest.size());
+    job.manifest_dirty = !job.have_manifest;
+
+    auto fail = [&job] {
+        std::lock_guard<std::mutex> lock(job.mutex);
+        job.ok = false;
+    };
+
+    bool walked = walk_tree(src, [&](const WalkEntry& e) {
+        if (e.rel == MANIFEST_NAME) {
+            return false;
+        }
+
+        struct stat src_st;
+        if (fstatat(e.parent_fd, e.name, &src_st, AT_SYMLINK_NOFOLLOW) != 0) {
+            return false;
+        }
+        if (!S_ISDIR(src_st.st_mode) && !S_ISREG(src_st.st_mode) && !S_ISLNK(src_st.st_mode)) {
+            return false;
+        }
+
+        ManifestEntry current = entry_from_stat(src_st);
+        fs::path src_path = src / e.rel;
+        fs::path dst_path = dst / e.rel;
+
+        auto old_it = job.old_manifest.find(e.rel);
+        const ManifestEntry* old =
+            old_it != job.old_manifest.end() ? &old_it->second : nullptr;
+
+        struct stat dst_st;
+        bool dst_exists = lstat(dst_path.c_str(), &dst_st) == 0;
+        bool type_matches = dst_exists && ((dst_st.st_mode & S_IFMT) == (src_st.st_mode & S_IFMT));
+        if (dst_exists && !type_matches) {
+            invalidate_manifest(job);
+            remove_stale(dst_path);
+            dst_exists = false;
+        }
+
+        // Owner, mode and xattr changes all move ctime, so the xattrs are only read again
+        // when it differs from the manifest
+        bool stat_match = old && old->type == current.type &&
+                          old->mtime_ns == current.mtime_ns && old->ctime_ns == current.ctime_ns;
+        current.xattr_hash = stat_match ? old->xattr_hash : hash_xattrs(src_path);
+
+        if (current.type == 'D') {
+            if (!dst_exists) {
+                invalidate_manifest(job);
+                if (mkdir(dst_path.c_str(), current.mode) != 0 && errno != EEXIST) {
+                    LOG_ERROR("sync: mkdir failed for " + dst_path.string() + ": " +
+                              strerror(errno));
+                    fail();
+                    return false;
+                }
+                refresh_metadata(src_path, dst_path, src_st, current.xattr_hash != 0);
+                lsetfilecon(dst_path, get_context_for_path(dst_path));
+                std::lock_guard<std::mutex> lock(job.mutex);
+                job.stats.copied++;
+            } else if ((dst_st.st_mode & 07777) != current.mode || dst_st.st_uid != current.uid ||
+                       dst_st.st_gid != current.gid || !old ||
+                       old->xattr_hash != current.xattr_hash) {
+                invalidate_manifest(job);
+                refresh_metadata(src_path, dst_path, src_st,
+                                 !old || old->xattr_hash != current.xattr_hash);
+            }
+            job.new_manifest[e.rel] = current;
+            return true;
+        }
+
+        bool unchanged = false;
+        if (old && dst_exists && old->type == current.type && old->size == current.size &&
+            static_cast<uint64_t>(dst_st.st_size) == current.size) {
+            bool same_data = false;
+            if (stat_match) {
+                current.hash = old->hash;
+                same_data = true;
+            } else if (current.type == 'F' && same_content(src_path, dst_path, *old, current)) {
+                // Touched but identical (e.g. module reinstalled from the same zip)
+                same_data = true;
+                job.manifest_dirty = true;
+            }
+
+            bool same_meta = old->mode == current.mode && old->uid == current.uid &&
+                             old->gid == current.gid && old->xattr_hash == current.xattr_hash;
+            if (same_data && same_meta) {
+                unchanged = true;
+            } else if (same_data && dst_st.st_nlink <= 1) {
+                // Only attributes changed: fix them on the copy instead of rewriting it. A copy
+                // hardlinked elsewhere (dedup, now or from an earlier sync) would change every
+                // module sharing the inode, so it is copied anew.
+                invalidate_manifest(job);
+                refresh_metadata(src_path, dst_path, src_st,
+                                 old->xattr_hash != current.xattr_hash);
+                unchanged = true;
+            }
+        }
+
+        job.new_manifest[e.rel] = current;
+
+        if (unchanged) {
+            std::lock_guard<std::mutex> lock(job.mutex);
+            job.stats.unchanged++;
+            return false;
+        }
+
+        invalidate_manifest(job);
+        uint64_t bytes = current.type == 'F' ? current.size : 0;
+        std::string rel = e.rel;
+        pool.submit(bytes, [&job, src_path, dst_path, rel, bytes] {
+            bool linked = false;
+            bool copied = job.dedup_store.empty()
+                              ? copy_node(src_path, dst_path)
+                              : dedup_copy(src_path, dst_path, rel, job.dedup_store, linked);
+            std::lock_guard<std::mutex> lock(job.mutex);
+            if (!copied) {
+                job.ok = false;
+            } else if (linked) {
+                job.stats.copied++;
+                job.stats.bytes_linked += bytes;
+            } else {
+                job.stats.copied++;
+                job.stats.bytes_copied += bytes;
+            }
+        });
+        return false;
+    });
+
+    if (!walked) {
+        // An incomplete listing would turn unvisited entries into deletions
+        LOG_WARN("sync: incomplete walk of " + src.string());
+        invalidate_manifest(job);
+        fail();
+    }
+}
+
+static bool finish_module_sync(ModuleSyncJob& job) {
+    const fs::path& dst = job.dst;
+
+    // Without a manifest the next sync starts from scratch, so nothing more to do here
+    if (!job.ok) {
+        invalidate_manifest(job);
+        return false;
+    }
+
+    // Delete what the source no longer has. Parents sort before children, so walking
+    // backwards removes the deepest entries first.
+    std::vector<std::string> removed;
+    for (const auto& [rel, entry] : job.old_manifest) {
+        if (job.new_manifest.find(rel) == job.new_manifest.end()) {
+            removed.push_back(rel);
+        }
+    }
+    std::sort(removed.begin(), removed.end());
+    if (!removed.empty()) {
+        invalidate_manifest(job);
+    }
+    for (auto it = removed.rbegin(); it != removed.rend(); ++it) {
+        remove_stale(dst / *it);
+        job.stats.removed++;
+    }
+
+    if (job.manifest_dirty && !save_manifest(dst, job.new_manifest)) {
+        LOG_WARN("sync: failed to write manifest for " + dst.string());
+    }
+    return true;
+}
+
+static size_t sync_worker_count(const Config& config) {
+    if (config.sync_jobs > 0) {
+        return static_cast<size_t>(config.sync_jobs);
+    }
+    // Flash storage sustains a handful of parallel streams; more only adds contention
+    size_t cores = std::thread::hardware_concurrency();
+    return std::max<size_t>(1, std::min<size_t>(cores, 4));
+}
+
+bool sync_modules(const std::vector<Module>& modules, const fs::path& storage_root,
+                  const Config& config, std::vector<std::string>* changed_ids) {
+    TRACE_SCOPE("sync");
+    size_t workers = sync_worker_count(config);
+    // A single stream gains nothing from a handoff thread
+    CopyPool pool(workers > 1 ? workers : 0, SYNC_INFLIGHT_BYTES);
+    LOG_DEBUG("Syncing " + std::to_string(modules.size()) + " modules with " +
+              std::to_string(std::max<size_t>(pool.workers(), 1)) + " copy streams");
+
+    fs::path store = storage_root / DEDUP_STORE_NAME;
+    if (config.dedup) {
+        if (!ensure_dir_exists(store)) {
+            store.clear();
+        }
+    } else {
+        // Module copies keep their data; only the shared names go away
+        if (fs::exists(store)) {
+            remove_stale(store);
+        }
+        store.clear();
+    }
+
+    std::vector<std::unique_ptr<ModuleSyncJob>> jobs;
+    jobs.reserve(modules.size());
+    for (const auto& module : modules) {
+        TRACE_SCOPE("sync_module", "module", module.id);
+        auto job = std::make_unique<ModuleSyncJob>();
+        job->src = module.source_path;
+        job->dst = storage_root / module.id;
+        job->dedup_store = store;
+        start_module_sync(*job, pool);
+        jobs.push_back(std::move(job));
+    }
+    {
+        TRACE_SCOPE("sync_copy_wait", "step");
+        pool.wait();
+    }
+
+    bool all_ok = true;
+    uint64_t linked_bytes = 0;
+    for (size_t i = 0; i < jobs.size(); ++i) {
+        auto& job = *jobs[i];
+        const std::string& id = modules[i].id;
+        if (!finish_module_sync(job)) {
+            LOG_ERROR("Failed to sync: " + id);
+            all_ok = false;
+            continue;
+        }
+        linked_bytes += job.stats.bytes_linked;
+        if (job.stats.changed()) {
+            LOG_DEBUG("Synced " + id + ": " + std::to_string(job.stats.copied) + " copied (" +
+                      std::to_string(job.stats.bytes_copied) + " bytes), " +
+                      std::to_string(job.stats.removed) + " removed, " +
+                      std::to_string(job.stats.unchanged) + " unchanged");
+            if (changed_ids) {
+                changed_ids->push_back(id);
+            }
+        } else {
+            LOG_DEBUG("Up-to-date: " + id);
+        }
+    }
+
+    if (!store.empty()) {
+        collect_dedup_garbage(store);
+        if (linked_bytes > 0) {
+            LOG_INFO("Dedup store reused " + std::to_string(linked_bytes) + " bytes this sync");
+        }
+    }
+    return all_ok;
+}
+
 // Remove orphaned module directories
-static void prune_orphaned_modules(const std::vector<Module>& modules,
+void prune_orphaned_modules(const std::vector<Module>& modules,
                                    const fs::path& storage_root) {
     if (!fs::exists(storage_root)) {
         return;
@@ -63,7 +803,7 @@ static void prune_orphaned_modules(const std::vector<Module>& modules,
         for (const auto& entry : fs::directory_iterator(storage_root)) {
             std::string name = entry.path().filename().string();
 
-            if (name == "lost+found" || name == "hymo") {
+            if (name == "lost+found" || name == "hymo" || name == DEDUP_STORE_NAME) {
                 continue;
             }
 
@@ -81,57 +821,118 @@ static void prune_orphaned_modules(const std::vector<Module>& modules,
     }
 }
 
-// Map SELinux context from system if possible
-static void recursive_context_repair(const fs::path& base, const fs::path& current) {
-    if (!fs::exists(current)) {
-        return;
-    }
+// Labels are resolved like the counterpart on the live system; entries the system lacks
+// take the label of their directory. Resolved directory labels are memoized, and once a
+// directory is known to be absent from the system its whole subtree is labelled without
+// further lookups.
+ModuleContextResolver::ModuleContextResolver(std::vector<std::string> partitions)
+    : partitions_(std::move(partitions)) {}
 
-    try {
-        std::string file_name = current.filename().string();
+bool ModuleContextResolver::system_context(const std::string& virtual_path,
+                                           std::string& context) {
+    if (!try_lgetfilecon(virtual_path, context)) {
+        return false;
+    }
+    // Fix rootfs context
+    if (context.find("u:object_r:rootfs:s0") != std::string::npos) {
+        context = get_context_for_path(virtual_path);
+    }
+    return true;
+}
 
-        // Use parent context for internal overlay structs
-        if (file_name == "upperdir" || file_name == "workdir") {
-            if (current.has_parent_path()) {
-                fs::path parent = current.parent_path();
-                try {
-                    std::string parent_ctx = lgetfilecon(parent);
-                    lsetfilecon(current, parent_ctx);
-                } catch (...) {
-                }
+std::string ModuleContextResolver::resolve(const std::string& rel, bool is_dir) {
+    size_t slash = rel.rfind('/');
+    DirContext resolved;
+    if (slash == std::string::npos) {
+        // A partition root, or a module file such as module.prop that is never mounted
+        if (std::find(partitions_.begin(), partitions_.end(), rel) == partitions_.end()) {
+            return "";
+        }
+        resolved.on_system = system_context("/" + rel, resolved.context);
+        if (!resolved.on_system) {
+            std::string parent_context;
+            resolved.context = system_context("/", parent_context)
+                                   ? parent_context
+                                   : get_context_for_path("/" + rel);
+        }
+    } else {
+        auto parent_it = dirs_.find(rel.substr(0, slash));
+        if (parent_it == dirs_.end()) {
+            return "";
+        }
+        const DirContext& parent = parent_it->second;
+        resolved = DirContext{parent.context, false};
+        // Internal overlay structures keep their directory's label
+        std::string name = rel.substr(slash + 1);
+        bool overlay_internal = name == "upperdir" || name == "workdir";
+        if (!overlay_internal && parent.on_system) {
+            std::string context;
+            if (system_context("/" + rel, context)) {
+                resolved = DirContext{context, true};
             }
-        } else {
-            fs::path relative = fs::relative(current, base);
-            fs::path system_path = fs::path("/") / relative;
+        }
+    }
 
-            if (fs::exists(system_path)) {
-                copy_path_context(system_path, current);
-            }
+    std::string context = resolved.context;
+    if (is_dir) {
+        dirs_.emplace(rel, std::move(resolved));
+    }
+    return context;
+}
+
+// Write the resolved label onto every entry of a module partition, only where it differs
+static void repair_partition_contexts(const fs::path& module_root, const std::string& partition,
+                                      size_t& relabelled) {
+    ModuleContextResolver resolver({partition});
+    auto apply = [&relabelled](const fs::path& dst, const std::string& context) {
+        std::string current;
+        if (try_lgetfilecon(dst, current) && current == context) {
+            return;
         }
+        if (lsetfilecon(dst, context)) {
+            relabelled++;
+        }
+    };
 
-        if (fs::is_directory(current)) {
-            for (const auto& entry : fs::directory_iterator(current)) {
-                recursive_context_repair(base, entry.path());
-            }
+    fs::path part_root = module_root / partition;
+    apply(part_root, resolver.resolve(partition, true));
+    walk_tree(part_root, [&](const WalkEntry& e) {
+        std::string context = resolver.resolve(partition + "/" + e.rel, e.type == DT_DIR);
+        if (context.empty()) {
+            return false;
         }
-    } catch (const std::exception& e) {
-        LOG_DEBUG("Context repair failed: " + current.string());
-    }
+        apply(part_root / e.rel, context);
+        return e.type == DT_DIR;
+    });
 }
 
 static void repair_module_contexts(const fs::path& module_root, const std::string& module_id,
                                    const std::vector<std::string>& all_partitions) {
     LOG_DEBUG("Repairing SELinux contexts for: " + module_id);
 
+    size_t relabelled = 0;
     for (const auto& partition : all_partitions) {
-        fs::path part_root = module_root / partition;
+        struct stat st;
+        if (lstat((module_root / partition).c_str(), &st) == 0 && S_ISDIR(st.st_mode)) {
+            repair_partition_contexts(module_root, partition, relabelled);
+        }
+    }
 
-        if (fs::exists(part_root) && fs::is_directory(part_root)) {
-            try {
-                recursive_context_repair(module_root, part_root);
-            } catch (const std::exception& e) {
-                LOG_WARN("Context repair failed for " + module_id + "/" + partition);
-            }
+    if (relabelled > 0) {
+        LOG_DEBUG("Relabelled " + std::to_string(relabelled) + " entries in " + module_id);
+    }
+}
+
+void repair_contexts_in_place(const std::vector<Module>& modules, const Config& config) {
+    TRACE_SCOPE("repair_contexts");
+    std::vector<std::string> all_partitions = BUILTIN_PARTITIONS;
+    for (const auto& part : config.partitions) {
+        all_partitions.push_back(part);
+    }
+
+    for (const auto& module : modules) {
+        if (has_content(module.source_path, all_partitions)) {
+            repair_module_contexts(module.source_path, module.id, all_partitions);
         }
     }
 }
@@ -147,33 +948,21 @@ void perform_sync(const std::vector<Module>& modules, const fs::path& storage_ro
 
     prune_orphaned_modules(modules, storage_root);
 
+    std::vector<Module> to_sync;
     for (const auto& module : modules) {
-        fs::path dst = storage_root / module.id;
-
         if (!has_content(module.source_path, all_partitions)) {
             LOG_DEBUG("Skipping empty module: " + module.id);
             continue;
         }
+        to_sync.push_back(module);
+    }
 
-        if (should_sync(module.source_path, dst)) {
-            LOG_DEBUG("Syncing: " + module.id);
-
-            if (fs::exists(dst)) {
-                try {
-                    fs::remove_all(dst);
-                } catch (const std::exception& e) {
-                    LOG_WARN("Failed to clean " + module.id);
-                }
-            }
+    std::vector<std::string> changed_ids;
+    sync_modules(to_sync, storage_root, config, &changed_ids);
 
-            if (!sync_dir(module.source_path, dst)) {
-                LOG_ERROR("Failed to sync: " + module.id);
-            } else {
-                repair_module_contexts(dst, module.id, all_partitions);
-            }
-        } else {
-            LOG_DEBUG("Up-to-date: " + module.id);
-        }
+    TRACE_SCOPE("repair_contexts");
+    for (const auto& id : changed_ids) {
+        repair_module_contexts(storage_root / id, id, all_partitions);
     }
 
     LOG_INFO("Sync completed.");
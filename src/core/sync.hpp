@@ -3,12 +3,57 @@
 
 #include "../conf/config.hpp"
 #include "inventory.hpp"
+#include <cstdint>
 #include <filesystem>
+#include <string>
+#include <unordered_map>
+#include <vector>
 
 namespace fs = std::filesystem;
 
 namespace hymo {
 
+// Remove storage directories of modules that are no longer installed
+void prune_orphaned_modules(const std::vector<Module> &modules,
+                            const fs::path &storage_root);
+
+// Bring storage_root/<id> in line with each module using the manifest kept there: only
+// added or changed entries are copied (on a bounded pool of config.sync_jobs streams)
+// and entries gone from the source are deleted. An unchanged module costs one lstat per
+// entry on each side. Ids whose storage changed are appended to `changed_ids`.
+// Returns false if any module failed.
+bool sync_modules(const std::vector<Module> &modules,
+                  const fs::path &storage_root, const Config &config,
+                  std::vector<std::string> *changed_ids = nullptr);
+
+// Bytes the dedup store under storage_root saves over plain per-module copies
+uint64_t dedup_saved_bytes(const fs::path &storage_root);
+
+// SELinux label a module entry should carry when mounted: that of its counterpart on the
+// live system, else that of its directory. `rel` is relative to the module root
+// ("system/bin/sh") and entries must be resolved parents first, as walk_tree visits them.
+// Returns "" for entries outside `partitions`, whose labels do not matter.
+class ModuleContextResolver {
+public:
+  explicit ModuleContextResolver(std::vector<std::string> partitions);
+  std::string resolve(const std::string &rel, bool is_dir);
+
+private:
+  struct DirContext {
+    std::string context;
+    bool on_system = false; // The matching system directory exists
+  };
+  static bool system_context(const std::string &virtual_path,
+                             std::string &context);
+
+  std::vector<std::string> partitions_;
+  std::unordered_map<std::string, DirContext> dirs_;
+};
+
+// Direct storage mode: nothing is copied, module files are labelled in place instead
+void repair_contexts_in_place(const std::vector<Module> &modules,
+                              const Config &config);
+
 void perform_sync(const std::vector<Module> &modules,
                   const fs::path &storage_root, const Config &config);
 
@@ -0,0 +1,227 @@
+// core/trace.cpp - Scoped span tracer implementation
+#include "trace.hpp"
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <vector>
+#include "../defs.hpp"
+#include "../utils.hpp"
+#include "json.hpp"
+
+namespace hymo {
+
+namespace {
+
+struct TraceEvent {
+    const char* name;
+    const char* category;
+    std::string detail;
+    int64_t start_us;
+    int64_t dur_us;
+};
+
+// Spans are appended to a buffer owned by the recording thread, so recording takes no lock.
+// Buffers outlive their threads and are only read by trace_save().
+struct ThreadTrace {
+    pid_t tid = 0;
+    std::vector<TraceEvent> events;
+};
+
+// Bounds memory if a loop is instrumented more finely than intended
+constexpr size_t MAX_EVENTS_PER_THREAD = 16384;
+
+std::atomic<bool> g_enabled{false};
+int64_t g_origin_us = 0;
+std::mutex g_threads_mutex;
+std::vector<std::unique_ptr<ThreadTrace>> g_threads;
+
+}  // namespace
+
+static int64_t monotonic_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<int64_t>(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+}
+
+static ThreadTrace* thread_trace() {
+    thread_local ThreadTrace* trace = nullptr;
+    if (!trace) {
+        auto owned = std::make_unique<ThreadTrace>();
+        owned->tid = static_cast<pid_t>(syscall(SYS_gettid));
+        owned->events.reserve(64);
+        trace = owned.get();
+        std::lock_guard<std::mutex> lock(g_threads_mutex);
+        g_threads.push_back(std::move(owned));
+    }
+    return trace;
+}
+
+void trace_enable() {
+    g_origin_us = monotonic_us();
+    g_enabled.store(true, std::memory_order_release);
+}
+
+TraceSpan::TraceSpan(const char* name, const char* category)
+    : name_(name),
+      category_(category),
+      start_us_(g_enabled.load(std::memory_order_acquire) ? monotonic_us() : -1) {}
+
+TraceSpan::TraceSpan(const char* name, const char* category, std::string detail)
+    : name_(name),
+      category_(category),
+      detail_(std::move(detail)),
+      start_us_(g_enabled.load(std::memory_order_acquire) ? monotonic_us() : -1) {}
+
+void TraceSpan::end() {
+    if (start_us_ < 0) {
+        return;
+    }
+    int64_t end_us = monotonic_us();
+    ThreadTrace* trace = thread_trace();
+    if (trace->events.size() < MAX_EVENTS_PER_THREAD) {
+        trace->events.push_back(
+            {name_, category_, std::move(detail_), start_us_ - g_origin_us, end_us - start_us_});
+    }
+    start_us_ = -1;
+}
+
+bool trace_save() {
+    g_enabled.store(false, std::memory_order_release);
+
+    std::string out;
+    json::Writer w(out);
+    w.begin_object().field("displayTimeUnit", "ms").key("traceEvents").begin_array();
+    pid_t pid = getpid();
+    size_t count = 0;
+
+    std::lock_guard<std::mutex> lock(g_threads_mutex);
+    for (const auto& thread : g_threads) {
+        for (const auto& e : thread->events) {
+            w.begin_object()
+                .field("name", e.name)
+                .field("cat", e.category)
+                .field("ph", "X")
+                .field("ts", e.start_us)
+                .field("dur", e.dur_us)
+                .field("pid", pid)
+                .field("tid", thread->tid);
+            if (!e.detail.empty()) {
+                w.key("args").begin_object().field("detail", e.detail).end_object();
+            }
+            w.end_object();
+            ++count;
+        }
+    }
+    // Name the main thread so viewers don't show the camouflaged process name
+    w.begin_object()
+        .field("name", "thread_name")
+        .field("ph", "M")
+        .field("pid", pid)
+        .field("tid", pid)
+        .key("args")
+        .begin_object()
+        .field("name", "hymod")
+        .end_object()
+        .end_object();
+    w.end_array().end_object();
+    out += '\n';
+
+    ensure_dir_exists(RUN_DIR);
+    std::string tmp_path = std::string(TRACE_FILE) + ".tmp";
+    {
+        std::ofstream file(tmp_path, std::ios::trunc);
+        if (!file.is_open() || !(file << out)) {
+            LOG_WARN("Failed to write trace to " + tmp_path);
+            return false;
+        }
+    }
+    if (rename(tmp_path.c_str(), TRACE_FILE) != 0) {
+        LOG_WARN("Failed to publish trace: " + std::string(strerror(errno)));
+        unlink(tmp_path.c_str());
+        return false;
+    }
+    LOG_DEBUG("Saved " + std::to_string(count) + " trace spans to " + TRACE_FILE);
+    return true;
+}
+
+std::string export_trace_summary_json() {
+    json::Value root = json::Value::object();
+    root["file"] = json::Value(TRACE_FILE);
+
+    std::ifstream file(TRACE_FILE);
+    if (!file.is_open()) {
+        root["available"] = json::Value(false);
+        return json::dump(root);
+    }
+    std::stringstream buffer;
+    buffer << file.rdbuf();
+
+    struct Total {
+        std::string category;
+        double count = 0;
+        double total_us = 0;
+        double max_us = 0;
+    };
+    std::map<std::string, Total> totals;
+    double first_us = -1;
+    double last_us = 0;
+
+    try {
+        auto trace = json::parse(buffer.str());
+        const auto& events = trace.as_object().at("traceEvents").as_array();
+        for (const auto& val : events) {
+            const auto& e = val.as_object();
+            if (!e.count("ph") || e.at("ph").as_string() != "X") {
+                continue;
+            }
+            double ts = e.at("ts").as_number();
+            double dur = e.at("dur").as_number();
+            Total& t = totals[e.at("name").as_string()];
+            if (e.count("cat")) {
+                t.category = e.at("cat").as_string();
+            }
+            t.count += 1;
+            t.total_us += dur;
+            t.max_us = std::max(t.max_us, dur);
+            first_us = first_us < 0 ? ts : std::min(first_us, ts);
+            last_us = std::max(last_us, ts + dur);
+        }
+    } catch (...) {
+        root["available"] = json::Value(false);
+        root["error"] = json::Value("Failed to parse trace");
+        return json::dump(root);
+    }
+
+    std::vector<std::pair<std::string, Total>> sorted(totals.begin(), totals.end());
+    std::sort(sorted.begin(), sorted.end(), [](const auto& a, const auto& b) {
+        return a.second.total_us > b.second.total_us;
+    });
+
+    json::Value spans = json::Value::array();
+    for (const auto& [name, t] : sorted) {
+        json::Value s = json::Value::object();
+        s["name"] = json::Value(name);
+        s["category"] = json::Value(t.category);
+        s["count"] = json::Value(t.count);
+        s["total_ms"] = json::Value(t.total_us / 1000.0);
+        s["max_ms"] = json::Value(t.max_us / 1000.0);
+        spans.push_back(s);
+    }
+
+    root["available"] = json::Value(true);
+    root["wall_ms"] = json::Value(first_us < 0 ? 0.0 : (last_us - first_us) / 1000.0);
+    root["spans"] = spans;
+    return json::dump(root);
+}
+
+}  // namespace hymo
@@ -0,0 +1,46 @@
+// core/trace.hpp - Scoped span tracer with Chrome trace-event export
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+namespace hymo {
+
+// Start recording spans in this process. Until then spans cost one atomic load.
+void trace_enable();
+
+// Write every recorded span to TRACE_FILE as Chrome/Perfetto trace-event JSON. Call once
+// threads that recorded spans are done.
+bool trace_save();
+
+// Per-span totals of the last saved trace, for `hymod api trace`
+std::string export_trace_summary_json();
+
+// One timed span on the calling thread, from construction to end() or destruction.
+// `name` and `category` must outlive the trace (string literals); `detail` is copied and
+// shown as the span's argument, e.g. a module id inside a per-module loop.
+class TraceSpan {
+public:
+    explicit TraceSpan(const char* name, const char* category = "phase");
+    TraceSpan(const char* name, const char* category, std::string detail);
+    ~TraceSpan() { end(); }
+
+    TraceSpan(const TraceSpan&) = delete;
+    TraceSpan& operator=(const TraceSpan&) = delete;
+
+    void end();
+
+private:
+    const char* name_;
+    const char* category_;
+    std::string detail_;
+    int64_t start_us_;  // -1 when not recording
+};
+
+#define HYMO_TRACE_CONCAT_(a, b) a##b
+#define HYMO_TRACE_CONCAT(a, b) HYMO_TRACE_CONCAT_(a, b)
+// Span covering the rest of the enclosing scope
+#define TRACE_SCOPE(...) \
+    ::hymo::TraceSpan HYMO_TRACE_CONCAT(hymo_trace_span_, __LINE__)(__VA_ARGS__)
+
+}  // namespace hymo
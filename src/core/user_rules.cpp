@@ -3,9 +3,11 @@
 #include <fstream>
 #include <iostream>
 #include <sstream>
+#include "../defs.hpp"
 #include "../mount/hymofs.hpp"
 #include "../utils.hpp"
 #include "json.hpp"
+#include "snapshot.hpp"
 
 #define USER_HIDE_RULES_FILE "/data/adb/hymo/user_hide_rules.json"
 
@@ -13,6 +15,16 @@ namespace hymo {
 
 std::vector<UserHideRule> load_user_hide_rules() {
     std::vector<UserHideRule> rules;
+    std::string source = file_signature(USER_HIDE_RULES_FILE);
+    SnapshotView snap;
+    if (snap.open_fresh(USER_RULES_SNAPSHOT_FILE, SnapshotKind::UserRules, source)) {
+        for (auto& path : snap.get_list("paths")) {
+            rules.push_back({std::move(path)});
+        }
+        LOG_INFO("Loaded " + std::to_string(rules.size()) + " user hide rules");
+        return rules;
+    }
+
     std::ifstream file(USER_HIDE_RULES_FILE);
 
     if (!file.is_open()) {
@@ -25,15 +37,27 @@ std::vector<UserHideRule> load_user_hide_rules() {
 
     try {
         auto root = json::parse(buffer.str());
-        if (root.type == json::Type::Array) {
+        if (root.type() == json::Type::Array) {
             for (const auto& val : root.as_array()) {
-                if (val.type == json::Type::String) {
+                if (val.type() == json::Type::String) {
                     rules.push_back({val.as_string()});
                 }
             }
         }
     } catch (const std::exception& e) {
         LOG_ERROR("Failed to parse user rules JSON: " + std::string(e.what()));
+        return rules;
+    }
+
+    SnapshotBuilder builder;
+    std::vector<std::string> paths;
+    for (const auto& rule : rules) {
+        paths.push_back(rule.path);
+    }
+    builder.set_list("paths", paths);
+    if (!ensure_dir_exists(RUN_DIR) ||
+        !builder.write(USER_RULES_SNAPSHOT_FILE, SnapshotKind::UserRules, source)) {
+        LOG_DEBUG("Could not write user hide rules snapshot");
     }
 
     LOG_INFO("Loaded " + std::to_string(rules.size()) + " user hide rules");
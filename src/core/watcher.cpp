@@ -0,0 +1,565 @@
+// core/watcher.cpp - Module directory watcher and incremental hot-apply implementation
+#include "watcher.hpp"
+#include <dirent.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <sys/mount.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <vector>
+#include "../defs.hpp"
+#include "../mount/hymofs.hpp"
+#include "../mount/magic.hpp"
+#include "../mount/overlay.hpp"
+#include "../utils.hpp"
+#include "inventory.hpp"
+#include "planner.hpp"
+#include "state.hpp"
+#include "storage.hpp"
+#include "sync.hpp"
+
+namespace hymo {
+
+static constexpr uint32_t MODULE_DIR_MASK =
+    IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ONLYDIR;
+static constexpr uint32_t MODULE_MASK =
+    IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_CLOSE_WRITE | IN_ONLYDIR;
+// A steady stream of events must not postpone the apply forever
+static constexpr int MAX_DEBOUNCE_FACTOR = 10;
+
+static volatile sig_atomic_t g_stop = 0;
+
+static void request_stop(int) {
+    g_stop = 1;
+}
+
+static std::vector<std::string> target_partitions(const Config& config) {
+    std::vector<std::string> parts = BUILTIN_PARTITIONS;
+    parts.insert(parts.end(), config.partitions.begin(), config.partitions.end());
+    std::sort(parts.begin(), parts.end());
+    parts.erase(std::unique(parts.begin(), parts.end()), parts.end());
+    return parts;
+}
+
+static bool contains(const std::vector<std::string>& ids, const std::string& id) {
+    return std::find(ids.begin(), ids.end(), id) != ids.end();
+}
+
+static void erase_ids(std::vector<std::string>& ids, const std::set<std::string>& drop) {
+    ids.erase(std::remove_if(ids.begin(), ids.end(),
+                             [&drop](const std::string& id) { return drop.count(id) > 0; }),
+              ids.end());
+}
+
+// True if `path` lies strictly below `parent`
+static bool is_nested(const std::string& path, const std::string& parent) {
+    return path.size() > parent.size() && path.compare(0, parent.size(), parent) == 0 &&
+           (parent == "/" || path[parent.size()] == '/');
+}
+
+// True if the topmost mount on `target` is an overlay
+static bool is_overlay_mounted(const std::string& target) {
+    std::ifstream mounts("/proc/self/mounts");
+    std::string line;
+    bool overlay = false;
+    while (std::getline(mounts, line)) {
+        std::istringstream iss(line);
+        std::string device, mount_point, type;
+        if (iss >> device >> mount_point >> type && mount_point == target) {
+            overlay = (type == "overlay");
+        }
+    }
+    return overlay;
+}
+
+// Virtual paths ("/system/bin/foo") a module copy provides under its partition dirs
+static void collect_virtual_paths(const fs::path& module_root,
+                                  const std::vector<std::string>& partitions,
+                                  std::set<std::string>& out) {
+    for (const auto& part : partitions) {
+        fs::path part_root = module_root / part;
+        if (!fs::is_directory(part_root)) {
+            continue;
+        }
+        walk_tree(part_root, [&](const WalkEntry& entry) {
+            if (entry.type != DT_DIR) {
+                out.insert("/" + part + "/" + entry.rel);
+            }
+            return true;
+        });
+    }
+}
+
+// True if any other HymoFS module provides one of `paths`; replacing rules piecemeal would
+// then drop or misorder that module's mapping
+static bool shares_paths(const std::set<std::string>& paths, const fs::path& storage_root,
+                         const std::vector<std::string>& other_ids) {
+    struct stat st;
+    for (const auto& id : other_ids) {
+        fs::path root = storage_root / id;
+        for (const auto& path : paths) {
+            if (lstat((root.string() + path).c_str(), &st) == 0) {
+                LOG_DEBUG("Module " + id + " also provides " + path);
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+bool apply_module_changes(const Config& config, const std::set<std::string>& module_ids) {
+    RuntimeState state = load_runtime_state();
+    if (state.storage_mode.empty() || state.mount_point.empty()) {
+        LOG_WARN("Hot-apply skipped: no mount state (modules were not mounted by hymod)");
+        return false;
+    }
+    const fs::path storage_root = state.mount_point;
+    const auto partitions = target_partitions(config);
+    const bool writable_storage = state.storage_mode == "tmpfs" ||
+                                  state.storage_mode == "ext4" || state.storage_mode == "zram";
+
+    std::string joined;
+    for (const auto& id : module_ids) {
+        joined += (joined.empty() ? "" : ", ") + id;
+    }
+    LOG_INFO("Hot-applying module changes: " + joined);
+
+    // Current module set, filtered like the boot path
+    std::vector<Module> modules;
+    for (auto& mod : scan_modules(config.moduledir, config)) {
+        bool has_content = std::any_of(partitions.begin(), partitions.end(),
+                                       [&mod](const std::string& part) {
+                                           return has_files_recursive(mod.source_path / part);
+                                       });
+        if (has_content) {
+            modules.push_back(std::move(mod));
+        }
+    }
+
+    // Magic mount trees bind files out of storage; leave their copies alone until reboot
+    std::set<std::string> changed;
+    for (const auto& id : module_ids) {
+        if (contains(state.magic_module_ids, id)) {
+            LOG_WARN("Module " + id + " is magic mounted; its change applies after reboot");
+        } else {
+            changed.insert(id);
+        }
+    }
+
+    // Overlays reading a changed module's copy are detached before the copy is touched.
+    // Detaching also takes down whatever else was mounted below them, so a module whose
+    // overlays carry foreign mounts waits for reboot instead.
+    std::map<std::string, std::set<std::string>> detach;  // target -> changed ids it reads
+    for (const auto& id : changed) {
+        for (const auto& target : overlays_with_layers_in(storage_root / id)) {
+            detach[target].insert(id);
+        }
+    }
+    // Child overlays mount_overlay() restored go with their parent target
+    for (auto it = detach.begin(); it != detach.end();) {
+        bool nested = std::any_of(detach.begin(), it, [&it](const auto& parent) {
+            return is_nested(it->first, parent.first);
+        });
+        it = nested ? detach.erase(it) : std::next(it);
+    }
+    for (const auto& [target, ids] : detach) {
+        if (!has_foreign_child_mounts(target)) {
+            continue;
+        }
+        for (const auto& id : ids) {
+            if (changed.erase(id)) {
+                LOG_WARN("Overlay on " + target + " has mounts from elsewhere below it; " +
+                         "change to " + id + " applies after reboot");
+            }
+        }
+    }
+    for (auto it = detach.begin(); it != detach.end();) {
+        bool needed = std::any_of(it->second.begin(), it->second.end(),
+                                  [&changed](const std::string& id) { return changed.count(id); });
+        it = needed ? std::next(it) : detach.erase(it);
+    }
+    if (changed.empty()) {
+        return true;
+    }
+
+    std::vector<Module> changed_modules;
+    for (const auto& mod : modules) {
+        if (changed.count(mod.id)) {
+            changed_modules.push_back(mod);
+        }
+    }
+    if (state.storage_mode == "erofs" && !changed_modules.empty()) {
+        LOG_WARN("EROFS storage is read-only; new module content applies after reboot");
+    }
+    if (writable_storage && !changed_modules.empty() &&
+        !grow_storage_for(storage_root, state.storage_mode, changed_modules,
+                          config.tmpfs_max_ram_percent)) {
+        LOG_WARN("Storage has no room for the changed modules; they apply after reboot");
+        return false;
+    }
+
+    // Targets whose overlays read the changed copies before the refresh
+    std::set<std::string> overlay_targets;
+    for (const auto& entry : detach) {
+        overlay_targets.insert(entry.first);
+    }
+
+    // Decide between a HymoFS delta and a full rebuild while the old copies still exist
+    const bool hymofs = HymoFS::is_available();
+    bool full_rebuild = false;
+    std::vector<std::string> old_hymofs_ids;
+    if (hymofs) {
+        std::set<std::string> paths;
+        for (const auto& id : changed) {
+            if (contains(state.hymofs_module_ids, id)) {
+                old_hymofs_ids.push_back(id);
+                collect_virtual_paths(storage_root / id, partitions, paths);
+            }
+        }
+        for (const auto& mod : changed_modules) {
+            full_rebuild = full_rebuild || !mod.rules.empty();
+            collect_virtual_paths(mod.source_path, partitions, paths);
+        }
+        std::vector<std::string> others = state.hymofs_module_ids;
+        erase_ids(others, changed);
+        full_rebuild = full_rebuild || shares_paths(paths, storage_root, others);
+
+        if (!full_rebuild) {
+            for (const auto& id : old_hymofs_ids) {
+                for (const auto& part : partitions) {
+                    HymoFS::remove_rules_from_directory(fs::path("/") / part,
+                                                        storage_root / id / part);
+                }
+            }
+        }
+    }
+
+    // std::set keeps parents ahead of nested targets; detaching a parent takes the overlays
+    // nested in it along
+    bool ok = true;
+    std::set<std::string> detached;
+    for (const auto& target : overlay_targets) {
+        if (!is_overlay_mounted(target)) {
+            continue;
+        }
+        if (umount2(target.c_str(), MNT_DETACH) != 0) {
+            LOG_ERROR("Failed to detach overlay on " + target + ": " + strerror(errno));
+            ok = false;
+            continue;
+        }
+        detached.insert(target);
+    }
+    // An overlay that could not be detached still reads the old copies; the detached ones
+    // are then remounted over storage as it was
+    const bool refresh = ok;
+    if (!refresh) {
+        LOG_WARN("Storage left as is; module changes apply after reboot");
+    }
+
+    // Refresh storage copies of the changed modules only
+    if (refresh && writable_storage) {
+        for (const auto& id : changed) {
+            bool still_active = std::any_of(changed_modules.begin(), changed_modules.end(),
+                                            [&id](const Module& m) { return m.id == id; });
+            if (!still_active && fs::exists(storage_root / id)) {
+                std::error_code ec;
+                fs::remove_all(storage_root / id, ec);
+                LOG_INFO("Dropped storage copy of " + id);
+            }
+        }
+        if (!changed_modules.empty()) {
+            if (!sync_modules(changed_modules, storage_root, config)) {
+                LOG_ERROR("Hot-apply sync failed");
+                ok = false;
+            } else if (state.storage_mode != "tmpfs") {
+                finalize_storage_permissions(storage_root);
+            }
+        }
+    } else if (refresh && state.storage_mode == "direct") {
+        repair_contexts_in_place(changed_modules, config);
+    }
+
+    MountPlan plan = generate_plan(config, modules, storage_root);
+
+    if (hymofs) {
+        if (full_rebuild) {
+            LOG_INFO("Changed modules share paths or carry rules; rebuilding HymoFS mappings");
+            update_hymofs_mappings(config, modules, storage_root, plan);
+            state.hymofs_module_ids = plan.hymofs_module_ids;
+        } else {
+            erase_ids(state.hymofs_module_ids, changed);
+            for (const auto& mod : changed_modules) {
+                if (!contains(plan.hymofs_module_ids, mod.id)) {
+                    continue;
+                }
+                for (const auto& part : partitions) {
+                    HymoFS::add_rules_from_directory(fs::path("/") / part,
+                                                     storage_root / mod.id / part);
+                }
+                state.hymofs_module_ids.push_back(mod.id);
+            }
+        }
+    }
+
+    // Overlay targets the changed modules contribute to now
+    for (const auto& op : plan.overlay_ops) {
+        for (const auto& layer : op.lowerdirs) {
+            fs::path module_root = layer.parent_path();
+            if (changed.count(module_root.filename().string())) {
+                overlay_targets.insert(op.target);
+                break;
+            }
+        }
+    }
+
+    erase_ids(state.overlay_module_ids, changed);
+    std::set<std::string> remounted_ids;
+    for (const auto& target : overlay_targets) {
+        auto op = std::find_if(plan.overlay_ops.begin(), plan.overlay_ops.end(),
+                               [&target](const OverlayOperation& o) { return o.target == target; });
+        bool nested_in_detached =
+            std::any_of(detached.begin(), detached.end(), [&target](const std::string& parent) {
+                return is_nested(target, parent);
+            });
+        if (nested_in_detached && op == plan.overlay_ops.end()) {
+            continue;  // Restored, if still needed, when its parent is remounted
+        }
+
+        // An overlay that did not read the changed copies is still intact; it is replaced
+        // only when nothing foreign is mounted below it
+        if (!detached.count(target) && is_overlay_mounted(target)) {
+            if (has_foreign_child_mounts(target)) {
+                LOG_WARN("Overlay on " + target + " has mounts from elsewhere below it; " +
+                         "its new layers apply after reboot");
+                continue;
+            }
+            if (umount2(target.c_str(), MNT_DETACH) != 0) {
+                LOG_WARN("Failed to detach overlay on " + target + ": " + strerror(errno));
+                ok = false;
+                continue;
+            }
+        }
+        if (op == plan.overlay_ops.end()) {
+            LOG_INFO("Overlay on " + target + " removed");
+            continue;
+        }
+
+        std::vector<std::string> lowerdirs;
+        for (const auto& layer : op->lowerdirs) {
+            lowerdirs.push_back(layer.string());
+        }
+        int err = mount_overlay(op->target, lowerdirs, config.mountsource, std::nullopt,
+                                std::nullopt, config.disable_umount, partitions, op->layer_index);
+        if (err != 0) {
+            LOG_ERROR("Failed to remount overlay on " + target + ": " + strerror(err));
+            ok = false;
+            continue;
+        }
+        LOG_INFO("Remounted overlay on " + target + " (" + std::to_string(lowerdirs.size()) +
+                 " layers)");
+        for (const auto& layer : op->lowerdirs) {
+            remounted_ids.insert(layer.parent_path().filename().string());
+        }
+    }
+    for (const auto& id : plan.overlay_module_ids) {
+        if (changed.count(id) && remounted_ids.count(id)) {
+            state.overlay_module_ids.push_back(id);
+        }
+    }
+
+    for (const auto& id : plan.magic_module_ids) {
+        if (changed.count(id)) {
+            LOG_WARN("Module " + id + " needs magic mount; it applies after reboot");
+        }
+    }
+
+    if (hymofs && !overlay_targets.empty() && config.enable_stealth) {
+        HymoFS::fix_mounts();
+    }
+
+    record_try_umount_roots(flush_unmountables());
+    state.save();
+    LOG_INFO(std::string("Hot-apply ") + (ok ? "finished" : "finished with errors"));
+    return ok;
+}
+
+namespace {
+
+class ModuleWatch {
+public:
+    explicit ModuleWatch(const Config& config)
+        : module_dir_(config.moduledir), partitions_(target_partitions(config)) {}
+    ~ModuleWatch() {
+        if (fd_ >= 0) {
+            close(fd_);
+        }
+    }
+
+    bool start() {
+        fd_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (fd_ < 0) {
+            LOG_ERROR("inotify_init1 failed: " + std::string(strerror(errno)));
+            return false;
+        }
+        root_wd_ = inotify_add_watch(fd_, module_dir_.c_str(), MODULE_DIR_MASK);
+        if (root_wd_ < 0) {
+            LOG_ERROR("Cannot watch " + module_dir_.string() + ": " + strerror(errno));
+            return false;
+        }
+        std::error_code ec;
+        for (const auto& entry : fs::directory_iterator(module_dir_, ec)) {
+            if (entry.is_directory()) {
+                watch_module(entry.path().filename().string());
+            }
+        }
+        return true;
+    }
+
+    int fd() const { return fd_; }
+
+    // Drain pending events into `changed`
+    void read_events(std::set<std::string>& changed) {
+        alignas(struct inotify_event) char buf[4096];
+        for (;;) {
+            ssize_t len = read(fd_, buf, sizeof(buf));
+            if (len <= 0) {
+                return;
+            }
+            for (char* p = buf; p < buf + len;) {
+                auto* event = reinterpret_cast<struct inotify_event*>(p);
+                handle_event(*event, changed);
+                p += sizeof(struct inotify_event) + event->len;
+            }
+        }
+    }
+
+private:
+    void watch_module(const std::string& id) {
+        int wd = inotify_add_watch(fd_, (module_dir_ / id).c_str(), MODULE_MASK);
+        if (wd >= 0) {
+            module_wds_[wd] = id;
+        }
+    }
+
+    bool is_relevant_entry(const std::string& name) const {
+        return name == DISABLE_FILE_NAME || name == REMOVE_FILE_NAME ||
+               name == SKIP_MOUNT_FILE_NAME || name == "module.prop" ||
+               name == "hymo_rules.conf" || contains(partitions_, name);
+    }
+
+    void handle_event(const struct inotify_event& event, std::set<std::string>& changed) {
+        if (event.mask & IN_Q_OVERFLOW) {
+            // Events were lost; every module is suspect
+            LOG_WARN("inotify queue overflowed, rechecking all modules");
+            std::error_code ec;
+            for (const auto& entry : fs::directory_iterator(module_dir_, ec)) {
+                changed.insert(entry.path().filename().string());
+            }
+            return;
+        }
+        if (event.mask & IN_IGNORED) {
+            module_wds_.erase(event.wd);
+            return;
+        }
+        std::string name = event.len ? event.name : "";
+        if (event.wd == root_wd_) {
+            if (name.empty() || name == "hymo" || name == "lost+found" || name[0] == '.') {
+                return;
+            }
+            changed.insert(name);
+            if (event.mask & (IN_CREATE | IN_MOVED_TO)) {
+                watch_module(name);
+            }
+            return;
+        }
+        auto it = module_wds_.find(event.wd);
+        if (it != module_wds_.end() && is_relevant_entry(name)) {
+            changed.insert(it->second);
+        }
+    }
+
+    fs::path module_dir_;
+    std::vector<std::string> partitions_;
+    int fd_ = -1;
+    int root_wd_ = -1;
+    std::map<int, std::string> module_wds_;
+};
+
+}  // namespace
+
+int run_module_watch(const Config& config, int debounce_ms) {
+    using Clock = std::chrono::steady_clock;
+
+    ModuleWatch watch(config);
+    if (!watch.start()) {
+        return 1;
+    }
+
+    struct sigaction sa = {};
+    sa.sa_handler = request_stop;
+    sigaction(SIGTERM, &sa, nullptr);
+    sigaction(SIGINT, &sa, nullptr);
+
+    LOG_INFO("Watching " + config.moduledir.string() + " for module changes");
+
+    std::set<std::string> pending;
+    Clock::time_point first_event;
+    Clock::time_point last_event;
+    const auto quiet = std::chrono::milliseconds(debounce_ms);
+    const auto max_wait = quiet * MAX_DEBOUNCE_FACTOR;
+
+    while (!g_stop) {
+        int timeout = -1;
+        if (!pending.empty()) {
+            auto now = Clock::now();
+            auto due = std::min(last_event + quiet, first_event + max_wait);
+            timeout = static_cast<int>(std::max<int64_t>(
+                0, std::chrono::duration_cast<std::chrono::milliseconds>(due - now).count()));
+        }
+
+        struct pollfd pfd = {watch.fd(), POLLIN, 0};
+        int ready = poll(&pfd, 1, timeout);
+        if (ready < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            LOG_ERROR("Watch poll failed: " + std::string(strerror(errno)));
+            return 1;
+        }
+        if (ready > 0) {
+            bool was_idle = pending.empty();
+            watch.read_events(pending);
+            if (!pending.empty()) {
+                last_event = Clock::now();
+                if (was_idle) {
+                    first_event = last_event;
+                }
+            }
+            continue;
+        }
+
+        // Quiet period elapsed: pick up config edits made alongside the module change
+        Config current = config;
+        try {
+            current = Config::load_default();
+            current.moduledir = config.moduledir;
+        } catch (const std::exception& e) {
+            LOG_WARN("Config reload failed, keeping previous: " + std::string(e.what()));
+        }
+        apply_module_changes(current, pending);
+        pending.clear();
+    }
+
+    LOG_INFO("Module watch stopping");
+    return 0;
+}
+
+}  // namespace hymo
@@ -0,0 +1,26 @@
+// core/watcher.hpp - Module directory watcher and incremental hot-apply
+#pragma once
+
+#include <set>
+#include <string>
+#include "../conf/config.hpp"
+
+namespace hymo {
+
+// Watch config.moduledir with inotify: module directories appearing, disappearing or being
+// renamed, and inside each module its marker files (disable, remove, skip_mount), module.prop,
+// hymo_rules.conf and top-level partition directories. Events are coalesced until the tree
+// has been quiet for `debounce_ms`, then the affected ids go to apply_module_changes() with
+// a freshly loaded config. Runs until SIGTERM/SIGINT.
+int run_module_watch(const Config& config, int debounce_ms = 1500);
+
+// Bring the live mounts in line with the current state of `module_ids`, leaving every other
+// module alone: their storage copies are refreshed or dropped, their HymoFS rules are
+// replaced (all rules are rebuilt only when they share paths with another module, so
+// priority stays right), and only the overlay targets they contribute to are remounted.
+// Storage is grown first and those overlays are detached before their copies change. Magic
+// mount trees, and targets with foreign mounts beneath them, cannot be swapped live; such
+// changes are logged and apply on reboot.
+bool apply_module_changes(const Config& config, const std::set<std::string>& module_ids);
+
+}  // namespace hymo
@@ -1,83 +1,61 @@
 // core/webui.cpp - WebUI API interface implementation
 #include "webui.hpp"
+#include <cmath>
 #include <fstream>
-#include <iomanip>
-#include <sstream>
 #include "../defs.hpp"
 #include "../mount/magic.hpp"
 #include "../mount/partition_utils.hpp"
 #include "../utils.hpp"
+#include "json.hpp"
 #include "state.hpp"
 
 namespace hymo {
 
-static std::string escape_json_string(const std::string& str) {
-    std::ostringstream oss;
-    for (char c : str) {
-        switch (c) {
-        case '"':
-            oss << "\\\"";
-            break;
-        case '\\':
-            oss << "\\\\";
-            break;
-        case '\n':
-            oss << "\\n";
-            break;
-        case '\r':
-            oss << "\\r";
-            break;
-        case '\t':
-            oss << "\\t";
-            break;
-        default:
-            oss << c;
-            break;
-        }
+static void write_mount_stats(json::Writer& w) {
+    auto stats = get_mount_statistics();
+    w.begin_object()
+        .field("total_mounts", stats.total_mounts)
+        .field("successful_mounts", stats.successful_mounts)
+        .field("failed_mounts", stats.failed_mounts)
+        .field("tmpfs_created", stats.tmpfs_created)
+        .field("files_mounted", stats.files_mounted)
+        .field("dirs_mounted", stats.dirs_mounted)
+        .field("symlinks_created", stats.symlinks_created)
+        .field("overlayfs_mounts", stats.overlayfs_mounts)
+        .field("try_umount_roots", stats.try_umount_roots)
+        .field("mount_budget", stats.mount_budget)
+        .field("predicted_mounts", stats.predicted_mounts)
+        .field("mounts_added", stats.mounts_added)
+        .field("success_rate", std::round(stats.get_success_rate() * 100) / 100)
+        .end_object();
+}
+
+static void write_partitions(json::Writer& w) {
+    w.begin_array();
+    for (const auto& p : detect_partitions()) {
+        w.begin_object()
+            .field("name", p.name)
+            .field("mount_point", p.mount_point.string())
+            .field("fs_type", p.fs_type)
+            .field("is_read_only", p.is_read_only)
+            .field("exists_as_symlink", p.exists_as_symlink)
+            .end_object();
     }
-    return oss.str();
+    w.end_array();
 }
 
 std::string export_mount_stats_json() {
-    auto stats = get_mount_statistics();
-
-    std::ostringstream json;
-    json << "{"
-         << "\"total_mounts\":" << stats.total_mounts << ","
-         << "\"successful_mounts\":" << stats.successful_mounts << ","
-         << "\"failed_mounts\":" << stats.failed_mounts << ","
-         << "\"tmpfs_created\":" << stats.tmpfs_created << ","
-         << "\"files_mounted\":" << stats.files_mounted << ","
-         << "\"dirs_mounted\":" << stats.dirs_mounted << ","
-         << "\"symlinks_created\":" << stats.symlinks_created << ","
-         << "\"overlayfs_mounts\":" << stats.overlayfs_mounts << ","
-         << "\"success_rate\":" << std::fixed << std::setprecision(2) << stats.get_success_rate()
-         << "}";
-
-    return json.str();
+    std::string out;
+    json::Writer w(out);
+    write_mount_stats(w);
+    return out;
 }
 
 std::string export_partitions_json() {
-    auto partitions = detect_partitions();
-
-    std::ostringstream json;
-    json << "[";
-
-    for (size_t i = 0; i < partitions.size(); i++) {
-        const auto& p = partitions[i];
-        if (i > 0)
-            json << ",";
-
-        json << "{"
-             << "\"name\":\"" << escape_json_string(p.name) << "\","
-             << "\"mount_point\":\"" << escape_json_string(p.mount_point.string()) << "\","
-             << "\"fs_type\":\"" << escape_json_string(p.fs_type) << "\","
-             << "\"is_read_only\":" << (p.is_read_only ? "true" : "false") << ","
-             << "\"exists_as_symlink\":" << (p.exists_as_symlink ? "true" : "false") << "}";
-    }
-
-    json << "]";
-    return json.str();
+    std::string out;
+    json::Writer w(out);
+    write_partitions(w);
+    return out;
 }
 
 std::string export_system_info_json() {
@@ -107,25 +85,20 @@ std::string export_system_info_json() {
         selinux = (enforce == "0") ? "Permissive" : "Enforcing";
     }
 
-    // Get mount statistics
-    auto mount_stats = export_mount_stats_json();
-
-    // Get detected partitions
-    auto partitions = export_partitions_json();
-
     // Get mount base from runtime state or use default
     auto state = load_runtime_state();
     std::string mount_base = state.mount_point.empty() ? HYMO_MIRROR_DEV : state.mount_point;
 
-    std::ostringstream json;
-    json << "{"
-         << "\"kernel\":\"" << escape_json_string(kernel) << "\","
-         << "\"selinux\":\"" << selinux << "\","
-         << "\"mount_base\":\"" << escape_json_string(mount_base) << "\","
-         << "\"mountStats\":" << mount_stats << ","
-         << "\"detectedPartitions\":" << partitions << "}";
-
-    return json.str();
+    std::string out;
+    json::Writer w(out);
+    w.begin_object()
+        .field("kernel", kernel)
+        .field("selinux", selinux)
+        .field("mount_base", mount_base);
+    write_mount_stats(w.key("mountStats"));
+    write_partitions(w.key("detectedPartitions"));
+    w.end_object();
+    return out;
 }
 
 }  // namespace hymo
@@ -13,6 +13,12 @@ constexpr const char* BASE_DIR = "/data/adb/hymo/";
 constexpr const char* RUN_DIR = "/data/adb/hymo/run/";
 constexpr const char* STATE_FILE = "/data/adb/hymo/run/daemon_state.json";
 constexpr const char* MOUNT_STATS_FILE = "/data/adb/hymo/run/mount_stats.json";
+constexpr const char* OVERLAY_HISTORY_FILE = "/data/adb/hymo/run/overlay_history.json";
+constexpr const char* TRACE_FILE = "/data/adb/hymo/run/boot_trace.json";
+// Binary snapshots derived from the JSON files above (see core/snapshot.hpp)
+constexpr const char* CONFIG_SNAPSHOT_FILE = "/data/adb/hymo/run/config.snap";
+constexpr const char* STATE_SNAPSHOT_FILE = "/data/adb/hymo/run/daemon_state.snap";
+constexpr const char* USER_RULES_SNAPSHOT_FILE = "/data/adb/hymo/run/user_hide_rules.snap";
 constexpr const char* DAEMON_LOG_FILE = "/data/adb/hymo/daemon.log";
 constexpr const char* SYSTEM_RW_DIR = "/data/adb/hymo/rw";
 constexpr const char* MODULE_PROP_FILE = "/data/adb/modules/hymo/module.prop";
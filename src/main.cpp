@@ -3,6 +3,7 @@
 #include <sys/mount.h>
 #include <unistd.h>
 #include <algorithm>
+#include <cerrno>
 #include <cstdlib>
 #include <fstream>
 #include <iostream>
@@ -10,15 +11,19 @@
 #include <set>
 #include <sstream>
 #include "conf/config.hpp"
+#include "core/daemon.hpp"
 #include "core/executor.hpp"
 #include "core/inventory.hpp"
 #include "core/json.hpp"
 #include "core/modules.hpp"
+#include "core/overlay_history.hpp"
 #include "core/planner.hpp"
 #include "core/state.hpp"
 #include "core/storage.hpp"
 #include "core/sync.hpp"
+#include "core/trace.hpp"
 #include "core/user_rules.hpp"
+#include "core/watcher.hpp"
 #include "core/webui.hpp"
 #include "defs.hpp"
 #include "mount/hymofs.hpp"
@@ -36,6 +41,7 @@ struct CliOptions {
     bool verbose = false;
     std::vector<std::string> partitions;
     std::string output;
+    std::string size;
     std::vector<std::string> args;
 };
 
@@ -44,13 +50,15 @@ static void print_help() {
     std::cout << "Main Commands:\n";
     std::cout << "  mount              Mount all modules (default action)\n";
     std::cout << "  clear              Clear all HymoFS mappings\n";
-    std::cout << "  fix-mounts         Fix mount namespace issues\n\n";
+    std::cout << "  fix-mounts         Fix mount namespace issues\n";
+    std::cout << "  daemon             Serve api/module list/config show from memory\n";
+    std::cout << "  watch              Hot-apply module installs, updates and removals\n\n";
 
     std::cout << "Configuration Commands (config <subcommand>):\n";
     std::cout << "  config gen         Generate default config file\n";
     std::cout << "  config show        Show current configuration\n";
     std::cout << "  config sync-partitions  Scan and auto-add partitions\n";
-    std::cout << "  config create-image [dir]  Create modules.img\n\n";
+    std::cout << "  config create-image [dir] [--size auto|N[K|M|G]]  Create modules.img\n\n";
 
     std::cout << "Module Commands (module <subcommand>):\n";
     std::cout << "  module list        List all modules\n";
@@ -75,7 +83,9 @@ static void print_help() {
     std::cout << "  api system         Complete system info with stats\n";
     std::cout << "  api storage        Storage usage information\n";
     std::cout << "  api mount-stats    Mount statistics\n";
-    std::cout << "  api partitions     Detected partitions info\n\n";
+    std::cout << "  api partitions     Detected partitions info\n";
+    std::cout << "  api overlay-history  Per-target overlay outcomes\n";
+    std::cout << "  api trace          Per-phase timings of the last mount\n\n";
 
     std::cout << "Privacy Commands (hide <subcommand>):\n";
     std::cout << "  hide list          List user-defined hide rules\n";
@@ -97,6 +107,7 @@ static void print_help() {
     std::cout << "  -p, --partition NAME    Add partition (can be used multiple "
                  "times)\n";
     std::cout << "  -o, --output FILE       Output file (for gen-config)\n";
+    std::cout << "  -S, --size SIZE         Image size for create-image (auto = fit modules)\n";
     std::cout << "  -h, --help              Show this help\n";
     std::cout << "\nExamples:\n";
     std::cout << "\nExamples:\n";
@@ -157,13 +168,14 @@ static CliOptions parse_args(int argc, char* argv[]) {
                                            {"verbose", no_argument, 0, 'v'},
                                            {"partition", required_argument, 0, 'p'},
                                            {"output", required_argument, 0, 'o'},
+                                           {"size", required_argument, 0, 'S'},
                                            {"help", no_argument, 0, 'h'},
                                            {0, 0, 0, 0}};
 
     int opt;
     int option_index = 0;
 
-    while ((opt = getopt_long(argc, argv, "c:m:t:s:vp:o:h", long_options, &option_index)) != -1) {
+    while ((opt = getopt_long(argc, argv, "c:m:t:s:vp:o:S:h", long_options, &option_index)) != -1) {
         switch (opt) {
         case 'c':
             opts.config_file = optarg;
@@ -186,6 +198,9 @@ static CliOptions parse_args(int argc, char* argv[]) {
         case 'o':
             opts.output = optarg;
             break;
+        case 'S':
+            opts.size = optarg;
+            break;
         case 'h':
             print_help();
             exit(0);
@@ -207,6 +222,30 @@ static CliOptions parse_args(int argc, char* argv[]) {
     return opts;
 }
 
+// "auto" (or empty) -> 0, otherwise bytes from N with an optional K/M/G suffix; -1 if invalid
+static int64_t parse_image_size(const std::string& text) {
+    if (text.empty() || text == "auto") {
+        return 0;
+    }
+    char* end = nullptr;
+    errno = 0;
+    unsigned long long value = strtoull(text.c_str(), &end, 10);
+    if (errno != 0 || end == text.c_str() || value == 0) {
+        return -1;
+    }
+    std::string suffix(end);
+    if (suffix == "K" || suffix == "k") {
+        value <<= 10;
+    } else if (suffix == "M" || suffix == "m") {
+        value <<= 20;
+    } else if (suffix == "G" || suffix == "g") {
+        value <<= 30;
+    } else if (!suffix.empty()) {
+        return -1;
+    }
+    return static_cast<int64_t>(value);
+}
+
 static Config load_config(const CliOptions& opts) {
     if (!opts.config_file.empty()) {
         return Config::from_file(opts.config_file);
@@ -223,17 +262,151 @@ static Config load_config(const CliOptions& opts) {
     }
 }
 
+// Read-only commands that a running `hymod daemon` can answer from memory
+static bool is_query_command(const std::string& command, const std::vector<std::string>& args) {
+    if (args.empty()) {
+        return false;
+    }
+    return command == "api" || (command == "module" && args[0] == "list") ||
+           (command == "config" && args[0] == "show");
+}
+
+static void print_config_json(const Config& config) {
+    std::string out;
+    json::Writer w(out, 2);
+    w.begin_object()
+        .field("moduledir", config.moduledir.string())
+        .field("tempdir", config.tempdir.string())
+        .field("mountsource", config.mountsource)
+        .field("mount_stage", config.mount_stage)
+        .field("debug", config.debug)
+        .field("verbose", config.verbose)
+        .field("fs_type", filesystem_type_to_string(config.fs_type))
+        .field("disable_umount", config.disable_umount)
+        .field("enable_nuke", config.enable_nuke)
+        .field("ignore_protocol_mismatch", config.ignore_protocol_mismatch)
+        .field("enable_kernel_debug", config.enable_kernel_debug)
+        .field("enable_stealth", config.enable_stealth)
+        .field("hymofs_enabled", config.hymofs_enabled)
+        .field("uname_release", config.uname_release)
+        .field("uname_version", config.uname_version)
+        .field("sync_jobs", config.sync_jobs)
+        .field("dedup", config.dedup)
+        .field("erofs_recompress", config.erofs_recompress)
+        .field("tmpfs_max_ram_percent", config.tmpfs_max_ram_percent)
+        .field("max_mounts", config.max_mounts)
+        .field("hymofs_available", HymoFS::is_available())
+        .field("hymofs_status", static_cast<int>(HymoFS::check_status()))
+        .field("tmpfs_xattr_supported", check_tmpfs_xattr())
+        .string_array("partitions", config.partitions)
+        .end_object();
+    std::cout << out << "\n";
+}
+
+static int run_query_command(const CliOptions& cli) {
+    const std::string& subcmd = cli.args[0];
+
+    if (cli.command == "config") {
+        print_config_json(load_config(cli));
+        return 0;
+    }
+    if (cli.command == "module") {
+        print_module_list(load_config(cli));
+        return 0;
+    }
+
+    if (subcmd == "system") {
+        std::cout << export_system_info_json() << std::endl;
+    } else if (subcmd == "storage") {
+        print_storage_status();
+    } else if (subcmd == "mount-stats") {
+        std::cout << export_mount_stats_json() << std::endl;
+    } else if (subcmd == "partitions") {
+        std::cout << export_partitions_json() << std::endl;
+    } else if (subcmd == "overlay-history") {
+        std::cout << export_overlay_history_json() << std::endl;
+    } else if (subcmd == "trace") {
+        std::cout << export_trace_summary_json() << std::endl;
+    } else {
+        std::cerr << "Unknown api subcommand: " << subcmd << "\n";
+        std::cerr << "Available: system, storage, mount-stats, partitions, "
+                     "overlay-history, trace\n";
+        return 1;
+    }
+    return 0;
+}
+
+// Replies the daemon may reuse, keyed on what each command reads. Storage usage changes
+// continuously and is always recomputed.
+static std::string query_cache_key(const std::vector<std::string>& request,
+                                   uint64_t mount_generation) {
+    const std::string& command = request[0];
+    const std::string subcmd = request.size() > 1 ? request[1] : "";
+    fs::path base(BASE_DIR);
+    std::string config_sig = file_signature(base / CONFIG_FILENAME) +
+                             file_signature(base / "module_mode.json") +
+                             file_signature(base / "module_rules.json");
+
+    // Both replies report what HymoFS offers, which changes when its module loads
+    std::string hymofs_sig = std::to_string(HymoFS::is_available()) + ";" +
+                             std::to_string(static_cast<int>(HymoFS::check_status())) + ";";
+
+    if (command == "config") {
+        return hymofs_sig + config_sig;
+    }
+    if (command == "module") {
+        Config config = load_config(CliOptions());
+        std::vector<std::string> partitions = BUILTIN_PARTITIONS;
+        partitions.insert(partitions.end(), config.partitions.begin(), config.partitions.end());
+        return hymofs_sig + config_sig + module_tree_signature(config.moduledir, partitions);
+    }
+    if (subcmd == "system") {
+        std::string enforce;
+        std::ifstream selinux_enforce("/sys/fs/selinux/enforce");
+        std::getline(selinux_enforce, enforce);
+        return std::to_string(mount_generation) + ";" + enforce + ";" +
+               file_signature(STATE_FILE) + file_signature(MOUNT_STATS_FILE);
+    }
+    if (subcmd == "partitions") {
+        return std::to_string(mount_generation);
+    }
+    if (subcmd == "mount-stats") {
+        return file_signature(MOUNT_STATS_FILE);
+    }
+    if (subcmd == "overlay-history") {
+        return file_signature(OVERLAY_HISTORY_FILE);
+    }
+    if (subcmd == "trace") {
+        return file_signature(TRACE_FILE);
+    }
+    return "";
+}
+
 int main(int argc, char* argv[]) {
     try {
         CliOptions cli = parse_args(argc, argv);
 
-        // Initialize logger globally for all commands
-        Logger::getInstance().init(cli.verbose, cli.verbose, DAEMON_LOG_FILE);
+        // Initialize logger globally for all commands. CLI commands log to stderr only; the
+        // mount run below attaches the daemon log.
+        Logger::getInstance().init(cli.verbose, cli.verbose, fs::path());
 
         if (cli.command.empty()) {
             cli.command = "mount";  // Default to mount if no command specified
         }
 
+        // A resident daemon answers queries for the default config without rescanning
+        bool default_options = cli.config_file.empty() && cli.moduledir.empty() &&
+                               cli.tempdir.empty() && cli.mountsource.empty() &&
+                               cli.partitions.empty() && !cli.verbose;
+        if (default_options && is_query_command(cli.command, cli.args)) {
+            std::vector<std::string> request{cli.command};
+            request.insert(request.end(), cli.args.begin(), cli.args.end());
+            int exit_code = 0;
+            if (forward_to_daemon(request, exit_code)) {
+                return exit_code;
+            }
+        }
+
         // Map command string to enum for switch statement
         enum class Command {
             CONFIG,
@@ -246,6 +419,8 @@ int main(int argc, char* argv[]) {
             FIX_MOUNTS,
             RAW,
             MOUNT,
+            DAEMON,
+            WATCH,
             UNKNOWN
         };
 
@@ -270,6 +445,10 @@ int main(int argc, char* argv[]) {
                 return Command::RAW;
             if (cmd == "mount")
                 return Command::MOUNT;
+            if (cmd == "daemon")
+                return Command::DAEMON;
+            if (cmd == "watch")
+                return Command::WATCH;
             return Command::UNKNOWN;
         };
 
@@ -287,44 +466,7 @@ int main(int argc, char* argv[]) {
                 std::cout << "Generated config: " << output << "\n";
                 return 0;
             } else if (subcmd == "show") {
-                Config config = load_config(cli);
-                std::cout << "{\n";
-                std::cout << "  \"moduledir\": \"" << config.moduledir.string() << "\",\n";
-                std::cout << "  \"tempdir\": \"" << config.tempdir.string() << "\",\n";
-                std::cout << "  \"mountsource\": \"" << config.mountsource << "\",\n";
-                std::cout << "  \"mount_stage\": \"" << config.mount_stage << "\",\n";
-                std::cout << "  \"debug\": " << (config.debug ? "true" : "false") << ",\n";
-                std::cout << "  \"verbose\": " << (config.verbose ? "true" : "false") << ",\n";
-                std::cout << "  \"fs_type\": \"" << filesystem_type_to_string(config.fs_type)
-                          << "\",\n";
-                std::cout << "  \"disable_umount\": " << (config.disable_umount ? "true" : "false")
-                          << ",\n";
-                std::cout << "  \"enable_nuke\": " << (config.enable_nuke ? "true" : "false")
-                          << ",\n";
-                std::cout << "  \"ignore_protocol_mismatch\": "
-                          << (config.ignore_protocol_mismatch ? "true" : "false") << ",\n";
-                std::cout << "  \"enable_kernel_debug\": "
-                          << (config.enable_kernel_debug ? "true" : "false") << ",\n";
-                std::cout << "  \"enable_stealth\": " << (config.enable_stealth ? "true" : "false")
-                          << ",\n";
-                std::cout << "  \"hymofs_enabled\": " << (config.hymofs_enabled ? "true" : "false")
-                          << ",\n";
-                std::cout << "  \"uname_release\": \"" << config.uname_release << "\",\n";
-                std::cout << "  \"uname_version\": \"" << config.uname_version << "\",\n";
-                std::cout << "  \"hymofs_available\": "
-                          << (HymoFS::is_available() ? "true" : "false") << ",\n";
-                std::cout << "  \"hymofs_status\": " << (int)HymoFS::check_status() << ",\n";
-                std::cout << "  \"tmpfs_xattr_supported\": "
-                          << (check_tmpfs_xattr() ? "true" : "false") << ",\n";
-                std::cout << "  \"partitions\": [";
-                for (size_t i = 0; i < config.partitions.size(); ++i) {
-                    std::cout << "\"" << config.partitions[i] << "\"";
-                    if (i < config.partitions.size() - 1)
-                        std::cout << ", ";
-                }
-                std::cout << "]\n";
-                std::cout << "}\n";
-                return 0;
+                return run_query_command(cli);
             } else if (subcmd == "sync-partitions") {
                 Config config = load_config(cli);
                 std::vector<std::string> candidates = scan_partition_candidates(config.moduledir);
@@ -371,7 +513,13 @@ int main(int argc, char* argv[]) {
             } else if (subcmd == "create-image") {
                 std::string dir = cli.args.size() >= 2 ? cli.args[1] : "/data/adb";
                 fs::path img_dir(dir);
-                if (create_image(img_dir)) {
+                int64_t size = parse_image_size(cli.size);
+                if (size < 0) {
+                    std::cerr << "Invalid size: " << cli.size << " (use auto or N[K|M|G])\n";
+                    return 1;
+                }
+                Config config = load_config(cli);
+                if (create_image(img_dir, static_cast<uint64_t>(size), config.moduledir)) {
                     std::cout << "Successfully created modules.img in " << dir << "\n";
                     LOG_INFO("Created modules.img via CLI");
                     return 0;
@@ -399,8 +547,7 @@ int main(int argc, char* argv[]) {
             Config config = load_config(cli);
 
             if (subcmd == "list") {
-                print_module_list(config);
-                return 0;
+                return run_query_command(cli);
             } else if (subcmd == "add" || subcmd == "delete") {
                 if (cli.args.size() < 2) {
                     std::cerr << "Usage: hymod module " << subcmd << " <module_id>\n";
@@ -705,31 +852,25 @@ int main(int argc, char* argv[]) {
                 }
 
                 // Find conflicts (files modified by multiple modules)
-                std::cout << "[";
-                bool first = true;
+                std::string out;
+                json::Writer w(out);
+                w.begin_array();
                 for (const auto& [file_path, module_ids] : file_map) {
                     if (module_ids.size() > 1) {
-                        if (!first)
-                            std::cout << ",";
-                        first = false;
-
-                        std::cout << "{\"file\":\"" << file_path << "\",\"modules\":[";
+                        std::string message = "File '" + file_path + "' is modified by " +
+                                              std::to_string(module_ids.size()) + " modules: ";
                         for (size_t i = 0; i < module_ids.size(); ++i) {
-                            if (i > 0)
-                                std::cout << ",";
-                            std::cout << "\"" << module_ids[i] << "\"";
+                            message += (i > 0 ? ", " : "") + module_ids[i];
                         }
-                        std::cout << "],\"message\":\"File '" << file_path << "' is modified by "
-                                  << module_ids.size() << " modules: ";
-                        for (size_t i = 0; i < module_ids.size(); ++i) {
-                            if (i > 0)
-                                std::cout << ", ";
-                            std::cout << module_ids[i];
-                        }
-                        std::cout << "\"}";
+                        w.begin_object()
+                            .field("file", file_path)
+                            .string_array("modules", module_ids)
+                            .field("message", message)
+                            .end_object();
                     }
                 }
-                std::cout << "]\n";
+                w.end_array();
+                std::cout << out << "\n";
                 return 0;
             } else {
                 std::cerr << "Unknown module subcommand: " << subcmd << "\n";
@@ -807,18 +948,16 @@ int main(int argc, char* argv[]) {
                 std::cout << json::dump(root, 2) << "\n";
                 return 0;
             } else if (subcmd == "version") {
-                std::cout << "{\n";
-                std::cout << "  \"protocol_version\": " << HymoFS::EXPECTED_PROTOCOL_VERSION
-                          << ",\n";
-                std::cout << "  \"hymofs_available\": "
-                          << (HymoFS::is_available() ? "true" : "false") << ",\n";
+                std::string out;
+                json::Writer w(out, 2);
+                w.begin_object()
+                    .field("protocol_version", HymoFS::EXPECTED_PROTOCOL_VERSION)
+                    .field("hymofs_available", HymoFS::is_available());
 
                 if (HymoFS::is_available()) {
                     int ver = HymoFS::get_protocol_version();
-                    std::cout << "  \"kernel_version\": " << ver << ",\n";
-                    std::cout << "  \"protocol_mismatch\": "
-                              << (ver != HymoFS::EXPECTED_PROTOCOL_VERSION ? "true" : "false")
-                              << ",\n";
+                    w.field("kernel_version", ver)
+                        .field("protocol_mismatch", ver != HymoFS::EXPECTED_PROTOCOL_VERSION);
 
                     std::string rules = HymoFS::get_active_rules();
                     std::set<std::string> active_modules;
@@ -846,26 +985,20 @@ int main(int argc, char* argv[]) {
                         }
                     }
 
-                    std::cout << "  \"active_modules\": [";
-                    bool first = true;
-                    for (const auto& mod : active_modules) {
-                        if (!first)
-                            std::cout << ", ";
-                        std::cout << "\"" << mod << "\"";
-                        first = false;
-                    }
-                    std::cout << "],\n";
+                    w.string_array("active_modules", active_modules);
                 } else {
-                    std::cout << "  \"kernel_version\": 0,\n";
-                    std::cout << "  \"protocol_mismatch\": false,\n";
-                    std::cout << "  \"active_modules\": [],\n";
+                    w.field("kernel_version", 0)
+                        .field("protocol_mismatch", false)
+                        .key("active_modules")
+                        .begin_array()
+                        .end_array();
                 }
 
                 RuntimeState state = load_runtime_state();
                 std::string mount_base =
                     state.mount_point.empty() ? "/dev/hymo_mirror" : state.mount_point;
-                std::cout << "  \"mount_base\": \"" << mount_base << "\"\n";
-                std::cout << "}\n";
+                w.field("mount_base", mount_base).end_object();
+                std::cout << out << "\n";
                 return 0;
             } else if (subcmd == "set-mirror") {
                 if (cli.args.size() < 2) {
@@ -953,25 +1086,13 @@ int main(int argc, char* argv[]) {
 
         case Command::API: {
             if (cli.args.empty()) {
-                std::cerr << "Usage: hymod api <system|storage|mount-stats|partitions>\n";
+                std::cerr << "Usage: hymod api "
+                             "<system|storage|mount-stats|partitions|overlay-history|trace>\n";
                 return 1;
             }
             std::string subcmd = cli.args[0];
 
-            if (subcmd == "system") {
-                std::cout << export_system_info_json() << std::endl;
-            } else if (subcmd == "storage") {
-                print_storage_status();
-            } else if (subcmd == "mount-stats") {
-                std::cout << export_mount_stats_json() << std::endl;
-            } else if (subcmd == "partitions") {
-                std::cout << export_partitions_json() << std::endl;
-            } else {
-                std::cerr << "Unknown api subcommand: " << subcmd << "\n";
-                std::cerr << "Available: system, storage, mount-stats, partitions\n";
-                return 1;
-            }
-            return 0;
+            return run_query_command(cli);
         }
 
         case Command::DEBUG: {
@@ -1143,6 +1264,35 @@ int main(int argc, char* argv[]) {
             // Fall through to mount logic below
             break;
 
+        case Command::DAEMON: {
+            Config config = load_config(cli);
+            config.merge_with_cli(cli.moduledir, cli.tempdir, cli.mountsource, cli.verbose,
+                                  cli.partitions);
+            Logger::getInstance().init(config.debug, config.verbose, DAEMON_LOG_FILE);
+            camouflage_process("kworker/u9:1");
+            return run_daemon(
+                [](const std::vector<std::string>& request) {
+                    CliOptions query;
+                    query.command = request[0];
+                    query.args.assign(request.begin() + 1, request.end());
+                    if (!is_query_command(query.command, query.args)) {
+                        std::cerr << "Not served by daemon: " << query.command << "\n";
+                        return 1;
+                    }
+                    return run_query_command(query);
+                },
+                query_cache_key);
+        }
+
+        case Command::WATCH: {
+            Config config = load_config(cli);
+            config.merge_with_cli(cli.moduledir, cli.tempdir, cli.mountsource, cli.verbose,
+                                  cli.partitions);
+            Logger::getInstance().init(config.debug, config.verbose, DAEMON_LOG_FILE);
+            camouflage_process("kworker/u9:1");
+            return run_module_watch(config);
+        }
+
         case Command::UNKNOWN:
         default:
             std::cerr << "Unknown command: " << cli.command << "\n";
@@ -1158,6 +1308,10 @@ int main(int argc, char* argv[]) {
         // Re-initialize logger with merged config
         Logger::getInstance().init(config.debug, config.verbose, DAEMON_LOG_FILE);
 
+        // Spans cost two clock reads each, so every mount run is traced
+        trace_enable();
+        TraceSpan run_span("mount");
+
         // Camouflage process
         if (!camouflage_process("kworker/u9:1")) {
             LOG_WARN("Failed to camouflage process");
@@ -1314,84 +1468,58 @@ int main(int argc, char* argv[]) {
             try {
                 // Handle Tmpfs -> EROFS -> Ext4 fallback
                 try {
-                    storage = setup_storage(MIRROR_DIR, img_path, config.fs_type);
+                    storage = setup_storage(MIRROR_DIR, img_path, config.fs_type,
+                                            config.moduledir, config.tmpfs_max_ram_percent);
                 } catch (const std::exception& e) {
                     if (config.fs_type != FilesystemType::AUTO) {
                         LOG_WARN("Specific FS check failed, falling back to auto: " +
                                  std::string(e.what()));
-                        storage = setup_storage(MIRROR_DIR, img_path, FilesystemType::AUTO);
+                        storage = setup_storage(MIRROR_DIR, img_path, FilesystemType::AUTO,
+                                                config.moduledir, config.tmpfs_max_ram_percent);
                     } else {
                         throw;
                     }
                 }
                 LOG_INFO("Mirror storage setup: " + storage.mode);
 
-                // EROFS is read-only: sync into a writable staging dir first, then build+mount.
+                // EROFS is read-only: the image is written straight from the module dirs
                 if (storage.mode == "erofs") {
-                    fs::path staging_dir = fs::path(BASE_DIR) / "erofs_staging";
-                    try {
-                        if (fs::exists(staging_dir)) {
-                            fs::remove_all(staging_dir);
-                        }
-                    } catch (...) {
-                        LOG_WARN("Failed to clean EROFS staging dir");
-                    }
-                    ensure_dir_exists(staging_dir);
-
-                    LOG_INFO("Syncing " + std::to_string(module_list.size()) +
-                             " active modules to EROFS staging...");
-
-                    bool sync_ok = true;
-                    for (const auto& mod : module_list) {
-                        fs::path src = config.moduledir / mod.id;
-                        fs::path dst = staging_dir / mod.id;
-                        if (!sync_dir(src, dst)) {
-                            LOG_ERROR("Failed to sync module: " + mod.id);
-                            sync_ok = false;
-                        }
-                    }
-
-                    if (!sync_ok) {
-                        LOG_ERROR("EROFS staging sync failed. Aborting mirror strategy.");
-                        umount(MIRROR_DIR.c_str());
-                    } else {
-                        storage = setup_erofs_storage(MIRROR_DIR, staging_dir,
-                                                      fs::path(BASE_DIR) / "modules.erofs");
-                        mirror_success = true;
-                        hymofs_active = true;
-
-                        // Plan should be generated from the mirrored storage root.
-                        plan = generate_plan(config, module_list, MIRROR_DIR);
-                        segregate_custom_rules(plan, MIRROR_DIR);
-                        update_hymofs_mappings(config, module_list, MIRROR_DIR, plan);
-                        exec_result = execute_plan(plan, config, hymofs_active);
-
-                        if (config.enable_stealth) {
-                            if (HymoFS::fix_mounts()) {
-                                LOG_INFO("Mount namespace fixed (mnt_id reordered).");
-                            } else {
-                                LOG_WARN("Failed to fix mount namespace.");
-                            }
+                    std::string decision = storage.decision;
+                    storage = setup_erofs_storage(MIRROR_DIR, module_list,
+                                                  fs::path(BASE_DIR) / "erofs_staging",
+                                                  fs::path(BASE_DIR) / "modules.erofs", config);
+                    storage.decision = decision;
+                    mirror_success = true;
+                    hymofs_active = true;
+
+                    // Plan should be generated from the mirrored storage root.
+                    plan = generate_plan(config, module_list, MIRROR_DIR);
+                    segregate_custom_rules(plan, MIRROR_DIR);
+                    update_hymofs_mappings(config, module_list, MIRROR_DIR, plan);
+                    exec_result = execute_plan(plan, config, hymofs_active);
+
+                    if (config.enable_stealth) {
+                        if (HymoFS::fix_mounts()) {
+                            LOG_INFO("Mount namespace fixed (mnt_id reordered).");
+                        } else {
+                            LOG_WARN("Failed to fix mount namespace.");
                         }
                     }
                 } else {
-                    // module_list already filtered above, just sync to mirror
-                    LOG_INFO("Syncing " + std::to_string(module_list.size()) +
-                             " active modules to mirror...");
-
                     bool sync_ok = true;
-                    for (const auto& mod : module_list) {
-                        fs::path src = config.moduledir / mod.id;
-                        fs::path dst = MIRROR_DIR / mod.id;
-                        if (!sync_dir(src, dst)) {
-                            LOG_ERROR("Failed to sync module: " + mod.id);
-                            sync_ok = false;
-                        }
+                    if (storage.mode == "direct") {
+                        // The mirror is a snapshot of the module directory itself
+                        repair_contexts_in_place(module_list, config);
+                    } else {
+                        // module_list already filtered above, just sync to mirror
+                        LOG_INFO("Syncing " + std::to_string(module_list.size()) +
+                                 " active modules to mirror...");
+                        sync_ok = sync_modules(module_list, MIRROR_DIR, config);
                     }
 
                     if (sync_ok) {
                         // If using ext4 image, we need to fix permissions after sync
-                        if (storage.mode == "ext4") {
+                        if (storage.mode == "ext4" || storage.mode == "zram") {
                             finalize_storage_permissions(storage.mount_point);
                         }
 
@@ -1479,7 +1607,8 @@ int main(int argc, char* argv[]) {
             fs::path mnt_base(FALLBACK_CONTENT_DIR);
             fs::path img_path = fs::path(BASE_DIR) / "modules.img";
 
-            storage = setup_storage(mnt_base, img_path, config.fs_type);
+            storage = setup_storage(mnt_base, img_path, config.fs_type, config.moduledir,
+                                    config.tmpfs_max_ram_percent);
 
             // **Step 2: Scan Modules**
             module_list = scan_modules(config.moduledir, config);
@@ -1487,25 +1616,20 @@ int main(int argc, char* argv[]) {
 
             // **Step 3: Sync Content**
             if (storage.mode == "erofs") {
-                // EROFS is read-only: stage content first, then build+mount.
-                fs::path staging_dir = fs::path(BASE_DIR) / "erofs_staging";
-                try {
-                    if (fs::exists(staging_dir)) {
-                        fs::remove_all(staging_dir);
-                    }
-                } catch (...) {
-                    LOG_WARN("Failed to clean EROFS staging dir");
-                }
-                ensure_dir_exists(staging_dir);
-
-                perform_sync(module_list, staging_dir, config);
-                storage = setup_erofs_storage(mnt_base, staging_dir,
-                                              fs::path(BASE_DIR) / "modules.erofs");
+                // EROFS is read-only: the image is built from the module dirs and mounted
+                std::string decision = storage.decision;
+                storage = setup_erofs_storage(mnt_base, module_list,
+                                              fs::path(BASE_DIR) / "erofs_staging",
+                                              fs::path(BASE_DIR) / "modules.erofs", config);
+                storage.decision = decision;
+            } else if (storage.mode == "direct") {
+                // Content is read in place through the snapshot; only labels need fixing
+                repair_contexts_in_place(module_list, config);
             } else {
                 perform_sync(module_list, storage.mount_point, config);
 
                 // **FIX 1: Fix permissions after sync**
-                if (storage.mode == "ext4") {
+                if (storage.mode == "ext4" || storage.mode == "zram") {
                     finalize_storage_permissions(storage.mount_point);
                 }
             }
@@ -1523,9 +1647,13 @@ int main(int argc, char* argv[]) {
                  " Magic modules, " + std::to_string(plan.hymofs_module_ids.size()) +
                  " HymoFS modules");
 
+        // Storage, overlay and magic mounts are all in place: register their roots at once
+        record_try_umount_roots(flush_unmountables());
+        record_mount_footprint(config.max_mounts, plan.predicted_mounts, exec_result.mounts_added);
+
         // **Step 6: KSU Nuke (Stealth)**
         bool nuke_active = false;
-        if (storage.mode == "ext4" && config.enable_nuke) {
+        if ((storage.mode == "ext4" || storage.mode == "zram") && config.enable_nuke) {
             LOG_INFO("Attempting to deploy Paw Pad (Stealth) via KernelSU...");
             if (ksu_nuke_sysfs(storage.mount_point.string())) {
                 LOG_INFO("Success: Paw Pad active. Ext4 sysfs traces nuked.");
@@ -1538,6 +1666,7 @@ int main(int argc, char* argv[]) {
         // **Step 8: Save Runtime State**
         RuntimeState state;
         state.storage_mode = storage.mode;
+        state.storage_decision = storage.decision;
         state.mount_point = storage.mount_point.string();
         state.overlay_module_ids = exec_result.overlay_module_ids;
         state.magic_module_ids = exec_result.magic_module_ids;
@@ -1644,12 +1773,17 @@ int main(int argc, char* argv[]) {
                                   exec_result.magic_module_ids.size(),
                                   plan.hymofs_module_ids.size(), warning_msg, hymofs_active);
 
+        run_span.end();
+        trace_save();
         LOG_INFO("Hymo Completed.");
     } catch (const std::exception& e) {
         std::cerr << "Fatal Error: " << e.what() << "\n";
         LOG_ERROR("Fatal Error: " + std::string(e.what()));
+        // Whatever did get mounted must still be hidden from apps
+        record_try_umount_roots(flush_unmountables());
         // Update with failure emoji
         update_module_description(false, "error", false, 0, 0, 0, "", false);
+        trace_save();
         return 1;
     }
     return 0;
@@ -6,6 +6,7 @@
 #include <unistd.h>
 #include <cerrno>
 #include <cstring>
+#include <mutex>
 #include "../utils.hpp"
 #include "hymo_magic.h"
 
@@ -17,6 +18,10 @@ static int s_hymo_fd = -1;  // Cached anonymous fd
 
 // Get anonymous fd from kernel (only way to communicate with HymoFS)
 static int get_anon_fd() {
+    // Overlay groups mount in parallel and may race for the first fd
+    static std::mutex fd_mutex;
+    std::lock_guard<std::mutex> lock(fd_mutex);
+
     if (s_hymo_fd >= 0) {
         return s_hymo_fd;
     }
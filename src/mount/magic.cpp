@@ -1,5 +1,6 @@
 // mount/magic.cpp - Magic mount implementation
 #include "magic.hpp"
+#include <dirent.h>
 #include <fcntl.h>
 #include <limits.h>
 #include <sys/mount.h>
@@ -14,7 +15,9 @@
 #include <set>
 #include <sstream>
 #include <unordered_map>
+#include "../core/json.hpp"
 #include "../core/state.hpp"
+#include "../core/trace.hpp"
 #include "../defs.hpp"
 #include "../utils.hpp"
 #include "mount_utils.hpp"
@@ -35,9 +38,15 @@ struct MountStats {
     int dirs_mounted = 0;
     int symlinks_created = 0;
     int overlayfs_mounts = 0;
+    int try_umount_roots = 0;
+    int mount_budget = 0;
+    int predicted_mounts = 0;
+    int mounts_added = 0;
 };
 
 static MountStats g_mount_stats;
+// Set once this process owns the saved statistics (reset at boot, or adopted by a later run)
+static bool g_mount_stats_owned = false;
 
 enum class NodeFileType { RegularFile, Directory, Symlink, Whiteout };
 
@@ -357,8 +366,9 @@ static bool mount_file(const fs::path& path, const fs::path& work_dir_path, cons
         }
         LOG_VERBOSE("Mount file: " + node.module_path.string() + " -> " + target_path.string());
 
-        if (!disable_umount) {
-            send_unmountable(target_path);
+        // Inside a tmpfs skeleton the file goes away with the skeleton's own registration
+        if (!disable_umount && !has_tmpfs) {
+            queue_unmountable(target_path);
         }
 
         mount(nullptr, target_path.c_str(), nullptr, MS_REMOUNT | MS_RDONLY | MS_BIND, nullptr);
@@ -538,7 +548,7 @@ static bool finalize_tmpfs_overlay(const fs::path& path, const fs::path& work_di
     mount(nullptr, path.c_str(), nullptr, MS_PRIVATE, nullptr);
 
     if (!disable_umount) {
-        send_unmountable(path);
+        queue_unmountable(path);
     }
 
     LOG_VERBOSE("Finalized tmpfs overlay: " + work_dir_path.string() + " -> " + path.string());
@@ -608,10 +618,85 @@ static bool do_magic_mount(const fs::path& path, const fs::path& work_dir_path,
     return true;
 }
 
+// Regular files under a stock entry, each of which mount_mirror() binds into a skeleton
+static int count_mirror_mounts(const fs::path& path) {
+    struct stat st;
+    if (lstat(path.c_str(), &st) != 0) {
+        return 0;
+    }
+    if (S_ISREG(st.st_mode)) {
+        return 1;
+    }
+    int count = 0;
+    if (S_ISDIR(st.st_mode)) {
+        walk_tree(path, [&count](const WalkEntry& entry) {
+            count += entry.type == DT_REG;
+            return true;
+        });
+    }
+    return count;
+}
+
+// Dry run of do_magic_mount(): the mounts it would leave in place below `path`
+static int count_magic_mounts(const fs::path& path, const Node& current, bool has_tmpfs) {
+    fs::path target_path = path / current.name;
+
+    switch (current.file_type) {
+    case NodeFileType::RegularFile:
+        return current.module_path.empty() ? 0 : 1;
+    case NodeFileType::Symlink:
+        return has_tmpfs || current.module_path.empty() ? 0 : 1;
+    case NodeFileType::Whiteout:
+        return 0;
+    case NodeFileType::Directory:
+        break;
+    }
+
+    bool create_tmpfs = !has_tmpfs && should_create_tmpfs(current, target_path, false);
+    bool effective_tmpfs = has_tmpfs || create_tmpfs;
+    int count = create_tmpfs ? 1 : 0;
+
+    if (fs::exists(target_path) && !current.replace) {
+        try {
+            for (const auto& entry : fs::directory_iterator(target_path)) {
+                std::string name = entry.path().filename().string();
+                auto it = current.children.find(name);
+                if (it != current.children.end()) {
+                    if (!it->second.skip) {
+                        count += count_magic_mounts(target_path, it->second, effective_tmpfs);
+                    }
+                } else if (effective_tmpfs) {
+                    count += count_mirror_mounts(entry.path());
+                }
+            }
+        } catch (...) {
+        }
+    }
+    for (const auto& [name, child] : current.children) {
+        if (!child.skip && !fs::exists(target_path / name) && !current.replace) {
+            count += count_magic_mounts(target_path, child, effective_tmpfs);
+        }
+    }
+    return count;
+}
+
+int predict_magic_mounts(const std::vector<fs::path>& module_paths,
+                         const std::vector<std::string>& extra_partitions) {
+    Node* root = collect_all_modules(module_paths, extra_partitions);
+    if (!root) {
+        return 0;
+    }
+    int count = count_magic_mounts("/", *root, false);
+    delete root;
+    return count;
+}
+
 bool mount_partitions(const fs::path& tmp_path, const std::vector<fs::path>& module_paths,
                       const std::string& mount_source,
                       const std::vector<std::string>& extra_partitions, bool disable_umount) {
+    TraceSpan collect_span("magic_collect", "step");
     Node* root = collect_all_modules(module_paths, extra_partitions);
+    collect_span.end();
     if (!root) {
         LOG_INFO("No files to magic mount");
         return true;
@@ -629,6 +714,7 @@ bool mount_partitions(const fs::path& tmp_path, const std::vector<fs::path>& mod
 
     bool result = false;
     try {
+        TRACE_SCOPE("magic_mount_tree", "step");
         result = do_magic_mount("/", work_dir, *root, false, disable_umount);
     } catch (const std::exception& e) {
         LOG_ERROR("Magic mount failed with exception: " + std::string(e.what()));
@@ -680,24 +766,39 @@ MountStatistics get_mount_statistics() {
                                 std::istreambuf_iterator<char>());
             file.close();
 
-            // Simple JSON parsing
-            auto get_int = [&content](const std::string& key) -> int {
-                auto pos = content.find("\"" + key + "\":");
-                if (pos == std::string::npos)
-                    return 0;
-                pos = content.find(":", pos) + 1;
-                auto end = content.find_first_of(",}", pos);
-                return std::stoi(content.substr(pos, end - pos));
+            const std::pair<const char*, int*> fields[] = {
+                {"total_mounts", &stats.total_mounts},
+                {"successful_mounts", &stats.successful_mounts},
+                {"failed_mounts", &stats.failed_mounts},
+                {"tmpfs_created", &stats.tmpfs_created},
+                {"files_mounted", &stats.files_mounted},
+                {"dirs_mounted", &stats.dirs_mounted},
+                {"symlinks_created", &stats.symlinks_created},
+                {"overlayfs_mounts", &stats.overlayfs_mounts},
+                {"try_umount_roots", &stats.try_umount_roots},
+                {"mount_budget", &stats.mount_budget},
+                {"predicted_mounts", &stats.predicted_mounts},
+                {"mounts_added", &stats.mounts_added},
             };
 
-            stats.total_mounts = get_int("total_mounts");
-            stats.successful_mounts = get_int("successful_mounts");
-            stats.failed_mounts = get_int("failed_mounts");
-            stats.tmpfs_created = get_int("tmpfs_created");
-            stats.files_mounted = get_int("files_mounted");
-            stats.dirs_mounted = get_int("dirs_mounted");
-            stats.symlinks_created = get_int("symlinks_created");
-            stats.overlayfs_mounts = get_int("overlayfs_mounts");
+            json::Reader reader(content);
+            if (reader.next() == json::Token::BeginObject) {
+                while (reader.next() == json::Token::Key) {
+                    int* field = nullptr;
+                    for (const auto& [name, ptr] : fields) {
+                        if (reader.string() == name) {
+                            field = ptr;
+                        }
+                    }
+                    if (!field) {
+                        reader.skip();
+                    } else if (reader.next() == json::Token::Number) {
+                        *field = static_cast<int>(reader.number());
+                    } else {
+                        break;
+                    }
+                }
+            }
         } catch (...) {
             // Return zeros on parse error
         }
@@ -713,16 +814,23 @@ void save_mount_statistics() {
         return;
     }
 
-    file << "{\n"
-         << "  \"total_mounts\": " << g_mount_stats.total_mounts << ",\n"
-         << "  \"successful_mounts\": " << g_mount_stats.successful_mounts << ",\n"
-         << "  \"failed_mounts\": " << g_mount_stats.failed_mounts << ",\n"
-         << "  \"tmpfs_created\": " << g_mount_stats.tmpfs_created << ",\n"
-         << "  \"files_mounted\": " << g_mount_stats.files_mounted << ",\n"
-         << "  \"dirs_mounted\": " << g_mount_stats.dirs_mounted << ",\n"
-         << "  \"symlinks_created\": " << g_mount_stats.symlinks_created << ",\n"
-         << "  \"overlayfs_mounts\": " << g_mount_stats.overlayfs_mounts << "\n"
-         << "}\n";
+    std::string out;
+    json::Writer w(out, 2);
+    w.begin_object()
+        .field("total_mounts", g_mount_stats.total_mounts)
+        .field("successful_mounts", g_mount_stats.successful_mounts)
+        .field("failed_mounts", g_mount_stats.failed_mounts)
+        .field("tmpfs_created", g_mount_stats.tmpfs_created)
+        .field("files_mounted", g_mount_stats.files_mounted)
+        .field("dirs_mounted", g_mount_stats.dirs_mounted)
+        .field("symlinks_created", g_mount_stats.symlinks_created)
+        .field("overlayfs_mounts", g_mount_stats.overlayfs_mounts)
+        .field("try_umount_roots", g_mount_stats.try_umount_roots)
+        .field("mount_budget", g_mount_stats.mount_budget)
+        .field("predicted_mounts", g_mount_stats.predicted_mounts)
+        .field("mounts_added", g_mount_stats.mounts_added)
+        .end_object();
+    file << out << "\n";
 
     file.close();
 }
@@ -731,8 +839,45 @@ void increment_overlay_stats() {
     g_mount_stats.overlayfs_mounts++;
 }
 
+// A process that did not run the boot mounts (e.g. a hot-apply from the watcher) adds to the
+// saved figures instead of overwriting them with its own
+static void adopt_saved_statistics() {
+    if (g_mount_stats_owned) {
+        return;
+    }
+    MountStatistics saved = get_mount_statistics();
+    g_mount_stats.total_mounts = saved.total_mounts;
+    g_mount_stats.successful_mounts = saved.successful_mounts;
+    g_mount_stats.failed_mounts = saved.failed_mounts;
+    g_mount_stats.tmpfs_created = saved.tmpfs_created;
+    g_mount_stats.files_mounted = saved.files_mounted;
+    g_mount_stats.dirs_mounted = saved.dirs_mounted;
+    g_mount_stats.symlinks_created = saved.symlinks_created;
+    g_mount_stats.overlayfs_mounts += saved.overlayfs_mounts;
+    g_mount_stats.try_umount_roots = saved.try_umount_roots;
+    g_mount_stats.mount_budget = saved.mount_budget;
+    g_mount_stats.predicted_mounts = saved.predicted_mounts;
+    g_mount_stats.mounts_added = saved.mounts_added;
+    g_mount_stats_owned = true;
+}
+
+void record_try_umount_roots(int count) {
+    adopt_saved_statistics();
+    g_mount_stats.try_umount_roots += count;
+    save_mount_statistics();
+}
+
+void record_mount_footprint(int budget, int predicted, int added) {
+    adopt_saved_statistics();
+    g_mount_stats.mount_budget = budget;
+    g_mount_stats.predicted_mounts = predicted;
+    g_mount_stats.mounts_added = added;
+    save_mount_statistics();
+}
+
 void reset_mount_statistics() {
     g_mount_stats = MountStats();
+    g_mount_stats_owned = true;
     save_mount_statistics();
 }
 
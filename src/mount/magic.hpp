@@ -19,6 +19,10 @@ struct MountStatistics {
     int dirs_mounted = 0;
     int symlinks_created = 0;
     int overlayfs_mounts = 0;  // OverlayFS partition mounts
+    int try_umount_roots = 0;  // Mount roots registered with KernelSU try-umount
+    int mount_budget = 0;      // Config max_mounts at the time of the run, 0 = unlimited
+    int predicted_mounts = 0;  // Mounts the planner expected the plan to add
+    int mounts_added = 0;      // Mounts the plan actually added to the namespace
 
     // Calculate success rate
     double get_success_rate() const {
@@ -35,6 +39,11 @@ bool mount_partitions(const fs::path& tmp_path, const std::vector<fs::path>& mod
 bool mount_partitions_auto(const fs::path& tmp_path, const std::vector<fs::path>& module_paths,
                            const std::string& mount_source, bool disable_umount);
 
+// Mounts mount_partitions() would add for these modules: file binds, tmpfs skeletons and the
+// stock files mirrored into them. Touches nothing.
+int predict_magic_mounts(const std::vector<fs::path>& module_paths,
+                         const std::vector<std::string>& extra_partitions);
+
 // Get mount statistics (for WebUI/debugging)
 MountStatistics get_mount_statistics();
 
@@ -44,6 +53,12 @@ void save_mount_statistics();
 // Increment overlay mount statistics
 void increment_overlay_stats();
 
+// Add roots registered by flush_unmountables() and save
+void record_try_umount_roots(int count);
+
+// Record the mount budget against the predicted and actual footprint of a run, and save
+void record_mount_footprint(int budget, int predicted, int added);
+
 // Reset mount statistics
 void reset_mount_statistics();
 
@@ -1,14 +1,18 @@
 // mount/mount_utils.cpp - Mount utility functions implementation
 #include "mount_utils.hpp"
 #include <fcntl.h>
+#include <poll.h>
+#include <sys/inotify.h>
 #include <sys/mount.h>
 #include <sys/syscall.h>
 #include <sys/xattr.h>
 #include <unistd.h>
+#include <algorithm>
 #include <cerrno>
 #include <chrono>
 #include <cstring>
 #include <ctime>
+#include <set>
 #include <thread>
 #include "../defs.hpp"
 #include "../utils.hpp"
@@ -150,28 +154,122 @@ bool mount_bind_modern(const fs::path& source, const fs::path& target, bool recu
     return false;
 }
 
+static int ms_until(std::chrono::steady_clock::time_point deadline) {
+    auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+        deadline - std::chrono::steady_clock::now());
+    return left.count() > 0 ? static_cast<int>(left.count()) : 0;
+}
+
+MountTableWatch::MountTableWatch() {
+    // The kernel flags mountinfo with POLLPRI for any change after the file was opened
+    fd_ = open("/proc/self/mountinfo", O_RDONLY | O_CLOEXEC);
+}
+
+MountTableWatch::~MountTableWatch() {
+    if (fd_ >= 0) {
+        close(fd_);
+    }
+}
+
+bool MountTableWatch::wait(int timeout_ms) {
+    if (fd_ < 0) {
+        return false;
+    }
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+    for (;;) {
+        struct pollfd pfd = {fd_, POLLPRI, 0};
+        int ready = poll(&pfd, 1, ms_until(deadline));
+        if (ready < 0 && errno == EINTR) {
+            continue;
+        }
+        return ready > 0 && (pfd.revents & (POLLPRI | POLLERR));
+    }
+}
+
+int wait_for_any_path(const std::vector<fs::path>& paths, int timeout_ms) {
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+    int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    std::set<std::string> watched;
+    int found = -1;
+
+    for (;;) {
+        // Watch before looking, so an entry created in between still wakes the poll. A
+        // missing parent is watched through its nearest existing ancestor and re-armed here
+        // once it appears.
+        for (const auto& path : paths) {
+            fs::path dir = path.parent_path();
+            while (dir != dir.root_path() && access(dir.c_str(), F_OK) != 0) {
+                dir = dir.parent_path();
+            }
+            if (fd >= 0 && watched.insert(dir.string()).second) {
+                inotify_add_watch(fd, dir.c_str(), IN_CREATE | IN_MOVED_TO);
+            }
+        }
+        for (size_t i = 0; i < paths.size() && found < 0; ++i) {
+            if (access(paths[i].c_str(), F_OK) == 0) {
+                found = static_cast<int>(i);
+            }
+        }
+        int remaining = ms_until(deadline);
+        if (found >= 0 || remaining == 0) {
+            break;
+        }
+
+        if (fd < 0) {
+            // No inotify: fall back to a short nap
+            std::this_thread::sleep_for(std::chrono::milliseconds(std::min(remaining, 20)));
+            continue;
+        }
+        struct pollfd pfd = {fd, POLLIN, 0};
+        if (poll(&pfd, 1, remaining) > 0) {
+            char buf[4096];
+            while (read(fd, buf, sizeof(buf)) > 0) {
+            }
+        }
+    }
+
+    if (fd >= 0) {
+        close(fd);
+    }
+    return found;
+}
+
 bool mount_with_retry(const char* source, const char* target, const char* filesystemtype,
-                      unsigned long mountflags, const void* data, int max_retries) {
-    for (int attempt = 0; attempt < max_retries; ++attempt) {
+                      unsigned long mountflags, const void* data, int timeout_ms) {
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+    for (int attempt = 1;; ++attempt) {
+        MountTableWatch mounts;
         if (mount(source, target, filesystemtype, mountflags, data) == 0) {
-            if (attempt > 0) {
-                LOG_INFO("Mount succeeded on attempt " + std::to_string(attempt + 1));
+            if (attempt > 1) {
+                LOG_INFO("Mount succeeded on attempt " + std::to_string(attempt));
             }
             return true;
         }
 
         int err = errno;
-        if (attempt < max_retries - 1) {
-            LOG_WARN("Mount attempt " + std::to_string(attempt + 1) + " failed: " + strerror(err) +
-                     ", retrying...");
-            std::this_thread::sleep_for(std::chrono::milliseconds(100 * (attempt + 1)));
-        } else {
-            LOG_ERROR("Mount failed after " + std::to_string(max_retries) +
-                      " attempts: " + strerror(err));
+        int remaining = ms_until(deadline);
+        bool ready = false;
+        if (remaining > 0 && err == ENOENT) {
+            if (access(target, F_OK) != 0) {
+                ready = wait_for_path(target, remaining);
+            } else if (source && source[0] == '/' && access(source, F_OK) != 0) {
+                ready = wait_for_path(source, remaining);
+            }
+        } else if (remaining > 0 && err == EBUSY) {
+            ready = mounts.wait(remaining);
         }
-    }
 
-    return false;
+        if (!ready) {
+            if (attempt > 1) {
+                LOG_WARN("Mount on " + std::string(target) + " still failing after " +
+                         std::to_string(attempt) + " attempts");
+            }
+            errno = err;
+            return false;
+        }
+        LOG_WARN("Mount attempt " + std::to_string(attempt) + " on " + std::string(target) +
+                 " failed: " + strerror(err) + ", retrying");
+    }
 }
 
 bool is_safe_path(const fs::path& base, const fs::path& target) {
@@ -237,6 +335,21 @@ bool is_safe_symlink(const fs::path& link_path, const fs::path& base) {
     }
 }
 
+int count_mounts() {
+    int fd = open("/proc/self/mountinfo", O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+    int count = 0;
+    char buf[8192];
+    ssize_t n;
+    while ((n = read(fd, buf, sizeof(buf))) > 0) {
+        count += static_cast<int>(std::count(buf, buf + n, '\n'));
+    }
+    close(fd);
+    return n < 0 ? -1 : count;
+}
+
 FastFileType get_file_type_fast(const fs::directory_entry& entry) {
     // Try to use cached file type from readdir first
     try {
@@ -9,6 +9,7 @@
 #include <unistd.h>
 #include <filesystem>
 #include <string>
+#include <vector>
 #include "../defs.hpp"
 
 namespace fs = std::filesystem;
@@ -24,9 +25,38 @@ bool clone_attr(const fs::path& source, const fs::path& target);
 // Note: This function does NOT log - caller should log appropriately
 bool mount_bind_modern(const fs::path& source, const fs::path& target, bool recursive = true);
 
-// Mount with automatic retry and fallback
+// Wakes when the mount table changes. Arm it before the operation whose outcome depends on
+// other mounts: any change after construction is seen, even one that lands before wait().
+class MountTableWatch {
+public:
+    MountTableWatch();
+    ~MountTableWatch();
+    MountTableWatch(const MountTableWatch&) = delete;
+    MountTableWatch& operator=(const MountTableWatch&) = delete;
+
+    // False if the deadline passed without a change
+    bool wait(int timeout_ms);
+
+private:
+    int fd_ = -1;
+};
+
+// Wait until one of `paths` exists, watching the nearest existing parent of each with
+// inotify. Returns the index of the path that appeared, or -1 once `timeout_ms` has passed.
+int wait_for_any_path(const std::vector<fs::path>& paths, int timeout_ms);
+
+inline bool wait_for_path(const fs::path& path, int timeout_ms) {
+    return wait_for_any_path({path}, timeout_ms) == 0;
+}
+
+// mount(2) that rides out transient failures until `timeout_ms` has passed: ENOENT waits for
+// the missing target or source path to appear, EBUSY waits for the mount table to change.
+// Other errors fail at once. On failure errno holds the last cause.
 bool mount_with_retry(const char* source, const char* target, const char* filesystemtype,
-                      unsigned long mountflags, const void* data, int max_retries = 3);
+                      unsigned long mountflags, const void* data, int timeout_ms = 1000);
+
+// Number of mounts in this mount namespace (entries in /proc/self/mountinfo), -1 on error
+int count_mounts();
 
 // Check if path is safe (within allowed base directory)
 bool is_safe_path(const fs::path& base, const fs::path& target);
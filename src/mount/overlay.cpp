@@ -1,5 +1,6 @@
 // mount/overlay.cpp - OverlayFS mounting implementation (FIXED)
 #include "overlay.hpp"
+#include <dirent.h>
 #include <fcntl.h>
 #include <sys/mount.h>
 #include <sys/stat.h>
@@ -58,13 +59,14 @@ static int open_tree(int dfd, const char* filename, unsigned int flags) {
     return syscall(__NR_open_tree, dfd, filename, flags);
 }
 
-static bool mount_overlayfs_modern(const std::string& lowerdir_config,
-                                   const std::optional<std::string>& upperdir,
-                                   const std::optional<std::string>& workdir,
-                                   const std::string& dest, const std::string& mount_source) {
+// Create a detached overlay mount and return its fd (-1 on failure)
+static int create_overlay_fd(const std::string& lowerdir_config,
+                             const std::optional<std::string>& upperdir,
+                             const std::optional<std::string>& workdir,
+                             const std::string& mount_source) {
     int fs_fd = fsopen("overlay", FSOPEN_CLOEXEC);
     if (fs_fd < 0) {
-        return false;
+        return -1;
     }
 
     bool success = true;
@@ -93,24 +95,30 @@ static bool mount_overlayfs_modern(const std::string& lowerdir_config,
     int mnt_fd = -1;
     if (success) {
         mnt_fd = fsmount(fs_fd, FSMOUNT_CLOEXEC, 0);
-        if (mnt_fd < 0) {
-            success = false;
-        }
     }
 
-    if (success) {
-        if (move_mount(mnt_fd, "", AT_FDCWD, dest.c_str(), MOVE_MOUNT_F_EMPTY_PATH) < 0) {
-            success = false;
-        } else {
-            // HymoFS: Hide overlay xattrs for this mount
-            HymoFS::hide_overlay_xattrs(dest);
-        }
+    close(fs_fd);
+    return mnt_fd;
+}
+
+static bool mount_overlayfs_modern(const std::string& lowerdir_config,
+                                   const std::optional<std::string>& upperdir,
+                                   const std::optional<std::string>& workdir,
+                                   const std::string& dest, const std::string& mount_source) {
+    int mnt_fd = create_overlay_fd(lowerdir_config, upperdir, workdir, mount_source);
+    if (mnt_fd < 0) {
+        return false;
     }
 
-    if (mnt_fd >= 0)
-        close(mnt_fd);
-    close(fs_fd);
+    bool success = true;
+    if (move_mount(mnt_fd, "", AT_FDCWD, dest.c_str(), MOVE_MOUNT_F_EMPTY_PATH) < 0) {
+        success = false;
+    } else {
+        // HymoFS: Hide overlay xattrs for this mount
+        HymoFS::hide_overlay_xattrs(dest);
+    }
 
+    close(mnt_fd);
     return success;
 }
 
@@ -154,7 +162,9 @@ static bool mount_overlayfs_legacy(const std::string& lowerdir_config,
 }
 
 // FIX 1: Add function to get child mount points
-static std::vector<std::string> get_child_mounts(const std::string& target_root) {
+// With `unique` false, a point carrying stacked mounts is listed once per mount
+static std::vector<std::string> get_child_mounts(const std::string& target_root,
+                                                 bool unique = true) {
     std::vector<std::string> mounts;
 
     std::ifstream mountinfo("/proc/self/mountinfo");
@@ -185,11 +195,17 @@ static std::vector<std::string> get_child_mounts(const std::string& target_root)
 
     // Sort and deduplicate
     std::sort(mounts.begin(), mounts.end());
-    mounts.erase(std::unique(mounts.begin(), mounts.end()), mounts.end());
+    if (unique) {
+        mounts.erase(std::unique(mounts.begin(), mounts.end()), mounts.end());
+    }
 
     return mounts;
 }
 
+int predict_overlay_mounts(const std::string& target_root) {
+    return 1 + static_cast<int>(get_child_mounts(target_root).size());
+}
+
 // Helper to create mirror path
 static std::string get_mirror_path(const std::string& target_root) {
     std::string clean_path = target_root;
@@ -197,6 +213,61 @@ static std::string get_mirror_path(const std::string& target_root) {
     return "/dev/hymo_mirror/" + clean_path;
 }
 
+bool has_foreign_child_mounts(const std::string& target_root) {
+    // mount_overlay() restores exactly one mount on each point its mirror has below it
+    std::string mirror_path = get_mirror_path(target_root);
+    std::set<std::string> expected;
+    for (const auto& mount_point : get_child_mounts(mirror_path)) {
+        expected.insert(target_root + mount_point.substr(mirror_path.size()));
+    }
+    std::string previous;
+    for (const auto& mount_point : get_child_mounts(target_root, false)) {
+        if (!expected.count(mount_point) || mount_point == previous) {
+            LOG_DEBUG("Foreign mount under " + target_root + ": " + mount_point);
+            return true;
+        }
+        previous = mount_point;
+    }
+    return false;
+}
+
+std::vector<std::string> overlays_with_layers_in(const fs::path& dir) {
+    std::vector<std::string> targets;
+    std::string prefix = dir.string() + "/";
+
+    std::ifstream mountinfo("/proc/self/mountinfo");
+    std::string line;
+    while (std::getline(mountinfo, line)) {
+        // mount_id parent_id major:minor root mount_point ... - fstype source super_options
+        size_t sep = line.find(" - ");
+        if (sep == std::string::npos) {
+            continue;
+        }
+        std::istringstream head(line.substr(0, sep));
+        std::istringstream tail(line.substr(sep + 3));
+        std::string mount_id, parent_id, dev, root, mount_point, fstype, source, options;
+        head >> mount_id >> parent_id >> dev >> root >> mount_point;
+        tail >> fstype >> source >> options;
+        size_t at = options.find("lowerdir=");
+        if (fstype != "overlay" || at == std::string::npos) {
+            continue;
+        }
+        at += strlen("lowerdir=");
+        std::istringstream lowers(options.substr(at, options.find(',', at) - at));
+        std::string lower;
+        while (std::getline(lowers, lower, ':')) {
+            if (lower == dir.string() || lower.compare(0, prefix.size(), prefix) == 0) {
+                targets.push_back(mount_point);
+                break;
+            }
+        }
+    }
+
+    std::sort(targets.begin(), targets.end());
+    targets.erase(std::unique(targets.begin(), targets.end()), targets.end());
+    return targets;
+}
+
 bool bind_mount(const fs::path& from, const fs::path& to, bool disable_umount) {
     LOG_DEBUG("bind mount " + from.string() + " -> " + to.string());
 
@@ -226,67 +297,136 @@ bool bind_mount(const fs::path& from, const fs::path& to, bool disable_umount) {
     }
 
     if (success && !disable_umount) {
-        send_unmountable(to);
+        queue_unmountable(to);
     }
 
     return success;
 }
 
-// FIX 2: Fix child mount restoration logic
-static bool mount_overlay_child(const std::string& mount_point, const std::string& relative,
-                                const std::vector<std::string>& module_roots,
-                                const std::string& stock_root, const std::string& mount_source,
-                                bool disable_umount, const std::vector<std::string>& partitions) {
+enum class ChildStrategy { Bind, Overlay, Skip };
+
+std::vector<std::string> child_mount_relatives(const std::string& target_root) {
+    std::vector<std::string> rels;
+    for (const auto& mount_point : get_child_mounts(target_root)) {
+        rels.push_back(mount_point.substr(target_root.size() + (target_root.back() != '/')));
+    }
+    return rels;
+}
+
+LayerPathIndex build_layer_index(const fs::path& layer, const std::vector<std::string>& rels) {
+    LayerPathIndex index;
+    int layer_fd = open(layer.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (layer_fd < 0) {
+        return index;
+    }
+    for (const auto& rel : rels) {
+        // Follows symlinks like the path lookup it replaces; dangling ones fail here
+        struct stat st;
+        if (fstatat(layer_fd, rel.c_str(), &st, 0) != 0) {
+            index.emplace(rel, 0);
+        } else {
+            index.emplace(rel, S_ISDIR(st.st_mode) ? 2 : 1);
+        }
+    }
+    close(layer_fd);
+    return index;
+}
+
+// Look up `rel` in one layer: 0 = absent, 1 = non-directory, 2 = directory
+static int probe_layer(const std::string& lower, const LayerPathIndex* index,
+                       const std::string& rel) {
+    // Child mounts that appeared after the plan was built were never indexed
+    if (index) {
+        auto it = index->find(rel);
+        if (it != index->end()) {
+            return it->second;
+        }
+    }
+
+    fs::path path = fs::path(lower) / rel;
+    if (fs::is_directory(path)) {
+        return 2;
+    }
+    return fs::exists(path) ? 1 : 0;
+}
+
+// Decide how a child mount under an overlay target is restored. For Overlay, `lower_dirs`
+// receives the module layers that provide `relative` as a directory.
+static ChildStrategy resolve_child_strategy(const std::string& mount_point,
+                                            const std::string& relative,
+                                            const std::vector<std::string>& module_roots,
+                                            const std::vector<LayerPathIndex>& layer_index,
+                                            const std::string& stock_root,
+                                            std::vector<std::string>& lower_dirs) {
+    std::string rel = relative.substr(1);  // Remove leading /
+    bool indexed = layer_index.size() == module_roots.size();
+
     // Check if any module modified this subpath
+    std::vector<int> probes(module_roots.size(), 0);
     bool has_modification = false;
-    for (const auto& lower : module_roots) {
-        fs::path path = fs::path(lower) / relative.substr(1);  // Remove leading /
-        if (fs::exists(path)) {
-            has_modification = true;
-            break;
-        }
+    for (size_t i = 0; i < module_roots.size(); ++i) {
+        probes[i] = probe_layer(module_roots[i], indexed ? &layer_index[i] : nullptr, rel);
+        has_modification |= probes[i] != 0;
     }
 
     if (!has_modification) {
         // No modification, directly bind mount original path
-        return bind_mount(stock_root, mount_point, disable_umount);
+        return ChildStrategy::Bind;
     }
 
     if (!fs::is_directory(stock_root)) {
-        return true;
+        return ChildStrategy::Skip;
     }
 
     // Collect lowerdirs for this subpath
-    std::vector<std::string> lower_dirs;
-    for (const auto& lower : module_roots) {
-        fs::path path = fs::path(lower) / relative.substr(1);
-        if (fs::is_directory(path)) {
-            lower_dirs.push_back(path.string());
-        } else if (fs::exists(path)) {
+    for (size_t i = 0; i < module_roots.size(); ++i) {
+        if (probes[i] == 2) {
+            lower_dirs.push_back((fs::path(module_roots[i]) / rel).string());
+        } else if (probes[i] == 1) {
             // File overwrites directory - overlay invalid
             // In this case, we should restore the original mount point, otherwise it
             // will be hidden
             LOG_WARN("File modification found at mount point " + mount_point +
                      ", falling back to bind mount");
-            return bind_mount(stock_root, mount_point, disable_umount);
+            lower_dirs.clear();
+            return ChildStrategy::Bind;
         }
     }
 
-    if (lower_dirs.empty()) {
-        // If no directory modification (only file modification or no modification),
-        // restore original mount
-        return bind_mount(stock_root, mount_point, disable_umount);
-    }
+    // If no directory modification (only file modification or no modification),
+    // restore original mount
+    return lower_dirs.empty() ? ChildStrategy::Bind : ChildStrategy::Overlay;
+}
 
-    // Build lowerdir string
+static std::string build_child_lowerdir(const std::vector<std::string>& lower_dirs,
+                                        const std::string& stock_root) {
     std::string lowerdir_config;
-    for (size_t i = 0; i < lower_dirs.size(); ++i) {
-        lowerdir_config += lower_dirs[i];
-        if (i < lower_dirs.size() - 1) {
-            lowerdir_config += ":";
-        }
+    for (const auto& dir : lower_dirs) {
+        lowerdir_config += dir;
+        lowerdir_config += ":";
     }
-    lowerdir_config += ":" + std::string(stock_root);
+    lowerdir_config += stock_root;
+    return lowerdir_config;
+}
+
+// FIX 2: Fix child mount restoration logic
+static bool mount_overlay_child(const std::string& mount_point, const std::string& relative,
+                                const std::vector<std::string>& module_roots,
+                                const std::vector<LayerPathIndex>& layer_index,
+                                const std::string& stock_root, const std::string& mount_source,
+                                bool disable_umount) {
+    std::vector<std::string> lower_dirs;
+    switch (resolve_child_strategy(mount_point, relative, module_roots, layer_index, stock_root,
+                                   lower_dirs)) {
+    case ChildStrategy::Skip:
+        return true;
+    case ChildStrategy::Bind:
+        return bind_mount(stock_root, mount_point, disable_umount);
+    case ChildStrategy::Overlay:
+        break;
+    }
+
+    std::string lowerdir_config = build_child_lowerdir(lower_dirs, stock_root);
 
     // Try modern API
     if (!mount_overlayfs_modern(lowerdir_config, std::nullopt, std::nullopt, mount_point,
@@ -300,16 +440,135 @@ static bool mount_overlay_child(const std::string& mount_point, const std::strin
     }
 
     if (!disable_umount) {
-        send_unmountable(mount_point);
+        queue_unmountable(mount_point);
     }
 
     return true;
 }
 
-bool mount_overlay(const std::string& target_root_raw, const std::vector<std::string>& module_roots,
-                   const std::string& mount_source, std::optional<fs::path> upperdir,
-                   std::optional<fs::path> workdir, bool disable_umount,
-                   const std::vector<std::string>& partitions) {
+enum class AssemblyResult { Attached, Failed, Unsupported };
+
+// Build the root overlay and every restored child mount as a detached mount tree, then
+// attach the whole tree to `target_root` with a single move_mount. On failure the tree is
+// discarded by closing its fds, so observers never see a partially assembled target.
+// Returns Unsupported when the kernel lacks the new mount API or cannot mount onto a
+// detached tree, in which case the caller falls back to in-place assembly. On Failed, errno
+// holds the cause.
+static AssemblyResult assemble_overlay_detached(const std::string& target_root,
+                                                const std::string& lowerdir_config,
+                                                const std::optional<std::string>& upperdir,
+                                                const std::optional<std::string>& workdir,
+                                                const std::vector<std::string>& mount_seq,
+                                                const std::vector<std::string>& module_roots,
+                                                const std::vector<LayerPathIndex>& layer_index,
+                                                const std::string& mirror_path,
+                                                const std::string& mount_source,
+                                                bool disable_umount) {
+    int tree_fd = create_overlay_fd(lowerdir_config, upperdir, workdir, mount_source);
+    if (tree_fd < 0) {
+        LOG_DEBUG("Detached overlay unavailable for " + target_root + ": " + strerror(errno));
+        return AssemblyResult::Unsupported;
+    }
+
+    std::vector<std::string> overlay_children;
+    std::vector<std::string> attached_children;
+    bool first_attach = true;
+
+    for (const auto& mount_point : mount_seq) {
+        std::string relative = mount_point;
+        if (mount_point.find(target_root) == 0) {
+            relative = mount_point.substr(target_root.length());
+        }
+        std::string source_path = mirror_path + relative;
+
+        std::vector<std::string> lower_dirs;
+        ChildStrategy strategy = resolve_child_strategy(mount_point, relative, module_roots,
+                                                        layer_index, source_path, lower_dirs);
+        if (strategy == ChildStrategy::Skip) {
+            continue;
+        }
+
+        int child_fd = -1;
+        if (strategy == ChildStrategy::Overlay) {
+            child_fd = create_overlay_fd(build_child_lowerdir(lower_dirs, source_path),
+                                         std::nullopt, std::nullopt, mount_source);
+            if (child_fd < 0) {
+                LOG_WARN("failed to overlay child " + mount_point + ", fallback to bind mount");
+                strategy = ChildStrategy::Bind;
+            }
+        }
+        if (child_fd < 0) {
+            child_fd = open_tree(AT_FDCWD, source_path.c_str(),
+                                 OPEN_TREE_CLONE | AT_RECURSIVE | OPEN_TREE_CLOEXEC);
+        }
+        if (child_fd < 0) {
+            int err = errno;
+            LOG_ERROR("Failed to prepare child mount " + mount_point + ": " + strerror(err));
+            close(tree_fd);
+            errno = err;
+            return AssemblyResult::Failed;
+        }
+
+        LOG_DEBUG("Staging child mount: " + mount_point + " from " + source_path);
+
+        // Mount point path relative to the detached root
+        std::string rel_path = relative.substr(1);
+        int ret = move_mount(child_fd, "", tree_fd, rel_path.c_str(), MOVE_MOUNT_F_EMPTY_PATH);
+        int err = errno;
+        close(child_fd);
+
+        if (ret < 0) {
+            close(tree_fd);
+            // Kernels without detached-tree support reject the very first attach
+            if (first_attach && err == EINVAL) {
+                LOG_DEBUG("Kernel cannot mount onto detached trees, using in-place assembly");
+                return AssemblyResult::Unsupported;
+            }
+            LOG_ERROR("Failed to stage child mount " + mount_point + ": " + strerror(err));
+            errno = err;
+            return AssemblyResult::Failed;
+        }
+        first_attach = false;
+
+        attached_children.push_back(mount_point);
+        if (strategy == ChildStrategy::Overlay) {
+            overlay_children.push_back(mount_point);
+        }
+    }
+
+    // Publish the fully assembled tree in one step
+    if (move_mount(tree_fd, "", AT_FDCWD, target_root.c_str(), MOVE_MOUNT_F_EMPTY_PATH) < 0) {
+        int err = errno;
+        LOG_ERROR("Failed to attach overlay tree at " + target_root + ": " + strerror(err));
+        close(tree_fd);
+        errno = err;
+        return AssemblyResult::Failed;
+    }
+    close(tree_fd);
+
+    // HymoFS: Hide overlay xattrs for the attached overlays
+    HymoFS::hide_overlay_xattrs(target_root);
+    for (const auto& mount_point : overlay_children) {
+        HymoFS::hide_overlay_xattrs(mount_point);
+    }
+
+    if (!disable_umount) {
+        queue_unmountable(target_root);
+        for (const auto& mount_point : attached_children) {
+            queue_unmountable(mount_point);
+        }
+    }
+
+    LOG_DEBUG("Attached overlay tree at " + target_root + " with " +
+              std::to_string(attached_children.size()) + " child mounts");
+    return AssemblyResult::Attached;
+}
+
+int mount_overlay(const std::string& target_root_raw, const std::vector<std::string>& module_roots,
+                  const std::string& mount_source, std::optional<fs::path> upperdir,
+                  std::optional<fs::path> workdir, bool disable_umount,
+                  const std::vector<std::string>& partitions,
+                  const std::vector<LayerPathIndex>& layer_index) {
     std::string target_root = target_root_raw;
     try {
         if (fs::exists(target_root_raw)) {
@@ -328,6 +587,8 @@ bool mount_overlay(const std::string& target_root_raw, const std::vector<std::st
     // 1. Bind mount target_root (recursively) to a private mirror location.
     // 2. Use the mirror as the lowerdir base.
     // 3. Restore child mounts by binding from the mirror.
+    // 4. Assemble root + children detached and attach them in one move_mount; the
+    //    in-place sequence below is only used when the kernel cannot do that.
 
     std::string mirror_path = get_mirror_path(target_root);
 
@@ -342,8 +603,9 @@ bool mount_overlay(const std::string& target_root_raw, const std::vector<std::st
     // Bind mount target to mirror (Recursive is KEY to seeing child mounts)
     // We use MS_REC to ensure we capture all sub-mounts (vendor, product, etc.)
     if (mount(target_root.c_str(), mirror_path.c_str(), nullptr, MS_BIND | MS_REC, nullptr) != 0) {
-        LOG_ERROR("Failed to create mirror for " + target_root + ": " + strerror(errno));
-        return false;
+        int err = errno;
+        LOG_ERROR("Failed to create mirror for " + target_root + ": " + strerror(err));
+        return err ? err : EIO;
     }
     // Make mirror private so our changes don't propagate back
     mount(nullptr, mirror_path.c_str(), nullptr, MS_PRIVATE, nullptr);
@@ -380,6 +642,21 @@ bool mount_overlay(const std::string& target_root_raw, const std::vector<std::st
         workdir_str = workdir->string();
     }
 
+    // Preferred: assemble everything detached and attach atomically
+    AssemblyResult assembly =
+        assemble_overlay_detached(target_root, lowerdir_config, upperdir_str, workdir_str,
+                                  mount_seq, module_roots, layer_index, mirror_path,
+                                  mount_source, disable_umount);
+    if (assembly == AssemblyResult::Attached) {
+        return 0;
+    }
+    if (assembly == AssemblyResult::Failed) {
+        // Nothing was attached; the detached tree is already gone
+        int err = errno;
+        umount2(mirror_path.c_str(), MNT_DETACH);
+        return err ? err : EIO;
+    }
+
     // Mount root overlay
     bool success = mount_overlayfs_modern(lowerdir_config, upperdir_str, workdir_str, target_root,
                                           mount_source);
@@ -390,19 +667,21 @@ bool mount_overlay(const std::string& target_root_raw, const std::vector<std::st
     }
 
     if (!success) {
-        LOG_ERROR("mount overlayfs for root " + target_root + " failed: " + strerror(errno));
+        int err = errno;
+        LOG_ERROR("mount overlayfs for root " + target_root + " failed: " + strerror(err));
         // Cleanup mirror
         umount2(mirror_path.c_str(), MNT_DETACH);
-        return false;
+        return err ? err : EIO;
     }
 
     if (!disable_umount) {
-        send_unmountable(target_root);
+        queue_unmountable(target_root);
     }
 
     // Restore child mounts using the MIRROR as source
     // If any child mount fails, we revert the entire overlay to prevent inconsistent state
     bool child_mount_failed = false;
+    int child_errno = 0;
     std::string failed_mount_point;
 
     for (const auto& mount_point : mount_seq) {
@@ -417,8 +696,9 @@ bool mount_overlay(const std::string& target_root_raw, const std::vector<std::st
 
         LOG_DEBUG("Restoring child mount: " + mount_point + " from " + source_path);
 
-        if (!mount_overlay_child(mount_point, relative, module_roots, source_path, mount_source,
-                                 disable_umount, partitions)) {
+        if (!mount_overlay_child(mount_point, relative, module_roots, layer_index, source_path,
+                                 mount_source, disable_umount)) {
+            child_errno = errno;
             LOG_ERROR("Failed to restore child mount " + mount_point + ", reverting overlay");
             child_mount_failed = true;
             failed_mount_point = mount_point;
@@ -435,10 +715,10 @@ bool mount_overlay(const std::string& target_root_raw, const std::vector<std::st
         }
         // Cleanup mirror
         umount2(mirror_path.c_str(), MNT_DETACH);
-        return false;
+        return child_errno ? child_errno : EIO;
     }
 
-    return true;
+    return 0;
 }
 
 }  // namespace hymo
\ No newline at end of file
@@ -4,19 +4,48 @@
 #include <filesystem>
 #include <optional>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 namespace fs = std::filesystem;
 
 namespace hymo {
 
-// Mount overlayfs on target with given lowerdirs
-bool mount_overlay(const std::string &target_root,
-                   const std::vector<std::string> &module_roots,
-                   const std::string &mount_source,
-                   std::optional<fs::path> upperdir,
-                   std::optional<fs::path> workdir, bool disable_umount,
-                   const std::vector<std::string> &partitions = {});
+// Probe results for the paths indexed in one layer (relative to the layer root, no leading
+// '/'): 0 = absent or a dangling symlink, 1 = non-directory, 2 = directory. Paths that were
+// not indexed have no entry and are looked up on disk.
+using LayerPathIndex = std::unordered_map<std::string, int>;
+
+// Child mounts below target_root, relative to it without a leading '/'. These are the only
+// paths mount_overlay() looks up in the layers.
+std::vector<std::string> child_mount_relatives(const std::string &target_root);
+
+// Index `rels` in one layer, absent paths included
+LayerPathIndex build_layer_index(const fs::path &layer,
+                                 const std::vector<std::string> &rels);
+
+// Mount overlayfs on target with given lowerdirs. When `layer_index` is parallel to
+// `module_roots`, child mounts it covers are resolved from it instead of path lookups.
+// Returns 0 on success, otherwise the errno of the step that failed.
+int mount_overlay(const std::string &target_root,
+                  const std::vector<std::string> &module_roots,
+                  const std::string &mount_source,
+                  std::optional<fs::path> upperdir,
+                  std::optional<fs::path> workdir, bool disable_umount,
+                  const std::vector<std::string> &partitions = {},
+                  const std::vector<LayerPathIndex> &layer_index = {});
+
+// Mounts mount_overlay() leaves on target_root: the overlay itself plus one per child
+// mount it has to restore on top
+int predict_overlay_mounts(const std::string &target_root);
+
+// True if something other than mount_overlay() mounted below the overlay on target_root,
+// such as magic mount binds or another tool's skeleton. Detaching the overlay would take
+// those down with it.
+bool has_foreign_child_mounts(const std::string &target_root);
+
+// Mount points of the overlays that use a lowerdir at or below `dir`, sorted
+std::vector<std::string> overlays_with_layers_in(const fs::path &dir);
 
 // Bind mount helper
 bool bind_mount(const fs::path &from, const fs::path &to, bool disable_umount);
@@ -1,52 +1,352 @@
 // utils.cpp - Utility functions implementation
 #include "utils.hpp"
+#include <dirent.h>
 #include <fcntl.h>
+#include <linux/fs.h>
 #include <linux/loop.h>
 #include <sys/ioctl.h>
 #include <sys/mount.h>
 #include <sys/prctl.h>
+#include <sys/sendfile.h>
 #include <sys/stat.h>
 #include <sys/syscall.h>
+#include <sys/sysmacros.h>
+#include <sys/vfs.h>
 #include <sys/xattr.h>
+#include <pthread.h>
 #include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <csignal>
 #include <cstring>
 #include <ctime>
 #include <fstream>
 #include <iostream>
+#include <map>
+#include <mutex>
 #include <set>
 #include <sstream>
 #include "defs.hpp"
+#include "mount/mount_utils.hpp"
+
+#ifndef FICLONE
+#define FICLONE _IOW(0x94, 9, int)
+#endif // #ifndef FICLONE
+
+#ifndef LO_FLAGS_DIRECT_IO
+#define LO_FLAGS_DIRECT_IO 16
+#endif // #ifndef LO_FLAGS_DIRECT_IO
+
+#ifndef LOOP_SET_DIRECT_IO
+#define LOOP_SET_DIRECT_IO 0x4C08
+#endif // #ifndef LOOP_SET_DIRECT_IO
+
+#ifndef LOOP_CONFIGURE
+// Linux 5.8+, absent from older uapi headers
+#define LOOP_CONFIGURE 0x4C0A
+struct loop_config {
+    __u32 fd;
+    __u32 block_size;
+    struct loop_info64 info;
+    __u64 __reserved[8];
+};
+#endif // #ifndef LOOP_CONFIGURE
+
+#ifndef EXT4_IOC_RESIZE_FS
+#define EXT4_IOC_RESIZE_FS _IOW('f', 16, uint64_t)
+#endif // #ifndef EXT4_IOC_RESIZE_FS
 
 namespace hymo {
 
 // Logger implementation
+
+// Bounded multi-producer queue: a producer claims a slot with one CAS on `tail` and
+// publishes it through the slot's sequence number, so logging threads never take a lock.
+struct Logger::Ring {
+    static constexpr size_t CAPACITY = 1024;  // Power of two
+
+    struct Slot {
+        std::atomic<size_t> seq{0};
+        LogLevel level = LogLevel::INFO;
+        time_t time = 0;
+        std::string message;
+    };
+
+    std::unique_ptr<Slot[]> slots{new Slot[CAPACITY]};
+    alignas(64) std::atomic<size_t> tail{0};
+    alignas(64) std::atomic<size_t> head{0};
+    std::atomic<bool> running{false};
+    std::atomic<bool> writer_idle{false};
+    std::mutex wake_mutex;
+    std::condition_variable wake;
+
+    Ring() {
+        for (size_t i = 0; i < CAPACITY; ++i) {
+            slots[i].seq.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    bool push(LogLevel level, time_t time, std::string& message) {
+        size_t pos = tail.load(std::memory_order_relaxed);
+        for (;;) {
+            Slot& slot = slots[pos & (CAPACITY - 1)];
+            size_t seq = slot.seq.load(std::memory_order_acquire);
+            auto diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+            if (diff == 0) {
+                if (tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    slot.level = level;
+                    slot.time = time;
+                    slot.message = std::move(message);
+                    slot.seq.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false;  // Full
+            } else {
+                pos = tail.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    bool pop(LogLevel& level, time_t& time, std::string& message) {
+        size_t pos = head.load(std::memory_order_relaxed);
+        for (;;) {
+            Slot& slot = slots[pos & (CAPACITY - 1)];
+            size_t seq = slot.seq.load(std::memory_order_acquire);
+            auto diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + 1);
+            if (diff == 0) {
+                if (head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    level = slot.level;
+                    time = slot.time;
+                    message = std::move(slot.message);
+                    slot.seq.store(pos + CAPACITY, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false;  // Empty
+            } else {
+                pos = head.load(std::memory_order_relaxed);
+            }
+        }
+    }
+};
+
+static const char* level_name(LogLevel level) {
+    switch (level) {
+    case LogLevel::ERROR:
+        return "ERROR";
+    case LogLevel::WARN:
+        return "WARN";
+    case LogLevel::INFO:
+        return "INFO";
+    case LogLevel::DEBUG:
+        return "DEBUG";
+    case LogLevel::VERBOSE:
+    default:
+        return "VERBOSE";
+    }
+}
+
+static void write_all(int fd, const std::string& data) {
+    const char* p = data.data();
+    size_t left = data.size();
+    while (left > 0) {
+        ssize_t n = write(fd, p, left);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return;
+        }
+        p += n;
+        left -= static_cast<size_t>(n);
+    }
+}
+
+static void flush_on_fatal_signal(int sig) {
+    Logger::getInstance().flush();
+    // SA_RESETHAND restored the default action
+    raise(sig);
+}
+
 Logger& Logger::getInstance() {
     static Logger instance;
     return instance;
 }
 
-void Logger::init(bool debug, bool verbose, const fs::path& log_path) {
-    debug_ = debug || verbose;
-    verbose_ = verbose;
-    (void)log_path;
-    log_file_.reset();
+Logger::~Logger() {
+    stop_writer();
 }
 
-void Logger::log(const std::string& level, const std::string& message) {
-    if (level == "VERBOSE" && !verbose_) {
+void Logger::init(bool debug, bool verbose, const fs::path& log_path) {
+    LogLevel max_level = verbose ? LogLevel::VERBOSE : debug ? LogLevel::DEBUG : LogLevel::INFO;
+    max_level_.store(static_cast<int>(max_level), std::memory_order_relaxed);
+
+    stop_writer();
+    if (log_path.empty()) {
         return;
     }
-    if (level == "DEBUG" && !debug_) {
+
+    std::error_code ec;
+    fs::create_directories(log_path.parent_path(), ec);
+    int fd = open(log_path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        LOG_WARN("Cannot open log file " + log_path.string() + ": " + strerror(errno));
         return;
     }
+    start_writer(fd);
+}
+
+void Logger::start_writer(int fd) {
+    // The mount wrapper already redirects stderr into the log file; don't write lines twice
+    struct stat file_st, err_st;
+    echo_stderr_ = !(fstat(fd, &file_st) == 0 && fstat(STDERR_FILENO, &err_st) == 0 &&
+                     file_st.st_dev == err_st.st_dev && file_st.st_ino == err_st.st_ino);
+    file_fd_ = fd;
+
+    static std::once_flag hooks_installed;
+    std::call_once(hooks_installed, [] {
+        // A forked child has no writer thread: it logs synchronously, and must not inherit
+        // the output lock mid-write
+        pthread_atfork([] { getInstance().write_mutex_.lock(); },
+                       [] { getInstance().write_mutex_.unlock(); },
+                       [] {
+                           Logger& logger = getInstance();
+                           if (logger.ring_) {
+                               logger.ring_->running.store(false);
+                           }
+                           // Only the parent's thread handle; nothing to join here
+                           (void)logger.writer_.release();
+                           logger.write_mutex_.unlock();
+                       });
+
+        struct sigaction sa = {};
+        sa.sa_handler = flush_on_fatal_signal;
+        sa.sa_flags = SA_RESETHAND;
+        for (int sig : {SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGABRT}) {
+            sigaction(sig, &sa, nullptr);
+        }
+    });
+
+    if (!ring_) {
+        ring_ = std::make_unique<Ring>();
+    }
+    ring_->running.store(true, std::memory_order_release);
+    writer_ = std::make_unique<std::thread>(&Logger::writer_loop, this);
+}
+
+void Logger::stop_writer() {
+    if (writer_) {
+        ring_->running.store(false, std::memory_order_release);
+        ring_->wake.notify_one();
+        writer_->join();
+        writer_.reset();
+    }
+    flush();
+    if (file_fd_ >= 0) {
+        close(file_fd_);
+        file_fd_ = -1;
+    }
+    echo_stderr_ = true;
+}
 
-    auto now = std::time(nullptr);
-    char time_buf[64];
-    std::strftime(time_buf, sizeof(time_buf), "%Y-%m-%d %H:%M:%S", std::localtime(&now));
+void Logger::writer_loop() {
+    for (;;) {
+        bool running = ring_->running.load(std::memory_order_acquire);
+        {
+            std::lock_guard<std::mutex> lock(write_mutex_);
+            drain();
+        }
+        if (!running) {
+            return;
+        }
+        // Producers only signal an idle writer; the timeout bounds a missed wakeup
+        std::unique_lock<std::mutex> lock(ring_->wake_mutex);
+        ring_->writer_idle.store(true);
+        ring_->wake.wait_for(lock, std::chrono::milliseconds(50));
+        ring_->writer_idle.store(false);
+    }
+}
 
-    std::string log_line = std::string("[") + time_buf + "] [" + level + "] " + message + "\n";
+void Logger::log(LogLevel level, std::string message) {
+    time_t now = std::time(nullptr);
+    if (ring_) {
+        while (ring_->running.load(std::memory_order_acquire)) {
+            if (ring_->push(level, now, message)) {
+                if (ring_->writer_idle.load(std::memory_order_relaxed)) {
+                    ring_->wake.notify_one();
+                }
+                return;
+            }
+            // Full: let the writer catch up rather than drop records
+            ring_->wake.notify_one();
+            std::this_thread::yield();
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(write_mutex_);
+    std::string line;
+    format_record(level, now, message, line);
+    emit(line);
+}
+
+void Logger::flush() {
+    if (!ring_) {
+        return;
+    }
+    // Bounded wait: a fatal signal may arrive while this thread or the writer holds the lock
+    std::unique_lock<std::mutex> lock(write_mutex_, std::defer_lock);
+    for (int i = 0; i < 1000 && !lock.try_lock(); ++i) {
+        usleep(1000);
+    }
+    if (lock.owns_lock()) {
+        drain();
+    }
+}
+
+void Logger::drain() {
+    std::string batch;
+    LogLevel level;
+    time_t time;
+    std::string message;
+    while (ring_->pop(level, time, message)) {
+        format_record(level, time, message, batch);
+        if (batch.size() >= 64 * 1024) {
+            emit(batch);
+            batch.clear();
+        }
+    }
+    if (!batch.empty()) {
+        emit(batch);
+    }
+}
+
+void Logger::format_record(LogLevel level, time_t time, const std::string& message,
+                           std::string& out) {
+    // Records arrive in bursts within the same second; format the timestamp once for them
+    if (time != time_cached_) {
+        struct tm tm_now;
+        localtime_r(&time, &tm_now);
+        std::strftime(time_buf_, sizeof(time_buf_), "%Y-%m-%d %H:%M:%S", &tm_now);
+        time_cached_ = time;
+    }
+    out += '[';
+    out += time_buf_;
+    out += "] [";
+    out += level_name(level);
+    out += "] ";
+    out += message;
+    out += '\n';
+}
 
-    std::cerr << log_line;
+void Logger::emit(const std::string& data) {
+    if (file_fd_ >= 0) {
+        write_all(file_fd_, data);
+    }
+    if (echo_stderr_ || file_fd_ < 0) {
+        write_all(STDERR_FILENO, data);
+    }
 }
 
 // File system utilities
@@ -83,6 +383,21 @@ std::string lgetfilecon(const fs::path& path) {
     return DEFAULT_SELINUX_CONTEXT;
 }
 
+bool try_lgetfilecon(const fs::path& path, std::string& context) {
+#ifdef __ANDROID__
+    char buf[256];
+    ssize_t len = lgetxattr(path.c_str(), SELINUX_XATTR, buf, sizeof(buf));
+    if (len > 0) {
+        // The stored label may carry a trailing NUL
+        context.assign(buf, buf[len - 1] == '\0' ? len - 1 : len);
+        return true;
+    }
+#endif // #ifdef __ANDROID__
+    (void)path;
+    (void)context;
+    return false;
+}
+
 // Get appropriate SELinux context based on path
 // /vendor and /odm paths should use vendor_file context
 std::string get_context_for_path(const fs::path& path) {
@@ -122,12 +437,16 @@ bool is_xattr_supported(const fs::path& path) {
     }
 }
 
-bool mount_tmpfs(const fs::path& target) {
+bool mount_tmpfs(const fs::path& target, uint64_t size_bytes) {
     if (!ensure_dir_exists(target)) {
         return false;
     }
 
-    if (mount("tmpfs", target.c_str(), "tmpfs", 0, "mode=0755") != 0) {
+    std::string options = "mode=0755";
+    if (size_bytes > 0) {
+        options += ",size=" + std::to_string(size_bytes);
+    }
+    if (mount("tmpfs", target.c_str(), "tmpfs", 0, options.c_str()) != 0) {
         LOG_ERROR("Failed to mount tmpfs at " + target.string() + ": " + strerror(errno));
         return false;
     }
@@ -172,6 +491,31 @@ bool is_erofs_supported() {
 }
 
 // Loop device helpers
+
+// Block size of the filesystem inside an image (ext4 or EROFS), capped at the page size as
+// loop devices require. 512 when unknown, which every filesystem accepts.
+static __u32 image_block_size(int file_fd) {
+    unsigned char sb[128];
+    if (pread(file_fd, sb, sizeof(sb), 1024) != static_cast<ssize_t>(sizeof(sb))) {
+        return 512;
+    }
+
+    uint32_t size = 512;
+    uint32_t erofs_magic = sb[0] | sb[1] << 8 | sb[2] << 16 | static_cast<uint32_t>(sb[3]) << 24;
+    if (erofs_magic == 0xE0F5E1E2 && sb[12] >= 9 && sb[12] <= 16) {
+        size = 1u << sb[12];
+    } else if ((sb[56] | sb[57] << 8) == 0xEF53 && sb[24] <= 6) {
+        // ext2/3/4: s_log_block_size counts from 1K
+        size = 1024u << sb[24];
+    }
+
+    long page = sysconf(_SC_PAGESIZE);
+    if (page > 0 && size > static_cast<uint32_t>(page)) {
+        size = static_cast<uint32_t>(page);
+    }
+    return size;
+}
+
 static int setup_loop_device(const std::string& image_path, std::string& loop_path,
                              bool read_only) {
     int control_fd = open("/dev/loop-control", O_RDWR | O_CLOEXEC);
@@ -215,13 +559,31 @@ static int setup_loop_device(const std::string& image_path, std::string& loop_pa
         return -1;
     }
 
-    int file_fd = open(image_path.c_str(), read_only ? O_RDONLY : O_RDWR | O_CLOEXEC);
+    int file_fd = open(image_path.c_str(), (read_only ? O_RDONLY : O_RDWR) | O_CLOEXEC);
     if (file_fd < 0) {
         LOG_ERROR("Failed to open image " + image_path + ": " + strerror(errno));
         close(loop_fd);
         return -1;
     }
 
+    // One ioctl binds, flags and sizes the device. Direct I/O keeps the image's pages out of
+    // the page cache a second time; the kernel quietly drops it if the backing file cannot
+    // do aligned direct I/O at this block size.
+    struct loop_config config;
+    memset(&config, 0, sizeof(config));
+    config.fd = static_cast<__u32>(file_fd);
+    config.block_size = image_block_size(file_fd);
+    config.info.lo_flags = LO_FLAGS_AUTOCLEAR | LO_FLAGS_DIRECT_IO;
+    if (read_only)
+        config.info.lo_flags |= LO_FLAGS_READ_ONLY;
+
+    if (ioctl(loop_fd, LOOP_CONFIGURE, &config) == 0) {
+        close(file_fd);
+        return loop_fd;
+    }
+    LOG_DEBUG("LOOP_CONFIGURE unavailable (" + std::string(strerror(errno)) +
+              "), using LOOP_SET_FD");
+
     if (ioctl(loop_fd, LOOP_SET_FD, file_fd) < 0) {
         LOG_ERROR("Failed to bind loop device: " + std::string(strerror(errno)));
         close(file_fd);
@@ -243,6 +605,9 @@ static int setup_loop_device(const std::string& image_path, std::string& loop_pa
         return -1;
     }
 
+    // Best effort on 4.4+; older kernels just keep buffered I/O
+    ioctl(loop_fd, LOOP_SET_DIRECT_IO, 1UL);
+
     return loop_fd;
 }
 
@@ -307,9 +672,8 @@ bool mount_image(const fs::path& image_path, const fs::path& target, const std::
         source = image_path.string();
     }
 
-    int ret = mount(source.c_str(), target.c_str(), fs_type.c_str(), flags, data.c_str());
-
-    if (ret != 0) {
+    // A fresh loop node or a target still being set up by init can be briefly unusable
+    if (!mount_with_retry(source.c_str(), target.c_str(), fs_type.c_str(), flags, data.c_str())) {
         LOG_ERROR("mount failed: " + std::string(strerror(errno)) + " (src=" + source +
                   ", tgt=" + target.string() + ", type=" + fs_type + ")");
         if (loop_fd >= 0) {
@@ -348,6 +712,347 @@ bool repair_image(const fs::path& image_path) {
     return false;
 }
 
+// Device node of a block device number, e.g. the loop device behind a mount
+static std::string block_device_path(dev_t dev) {
+    std::ifstream uevent("/sys/dev/block/" + std::to_string(major(dev)) + ":" +
+                         std::to_string(minor(dev)) + "/uevent");
+    std::string line;
+    while (std::getline(uevent, line)) {
+        if (line.compare(0, 8, "DEVNAME=") == 0) {
+            std::string name = line.substr(8);
+            for (const char* dir : {"/dev/block/", "/dev/"}) {
+                if (access((dir + name).c_str(), F_OK) == 0) {
+                    return dir + name;
+                }
+            }
+        }
+    }
+    return "";
+}
+
+bool grow_mounted_image(const fs::path& image_path, const fs::path& mount_point,
+                        uint64_t size_bytes) {
+    struct stat img_st;
+    if (stat(image_path.c_str(), &img_st) != 0) {
+        return false;
+    }
+    uint64_t old_size = static_cast<uint64_t>(img_st.st_size);
+    if (old_size >= size_bytes) {
+        return true;
+    }
+    LOG_INFO("Growing " + image_path.filename().string() + " from " +
+             std::to_string(old_size >> 20) + "M to " + std::to_string(size_bytes >> 20) + "M");
+
+    struct stat mnt_st;
+    if (stat(mount_point.c_str(), &mnt_st) != 0) {
+        return false;
+    }
+    std::string loop_dev = block_device_path(mnt_st.st_dev);
+    if (loop_dev.empty()) {
+        LOG_WARN("No block device found behind " + mount_point.string());
+        return false;
+    }
+
+    int img_fd = open(image_path.c_str(), O_WRONLY | O_CLOEXEC);
+    if (img_fd < 0) {
+        return false;
+    }
+    // Reserve the new space up front so the loop device never hits ENOSPC mid-write
+    bool extended = fallocate(img_fd, 0, 0, static_cast<off_t>(size_bytes)) == 0 ||
+                    ((errno == EOPNOTSUPP || errno == ENOSYS) &&
+                     ftruncate(img_fd, static_cast<off_t>(size_bytes)) == 0);
+    close(img_fd);
+    if (!extended) {
+        LOG_ERROR("Failed to extend image: " + std::string(strerror(errno)));
+        return false;
+    }
+
+    int loop_fd = open(loop_dev.c_str(), O_RDONLY | O_CLOEXEC);
+    if (loop_fd < 0 || ioctl(loop_fd, LOOP_SET_CAPACITY, 0) != 0) {
+        LOG_ERROR("Failed to refresh loop capacity of " + loop_dev + ": " + strerror(errno));
+        if (loop_fd >= 0) {
+            close(loop_fd);
+        }
+        return false;
+    }
+    close(loop_fd);
+
+    int dir_fd = open(mount_point.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dir_fd < 0) {
+        return false;
+    }
+    struct statfs sfs;
+    bool resized = false;
+    if (fstatfs(dir_fd, &sfs) == 0 && sfs.f_bsize > 0) {
+        uint64_t blocks = size_bytes / static_cast<uint64_t>(sfs.f_bsize);
+        resized = ioctl(dir_fd, EXT4_IOC_RESIZE_FS, &blocks) == 0;
+    }
+    close(dir_fd);
+
+    if (!resized) {
+        // Older kernels lack the ioctl; resize2fs falls back to group-by-group growth
+        LOG_DEBUG("EXT4_IOC_RESIZE_FS failed (" + std::string(strerror(errno)) +
+                  "), trying resize2fs");
+        std::string cmd = "resize2fs " + loop_dev + " >/dev/null 2>&1";
+        int ret = system(cmd.c_str());
+        resized = WIFEXITED(ret) && WEXITSTATUS(ret) == 0;
+    }
+    if (!resized) {
+        LOG_ERROR("Online resize of " + mount_point.string() + " failed");
+    }
+    return resized;
+}
+
+// Copy engine: data moves fd-to-fd with the cheapest primitive the filesystem pair
+// supports. The first method that works for a (src dev, dst dev) pair is remembered so
+// later files skip the probing.
+enum class CopyMethod { Clone, CopyFileRange, Sendfile, ReadWrite };
+
+static std::mutex g_copy_method_mutex;
+static std::map<std::pair<dev_t, dev_t>, CopyMethod> g_copy_methods;
+
+static CopyMethod cached_copy_method(dev_t src_dev, dev_t dst_dev) {
+    std::lock_guard<std::mutex> lock(g_copy_method_mutex);
+    auto it = g_copy_methods.find({src_dev, dst_dev});
+    return it != g_copy_methods.end() ? it->second : CopyMethod::Clone;
+}
+
+static void demote_copy_method(dev_t src_dev, dev_t dst_dev, CopyMethod next) {
+    std::lock_guard<std::mutex> lock(g_copy_method_mutex);
+    auto& method = g_copy_methods[{src_dev, dst_dev}];
+    if (method < next) {
+        method = next;
+    }
+}
+
+static const char* copy_method_name(CopyMethod method) {
+    switch (method) {
+    case CopyMethod::Clone:
+        return "reflink";
+    case CopyMethod::CopyFileRange:
+        return "copy_file_range";
+    case CopyMethod::Sendfile:
+        return "sendfile";
+    case CopyMethod::ReadWrite:
+        return "read/write";
+    }
+    return "unknown";
+}
+
+// Errors that mean "this primitive cannot do this pair", as opposed to I/O failures
+static bool is_unsupported_copy_error(int err) {
+    return err == EXDEV || err == EINVAL || err == ENOSYS || err == EOPNOTSUPP ||
+           err == ENOTTY || err == EBADF || err == ETXTBSY;
+}
+
+// Returns bytes copied, or -1 with errno set
+static ssize_t copy_data(CopyMethod method, int src_fd, int dst_fd, off_t size) {
+    off_t done = 0;
+    switch (method) {
+    case CopyMethod::Clone:
+        if (ioctl(dst_fd, FICLONE, src_fd) != 0) {
+            return -1;
+        }
+        return size;
+    case CopyMethod::CopyFileRange:
+#ifdef __NR_copy_file_range
+        while (done < size) {
+            ssize_t n = syscall(__NR_copy_file_range, src_fd, nullptr, dst_fd, nullptr,
+                                static_cast<size_t>(size - done), 0);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n < 0) {
+                return done ? done : -1;
+            }
+            if (n == 0) {
+                break;
+            }
+            done += n;
+        }
+        return done;
+#else
+        errno = ENOSYS;
+        return -1;
+#endif // #ifdef __NR_copy_file_range
+    case CopyMethod::Sendfile:
+        while (done < size) {
+            ssize_t n = sendfile(dst_fd, src_fd, nullptr, static_cast<size_t>(size - done));
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n < 0) {
+                return done ? done : -1;
+            }
+            if (n == 0) {
+                break;
+            }
+            done += n;
+        }
+        return done;
+    case CopyMethod::ReadWrite: {
+        std::vector<char> buf(1024 * 1024);
+        while (true) {
+            ssize_t n = read(src_fd, buf.data(), buf.size());
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n < 0) {
+                return -1;
+            }
+            if (n == 0) {
+                break;
+            }
+            for (ssize_t off = 0; off < n;) {
+                ssize_t w = write(dst_fd, buf.data() + off, static_cast<size_t>(n - off));
+                if (w < 0 && errno == EINTR) {
+                    continue;
+                }
+                if (w < 0) {
+                    return -1;
+                }
+                off += w;
+            }
+            done += n;
+        }
+        return done;
+    }
+    }
+    errno = EINVAL;
+    return -1;
+}
+
+// Carry xattrs across; the SELinux label is assigned by the caller instead
+static void copy_xattrs_fd(int src_fd, int dst_fd) {
+    ssize_t list_len = flistxattr(src_fd, nullptr, 0);
+    if (list_len <= 0) {
+        return;
+    }
+    std::vector<char> names(static_cast<size_t>(list_len));
+    list_len = flistxattr(src_fd, names.data(), names.size());
+    if (list_len <= 0) {
+        return;
+    }
+
+    std::vector<char> value;
+    for (ssize_t off = 0; off < list_len;) {
+        const char* name = names.data() + off;
+        off += static_cast<ssize_t>(strlen(name)) + 1;
+        if (strcmp(name, SELINUX_XATTR) == 0) {
+            continue;
+        }
+        ssize_t len = fgetxattr(src_fd, name, nullptr, 0);
+        if (len < 0) {
+            continue;
+        }
+        value.resize(static_cast<size_t>(len));
+        len = fgetxattr(src_fd, name, value.data(), value.size());
+        if (len >= 0 && fsetxattr(dst_fd, name, value.data(), static_cast<size_t>(len), 0) != 0) {
+            LOG_VERBOSE("xattr " + std::string(name) + " not copied: " + strerror(errno));
+        }
+    }
+}
+
+static bool copy_regular_file(const fs::path& src, const fs::path& dst, const struct stat& st) {
+    int src_fd = open(src.c_str(), O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+    if (src_fd < 0) {
+        LOG_ERROR("copy: cannot open " + src.string() + ": " + strerror(errno));
+        return false;
+    }
+
+    // Replace rather than truncate, so hardlinked copies elsewhere are never written through
+    if (unlink(dst.c_str()) != 0 && errno != ENOENT) {
+        std::error_code ec;
+        fs::remove_all(dst, ec);
+    }
+    int dst_fd = open(dst.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, st.st_mode & 07777);
+    if (dst_fd < 0) {
+        LOG_ERROR("copy: cannot create " + dst.string() + ": " + strerror(errno));
+        close(src_fd);
+        return false;
+    }
+
+    struct stat dst_st;
+    fstat(dst_fd, &dst_st);
+
+    bool ok = st.st_size == 0;
+    for (CopyMethod method = cached_copy_method(st.st_dev, dst_st.st_dev); !ok;) {
+        ssize_t n = copy_data(method, src_fd, dst_fd, st.st_size);
+        if (n == st.st_size) {
+            ok = true;
+            break;
+        }
+        int err = errno;
+        if (n > 0 || method == CopyMethod::ReadWrite || !is_unsupported_copy_error(err)) {
+            LOG_ERROR("copy: " + src.string() + " -> " + dst.string() + " failed: " +
+                      strerror(err));
+            break;
+        }
+        method = static_cast<CopyMethod>(static_cast<int>(method) + 1);
+        demote_copy_method(st.st_dev, dst_st.st_dev, method);
+        LOG_VERBOSE("copy: falling back to " + std::string(copy_method_name(method)) + " for " +
+                    src.string());
+    }
+
+    if (ok) {
+        if (fchown(dst_fd, st.st_uid, st.st_gid) != 0) {
+            LOG_VERBOSE("copy: fchown failed for " + dst.string());
+        }
+        fchmod(dst_fd, st.st_mode & 07777);
+        copy_xattrs_fd(src_fd, dst_fd);
+#ifdef __ANDROID__
+        std::string context = get_context_for_path(dst);
+        fsetxattr(dst_fd, SELINUX_XATTR, context.c_str(), context.length(), 0);
+#endif // #ifdef __ANDROID__
+    }
+
+    close(src_fd);
+    close(dst_fd);
+    if (!ok) {
+        unlink(dst.c_str());
+    }
+    return ok;
+}
+
+bool copy_node(const fs::path& src, const fs::path& dst) {
+    struct stat st;
+    if (lstat(src.c_str(), &st) != 0) {
+        LOG_ERROR("copy: cannot stat " + src.string() + ": " + strerror(errno));
+        return false;
+    }
+
+    if (S_ISREG(st.st_mode)) {
+        return copy_regular_file(src, dst, st);
+    }
+
+    if (!S_ISLNK(st.st_mode)) {
+        LOG_WARN("copy: skipping special file " + src.string());
+        return true;
+    }
+
+    std::vector<char> target(static_cast<size_t>(st.st_size) + 1);
+    ssize_t len = readlink(src.c_str(), target.data(), target.size());
+    if (len < 0 || static_cast<size_t>(len) >= target.size()) {
+        LOG_ERROR("copy: cannot read link " + src.string());
+        return false;
+    }
+    target[static_cast<size_t>(len)] = '\0';
+
+    if (unlink(dst.c_str()) != 0 && errno != ENOENT) {
+        std::error_code ec;
+        fs::remove_all(dst, ec);
+    }
+    if (symlink(target.data(), dst.c_str()) != 0) {
+        LOG_ERROR("copy: cannot create link " + dst.string() + ": " + strerror(errno));
+        return false;
+    }
+    if (lchown(dst.c_str(), st.st_uid, st.st_gid) != 0) {
+        LOG_VERBOSE("copy: lchown failed for " + dst.string());
+    }
+    lsetfilecon(dst, get_context_for_path(dst));
+    return true;
+}
+
 static bool native_cp_r(const fs::path& src, const fs::path& dst) {
     try {
         LOG_DEBUG("native_cp_r: " + src.string() + " -> " + dst.string());
@@ -368,17 +1073,8 @@ static bool native_cp_r(const fs::path& src, const fs::path& dst) {
                     LOG_ERROR("Failed to copy dir: " + entry.path().string());
                     return false;
                 }
-            } else if (fs::is_symlink(entry)) {
-                auto link_target = fs::read_symlink(entry.path());
-                if (fs::exists(dst_path)) {
-                    fs::remove(dst_path);
-                }
-                fs::create_symlink(link_target, dst_path);
-                lsetfilecon(dst_path, get_context_for_path(dst_path));
-            } else {
-                fs::copy_file(entry.path(), dst_path, fs::copy_options::overwrite_existing);
-                fs::permissions(dst_path, fs::status(entry.path()).permissions());
-                lsetfilecon(dst_path, get_context_for_path(dst_path));
+            } else if (!copy_node(entry.path(), dst_path)) {
+                return false;
             }
         }
 
@@ -409,15 +1105,101 @@ bool sync_dir(const fs::path& src, const fs::path& dst) {
     return result;
 }
 
-// Check if tmpfs supports xattr on this device
-bool check_tmpfs_xattr() {
-    fs::path temp_dir = select_temp_dir() / "xattr_check";
-    if (!mount_tmpfs(temp_dir)) {
+static bool walk_tree_fd(int dir_fd, const std::string& prefix, const WalkVisitor& visit) {
+    DIR* dir = fdopendir(dir_fd);
+    if (!dir) {
+        close(dir_fd);
+        return false;
+    }
+
+    bool ok = true;
+    while (struct dirent* ent = readdir(dir)) {
+        const char* name = ent->d_name;
+        if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) {
+            continue;
+        }
+
+        unsigned char type = ent->d_type;
+        if (type == DT_UNKNOWN) {
+            struct stat st;
+            if (fstatat(dirfd(dir), name, &st, AT_SYMLINK_NOFOLLOW) != 0) {
+                continue;
+            }
+            type = IFTODT(st.st_mode);
+        }
+
+        std::string rel = prefix.empty() ? std::string(name) : prefix + "/" + name;
+        bool descend = visit(WalkEntry{dirfd(dir), name, rel, type});
+
+        if (descend && type == DT_DIR) {
+            int child_fd =
+                openat(dirfd(dir), name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+            if (child_fd < 0 || !walk_tree_fd(child_fd, rel, visit)) {
+                ok = false;
+            }
+        }
+    }
+
+    closedir(dir);
+    return ok;
+}
+
+std::string file_signature(const fs::path& path) {
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0) {
+        return "-;";
+    }
+    return std::to_string(st.st_ino) + "." + std::to_string(st.st_size) + "." +
+           std::to_string(st.st_mtim.tv_sec) + "." + std::to_string(st.st_mtim.tv_nsec) + ";";
+}
+
+bool write_file_atomic(const fs::path& path, std::string_view data) {
+    fs::path tmp = path;
+    tmp += ".tmp." + std::to_string(getpid());
+    int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        return false;
+    }
+    size_t written = 0;
+    while (written < data.size()) {
+        ssize_t n = write(fd, data.data() + written, data.size() - written);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            break;
+        }
+        written += static_cast<size_t>(n);
+    }
+    bool ok = close(fd) == 0 && written == data.size();
+    if (!ok || rename(tmp.c_str(), path.c_str()) != 0) {
+        unlink(tmp.c_str());
         return false;
     }
-    bool supported = is_xattr_supported(temp_dir);
-    umount2(temp_dir.c_str(), MNT_DETACH);
-    rmdir(temp_dir.c_str());
+    return true;
+}
+
+bool walk_tree(const fs::path& root, const WalkVisitor& visit) {
+    int root_fd = open(root.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (root_fd < 0) {
+        return false;
+    }
+    return walk_tree_fd(root_fd, "", visit);
+}
+
+// Check if tmpfs supports xattr on this device
+bool check_tmpfs_xattr() {
+    // A kernel property; probe once so a long-lived daemon doesn't mount a tmpfs per query
+    static const bool supported = [] {
+        fs::path temp_dir = select_temp_dir() / "xattr_check";
+        if (!mount_tmpfs(temp_dir)) {
+            return false;
+        }
+        bool result = is_xattr_supported(temp_dir);
+        umount2(temp_dir.c_str(), MNT_DETACH);
+        rmdir(temp_dir.c_str());
+        return result;
+    }();
     return supported;
 }
 
@@ -527,35 +1309,81 @@ struct NukeExt4SysfsCmd {
 };
 #endif // #ifdef __ANDROID__
 
-bool send_unmountable(const fs::path& target) {
-#ifdef __ANDROID__
-    static std::set<std::string> sent_unmounts;
+// Registrations are held back until flush_unmountables(): KernelSU walks its try-umount list
+// on every app spawn, so only the outermost mount roots are sent, once each
+static std::mutex unmount_mutex;
+static std::vector<std::string> pending_unmounts;
+static std::set<std::string> sent_unmounts;
 
-    std::string path_str = target.string();
-    if (path_str.empty())
-        return true;
+void queue_unmountable(const fs::path& target) {
+    std::string path_str = target.lexically_normal().string();
+    while (path_str.size() > 1 && path_str.back() == '/') {
+        path_str.pop_back();
+    }
+    if (path_str.empty() || path_str[0] != '/') {
+        return;
+    }
 
-    // Dedup check
-    if (sent_unmounts.find(path_str) != sent_unmounts.end()) {
-        return true;
+    // Overlay groups register paths from several threads
+    std::lock_guard<std::mutex> lock(unmount_mutex);
+    pending_unmounts.push_back(std::move(path_str));
+}
+
+// True if `path` or one of its ancestors is in `roots`
+static bool covered_by(const std::string& path, const std::set<std::string>& roots) {
+    for (size_t pos = path.find('/', 1); pos != std::string::npos; pos = path.find('/', pos + 1)) {
+        if (roots.count(path.substr(0, pos))) {
+            return true;
+        }
     }
+    return roots.count(path) > 0;
+}
 
-    int fd = grab_ksu_fd();
-    if (fd < 0) {
-        return false;
+int flush_unmountables() {
+    std::lock_guard<std::mutex> lock(unmount_mutex);
+    if (pending_unmounts.empty()) {
+        return 0;
     }
 
-    KsuAddTryUmount cmd = {
-        .arg = reinterpret_cast<uint64_t>(path_str.c_str()), .flags = 2, .mode = 1};
+    // Shallowest first, so a root is always considered before anything nested inside it.
+    // A lazy umount of a root detaches every mount below it, so nested paths add nothing.
+    std::vector<std::string> pending;
+    pending.swap(pending_unmounts);
+    auto depth = [](const std::string& path) { return std::count(path.begin(), path.end(), '/'); };
+    std::stable_sort(pending.begin(), pending.end(),
+                     [&depth](const std::string& a, const std::string& b) {
+                         return depth(a) < depth(b);
+                     });
+    std::vector<std::string> roots;
+    std::set<std::string> covering = sent_unmounts;
+    for (auto& path : pending) {
+        if (!covered_by(path, covering)) {
+            covering.insert(path);
+            roots.push_back(std::move(path));
+        }
+    }
+    LOG_DEBUG("Try-umount: " + std::to_string(pending.size()) + " paths reduced to " +
+              std::to_string(roots.size()) + " roots");
 
-    if (ioctl(fd, KSU_IOCTL_ADD_TRY_UMOUNT, &cmd) == 0) {
-        sent_unmounts.insert(path_str);
-        LOG_DEBUG("Registered unmountable path: " + path_str);
-    } else {
-        LOG_WARN("Failed to register unmountable path: " + path_str);
+    int registered = 0;
+#ifdef __ANDROID__
+    int fd = grab_ksu_fd();
+    if (fd < 0) {
+        return 0;
+    }
+    for (const auto& path : roots) {
+        KsuAddTryUmount cmd = {
+            .arg = reinterpret_cast<uint64_t>(path.c_str()), .flags = 2, .mode = 1};
+        if (ioctl(fd, KSU_IOCTL_ADD_TRY_UMOUNT, &cmd) == 0) {
+            sent_unmounts.insert(path);
+            registered++;
+            LOG_DEBUG("Registered unmountable path: " + path);
+        } else {
+            LOG_WARN("Failed to register unmountable path: " + path);
+        }
     }
 #endif // #ifdef __ANDROID__
-    return true;
+    return registered;
 }
 
 bool ksu_nuke_sysfs(const std::string& target) {
@@ -1,56 +1,127 @@
 // utils.hpp - Utility functions
 #pragma once
 
+#include <atomic>
+#include <ctime>
 #include <filesystem>
+#include <functional>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <string_view>
+#include <thread>
 
 namespace fs = std::filesystem;
 
 namespace hymo {
 
 // Logging
+enum class LogLevel { ERROR, WARN, INFO, DEBUG, VERBOSE };
+
 class Logger {
 public:
     static Logger& getInstance();
+    // With a non-empty `log_path`, records are queued and appended to that file by a
+    // background writer (and still echoed to stderr unless stderr is that file).
+    // Otherwise they go to stderr synchronously.
     void init(bool debug, bool verbose, const fs::path& log_path);
-    void log(const std::string& level, const std::string& message);
+    bool enabled(LogLevel level) const {
+        return static_cast<int>(level) <= max_level_.load(std::memory_order_relaxed);
+    }
+    void log(LogLevel level, std::string message);
+    // Write out everything queued so far; also run on exit and on fatal signals
+    void flush();
+
+    struct Ring;
 
 private:
     Logger() = default;
-    bool debug_ = false;
-    bool verbose_ = false;
-    std::unique_ptr<std::ofstream> log_file_;
+    ~Logger();
+    void start_writer(int fd);
+    void stop_writer();
+    void writer_loop();
+    void drain();  // Caller holds write_mutex_
+    void format_record(LogLevel level, time_t time, const std::string& message,
+                       std::string& out);
+    void emit(const std::string& data);
+
+    std::atomic<int> max_level_{static_cast<int>(LogLevel::INFO)};
+    std::unique_ptr<Ring> ring_;
+    std::unique_ptr<std::thread> writer_;
+    std::mutex write_mutex_;  // Serializes output between the writer and flush()
+    int file_fd_ = -1;
+    bool echo_stderr_ = true;
+    char time_buf_[32] = {};
+    time_t time_cached_ = -1;
 };
 
-#define LOG_INFO(msg) Logger::getInstance().log("INFO", msg)
-#define LOG_WARN(msg) Logger::getInstance().log("WARN", msg)
-#define LOG_ERROR(msg) Logger::getInstance().log("ERROR", msg)
-#define LOG_DEBUG(msg) Logger::getInstance().log("DEBUG", msg)
-#define LOG_VERBOSE(msg) Logger::getInstance().log("VERBOSE", msg)
+// The message expression is only evaluated when its level is enabled
+#define HYMO_LOG(level, msg)                                          \
+    do {                                                              \
+        ::hymo::Logger& hymo_logger_ = ::hymo::Logger::getInstance(); \
+        if (hymo_logger_.enabled(level)) {                            \
+            hymo_logger_.log(level, msg);                             \
+        }                                                             \
+    } while (0)
+
+#define LOG_INFO(msg) HYMO_LOG(::hymo::LogLevel::INFO, msg)
+#define LOG_WARN(msg) HYMO_LOG(::hymo::LogLevel::WARN, msg)
+#define LOG_ERROR(msg) HYMO_LOG(::hymo::LogLevel::ERROR, msg)
+#define LOG_DEBUG(msg) HYMO_LOG(::hymo::LogLevel::DEBUG, msg)
+#define LOG_VERBOSE(msg) HYMO_LOG(::hymo::LogLevel::VERBOSE, msg)
 
 // File system utilities
 bool ensure_dir_exists(const fs::path& path);
 bool is_xattr_supported(const fs::path& path);
 bool lsetfilecon(const fs::path& path, const std::string& context);
 std::string lgetfilecon(const fs::path& path);
+// Like lgetfilecon, but reports missing files or labels instead of substituting a default
+bool try_lgetfilecon(const fs::path& path, std::string& context);
 std::string get_context_for_path(const fs::path& path);
 bool copy_path_context(const fs::path& src, const fs::path& dst);
 
-bool mount_tmpfs(const fs::path& target);
+// A size of 0 leaves the kernel default (half of RAM)
+bool mount_tmpfs(const fs::path& target, uint64_t size_bytes = 0);
 bool mount_image(const fs::path& image_path, const fs::path& target,
                  const std::string& fs_type = "ext4",
                  const std::string& options = "loop,rw,noatime");
 bool repair_image(const fs::path& image_path);
+// Grow the ext4 image mounted at mount_point to at least size_bytes without unmounting it.
+// Never shrinks.
+bool grow_mounted_image(const fs::path& image_path, const fs::path& mount_point,
+                        uint64_t size_bytes);
 bool sync_dir(const fs::path& src, const fs::path& dst);
+// Copy one regular file or symlink over dst, carrying mode and SELinux context
+bool copy_node(const fs::path& src, const fs::path& dst);
 bool has_files_recursive(const fs::path& path);
+// Inode, size and mtime of `path` as a short string; changes whenever the file is rewritten
+std::string file_signature(const fs::path& path);
+// Write `data` to a sibling temp file and rename it over `path`, so readers never see a
+// partial file
+bool write_file_atomic(const fs::path& path, std::string_view data);
 bool check_tmpfs_xattr();
 
+// fd-based directory walker (openat/readdir, never follows symlinks)
+struct WalkEntry {
+    int parent_fd;           // fd of the directory containing the entry
+    const char* name;        // entry name relative to parent_fd
+    const std::string& rel;  // path relative to the walk root, no leading '/'
+    unsigned char type;      // DT_* type, resolved with lstat when readdir reports DT_UNKNOWN
+};
+
+// Visitor returns false to skip descending into a directory entry
+using WalkVisitor = std::function<bool(const WalkEntry&)>;
+bool walk_tree(const fs::path& root, const WalkVisitor& visit);
+
 // EROFS support
 bool is_erofs_supported();
 
 // KSU utilities
-bool send_unmountable(const fs::path& target);
+// Queue a mount for KernelSU try-umount; nothing reaches the kernel until the flush
+void queue_unmountable(const fs::path& target);
+// Register the minimal covering set of queued mount roots in one batch; nested paths and
+// roots sent by an earlier flush are dropped. Returns how many roots were registered.
+int flush_unmountables();
 bool ksu_nuke_sysfs(const std::string& target);
 int grab_ksu_fd();
 
@@ -65,6 +65,10 @@ export const translations = {
       fsErofsDesc: 'Read-Only, High performance',
       fsExt4: 'ext4',
       fsExt4Desc: 'Read-Write, Persistent loop image',
+      fsDirect: 'direct',
+      fsDirectDesc: 'No copy, reads module directory in place',
+      fsZram: 'zram',
+      fsZramDesc: 'Read-Write, compressed in RAM (zram)',
       enableNuke: 'Enable Nuke Mode',
       disableUmount: 'Disable Unmount',
       enableStealth: 'Enable Stealth',
@@ -260,6 +264,10 @@ export const translations = {
       fsErofsDesc: '只读、高性能',
       fsExt4: 'ext4',
       fsExt4Desc: '可读写、持久化循环镜像',
+      fsDirect: 'direct',
+      fsDirectDesc: '不复制，直接读取模块目录',
+      fsZram: 'zram',
+      fsZramDesc: '可读写，内存中压缩存储 (zram)',
       enableNuke: '启用 Nuke',
       disableUmount: '禁用 Unmount',
       enableStealth: '启用隐身模式',
@@ -455,6 +463,10 @@ export const translations = {
       fsErofsDesc: '唯讀、高效能',
       fsExt4: 'ext4',
       fsExt4Desc: '可讀寫、持久化循環映像',
+      fsDirect: 'direct',
+      fsDirectDesc: '不複製，直接讀取模組目錄',
+      fsZram: 'zram',
+      fsZramDesc: '可讀寫，記憶體中壓縮儲存 (zram)',
       enableNuke: '啟用 Nuke',
       disableUmount: '停用 Unmount',
       enableStealth: '啟用隱身模式',
@@ -650,6 +662,10 @@ export const translations = {
       fsErofsDesc: 'Lecture seule, haute performance',
       fsExt4: 'ext4',
       fsExt4Desc: 'Lecture-écriture, image loop persistante',
+      fsDirect: 'direct',
+      fsDirectDesc: 'Sans copie, lit le dossier du module sur place',
+      fsZram: 'zram',
+      fsZramDesc: 'Lecture-écriture, compressé en RAM (zram)',
       enableNuke: 'Activer Nuke',
       disableUmount: 'Désactiver Unmount',
       enableStealth: 'Mode furtif',
@@ -845,6 +861,10 @@ export const translations = {
       fsErofsDesc: 'Solo lectura, alto rendimiento',
       fsExt4: 'ext4',
       fsExt4Desc: 'Lectura-escritura, imagen loop persistente',
+      fsDirect: 'direct',
+      fsDirectDesc: 'Sin copia, lee el directorio del módulo en su lugar',
+      fsZram: 'zram',
+      fsZramDesc: 'Lectura-escritura, comprimido en RAM (zram)',
       enableNuke: 'Activar Nuke',
       disableUmount: 'Desactivar Unmount',
       enableStealth: 'Modo sigiloso',
@@ -1040,6 +1060,10 @@ export const translations = {
       fsErofsDesc: 'Только чтение, высокая производительность',
       fsExt4: 'ext4',
       fsExt4Desc: 'Чтение-запись, постоянный образ loop',
+      fsDirect: 'direct',
+      fsDirectDesc: 'Без копирования, чтение каталога модуля на месте',
+      fsZram: 'zram',
+      fsZramDesc: 'Чтение-запись, сжатие в RAM (zram)',
       enableNuke: 'Nuke режим',
       disableUmount: 'Откл. Unmount',
       enableStealth: 'Скрытый режим',
@@ -1235,6 +1259,10 @@ export const translations = {
       fsErofsDesc: '読み取り専用、高性能',
       fsExt4: 'ext4',
       fsExt4Desc: '読み書き可能、永続的なループイメージ',
+      fsDirect: 'direct',
+      fsDirectDesc: 'コピーなし、モジュールディレクトリを直接読み取り',
+      fsZram: 'zram',
+      fsZramDesc: '読み書き可能、RAM上で圧縮 (zram)',
       enableNuke: 'Nuke有効化',
       disableUmount: 'Unmount無効化',
       enableStealth: 'ステルスモード',
@@ -1430,6 +1458,10 @@ export const translations = {
       fsErofsDesc: '읽기 전용, 고성능',
       fsExt4: 'ext4',
       fsExt4Desc: '읽기-쓰기, 영구 루프 이미지',
+      fsDirect: 'direct',
+      fsDirectDesc: '복사 없이 모듈 디렉터리를 직접 읽기',
+      fsZram: 'zram',
+      fsZramDesc: '읽기-쓰기, RAM에 압축 저장 (zram)',
       enableNuke: 'Nuke 활성',
       disableUmount: 'Unmount 비활성',
       enableStealth: '스텔스 모드',
@@ -1625,6 +1657,10 @@ export const translations = {
       fsErofsDesc: 'قراءة فقط، أداء عالي',
       fsExt4: 'ext4',
       fsExt4Desc: 'قراءة-كتابة، صورة حلقية دائمة',
+      fsDirect: 'direct',
+      fsDirectDesc: 'بدون نسخ، يقرأ مجلد الوحدة مباشرة',
+      fsZram: 'zram',
+      fsZramDesc: 'قراءة وكتابة، مضغوط في الذاكرة (zram)',
       enableNuke: 'تمكين Nuke',
       disableUmount: 'تعطيل Unmount',
       enableStealth: 'وضع التخفي',
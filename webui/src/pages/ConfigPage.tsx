@@ -132,6 +132,8 @@ export function ConfigPage() {
                 { value: "tmpfs", label: t.config.fsTmpfs, description: t.config.fsTmpfsDesc, disabled: !config.tmpfs_xattr_supported },
                 { value: "erofs", label: t.config.fsErofs, description: t.config.fsErofsDesc },
                 { value: "ext4", label: t.config.fsExt4, description: t.config.fsExt4Desc },
+                { value: "direct", label: t.config.fsDirect, description: t.config.fsDirectDesc },
+                { value: "zram", label: t.config.fsZram, description: t.config.fsZramDesc },
             ]}
             value={config.fs_type}
             onChange={(val) => updateConfig({ fs_type: val })}
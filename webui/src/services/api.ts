@@ -101,6 +101,10 @@ const mockApi = {
         dirs_mounted: 15,
         symlinks_created: 10,
         overlayfs_mounts: 0,
+        try_umount_roots: 4,
+        mount_budget: 0,
+        predicted_mounts: 36,
+        mounts_added: 36,
         success_rate: 97.8,
       },
       detectedPartitions: [
@@ -184,6 +188,11 @@ const realApi = {
       uname_release: config.uname_release,
       uname_version: config.uname_version,
       mount_stage: config.mount_stage,
+      sync_jobs: config.sync_jobs,
+      dedup: config.dedup,
+      erofs_recompress: config.erofs_recompress,
+      tmpfs_max_ram_percent: config.tmpfs_max_ram_percent,
+      max_mounts: config.max_mounts,
       partitions: config.partitions,
     }
     const data = JSON.stringify(configToSave, null, 2).replace(/'/g, "'\\''")
@@ -23,6 +23,11 @@ export const DEFAULT_CONFIG = {
   uname_release: '',
   uname_version: '',
   mount_stage: 'metamount',
+  sync_jobs: 0,
+  dedup: false,
+  erofs_recompress: false,
+  tmpfs_max_ram_percent: 25,
+  max_mounts: 0,
   partitions: [] as string[],
   hymofs_available: false,
   tmpfs_xattr_supported: false,
@@ -58,7 +63,7 @@ export type StorageInfo = {
   used: string
   avail: string
   percent: number
-  mode: 'tmpfs' | 'ext4' | 'erofs' | 'hymofs' | null
+  mode: 'tmpfs' | 'ext4' | 'erofs' | 'direct' | 'zram' | 'hymofs' | null
 }
 
 export type SystemInfo = {
@@ -83,6 +88,10 @@ export type MountStatistics = {
   dirs_mounted: number
   symlinks_created: number
   overlayfs_mounts: number
+  try_umount_roots?: number
+  mount_budget?: number
+  predicted_mounts?: number
+  mounts_added?: number
   success_rate?: number
 }
 